@@ -14,43 +14,158 @@
 
 #define NUMOF(x) (int)(sizeof(x)/sizeof(*(x)))
 
-bool check_gnss_config_in_ram(RX_t *rx, UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg)
+#define CFG_RAM_MAX_KV 3000
+
+static int _kvCompareId(const void *a, const void *b)
 {
-    bool receiverconfigured = true;
+    const uint32_t idA = ((const UBLOXCFG_KEYVAL_t *)a)->id;
+    const uint32_t idB = ((const UBLOXCFG_KEYVAL_t *)b)->id;
+    return (idA > idB) - (idA < idB);
+}
 
-    // Get current
+// Read all items of a configuration layer, sorted by key ID. Returns number of items, -1 on error
+static int _getLayerConfig(RX_t *rx, UBLOXCFG_LAYER_t layer, UBLOXCFG_KEYVAL_t **kv)
+{
     const uint32_t keys[] = { UBX_CFG_VALGET_V0_ALL_WILDCARD };
-    UBLOXCFG_KEYVAL_t allKvRam[3000];
-    memset(allKvRam, 0, sizeof(allKvRam));
-    const int nAllKvRam = rxGetConfig(rx, UBLOXCFG_LAYER_RAM, keys, NUMOF(keys), allKvRam, NUMOF(allKvRam));
+    *kv = calloc(CFG_RAM_MAX_KV, sizeof(UBLOXCFG_KEYVAL_t));
+    if (*kv == NULL)
+    {
+        log_warn("malloc fail");
+        return -1;
+    }
+    const int nKv = rxGetConfig(rx, layer, keys, NUMOF(keys), *kv, CFG_RAM_MAX_KV);
+    if (nKv < 0)
+    {
+        free(*kv);
+        *kv = NULL;
+        return -1;
+    }
+    qsort(*kv, nKv, sizeof(**kv), _kvCompareId);
+    return nKv;
+}
+
+static void _logDiff(const UBLOXCFG_KEYVAL_t *kvCfg, const UBLOXCFG_KEYVAL_t *kvCur, const char *layer)
+{
+    char strCfg[UBLOXCFG_MAX_KEYVAL_STR_SIZE];
+    char strCur[UBLOXCFG_MAX_KEYVAL_STR_SIZE];
+
+    if (kvCur == NULL)
+    {
+        if (ubloxcfg_stringifyKeyVal(strCfg, sizeof(strCfg), kvCfg))
+        {
+            log_debug("Config (%s) is not stored in %s", strCfg, layer);
+        }
+    }
+    else if (ubloxcfg_stringifyKeyVal(strCfg, sizeof(strCfg), kvCfg) &&
+             ubloxcfg_stringifyKeyVal(strCur, sizeof(strCur), kvCur) )
+    {
+        log_debug("Config (%s) differs from %s config (%s)", strCfg, layer, strCur);
+    }
+}
+
+int get_gnss_config_diff(RX_t *rx, const UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg, UBLOXCFG_KEYVAL_t *diffKv)
+{
+    // Get current
+    UBLOXCFG_KEYVAL_t *allKvRam;
+    const int nAllKvRam = _getLayerConfig(rx, UBLOXCFG_LAYER_RAM, &allKvRam);
+    if (nAllKvRam <= 0)
+    {
+        log_warn("Could not read receiver configuration");
+        free(allKvRam);
+        return -1;
+    }
 
     // Check all items from config file
+    int nDiffKv = 0;
     for (int ixKvCfg = 0; ixKvCfg < nAllKvCfg; ixKvCfg++)
     {
         const UBLOXCFG_KEYVAL_t *kvCfg = &allKvCfg[ixKvCfg];
+        const UBLOXCFG_KEYVAL_t *kvRam = bsearch(kvCfg, allKvRam, nAllKvRam, sizeof(*allKvRam), _kvCompareId);
 
-        // Check current configuration
-        for (int ixKvRam = 0; ixKvRam < nAllKvRam; ixKvRam++)
+        // Items unknown to the receiver are not reported by VALGET, skip them as well
+        if ( (kvRam == NULL) || (kvRam->val._raw == kvCfg->val._raw) )
         {
-            const UBLOXCFG_KEYVAL_t *kvRam = &allKvRam[ixKvRam];
-            if (kvRam->id == kvCfg->id)
-            {
-                if (kvRam->val._raw != kvCfg->val._raw)
-                {
-                    receiverconfigured = false;
-                    char strCfg[UBLOXCFG_MAX_KEYVAL_STR_SIZE];
-                    char strRam[UBLOXCFG_MAX_KEYVAL_STR_SIZE];
-                    if (ubloxcfg_stringifyKeyVal(strCfg, sizeof(strCfg), kvCfg) &&
-                        ubloxcfg_stringifyKeyVal(strRam, sizeof(strRam), kvRam) )
-                    {
-                        log_debug("Config (%s) differs from current config (%s)", strCfg, strRam);
-                    }
-                }
-            }
+            continue;
         }
+
+        _logDiff(kvCfg, kvRam, "current");
+        diffKv[nDiffKv++] = *kvCfg;
+    }
+
+    free(allKvRam);
+    return nDiffKv;
+}
+
+int get_gnss_persisted_config_diff(RX_t *rx, const UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg, UBLOXCFG_KEYVAL_t *diffKv)
+{
+    UBLOXCFG_KEYVAL_t *allKvRam;
+    UBLOXCFG_KEYVAL_t *allKvBbr;
+    UBLOXCFG_KEYVAL_t *allKvFlash;
+    const int nAllKvRam = _getLayerConfig(rx, UBLOXCFG_LAYER_RAM, &allKvRam);
+    const int nAllKvBbr = _getLayerConfig(rx, UBLOXCFG_LAYER_BBR, &allKvBbr);
+    int nAllKvFlash = _getLayerConfig(rx, UBLOXCFG_LAYER_FLASH, &allKvFlash);
+    int nDiffKv = 0;
+
+    if ( (nAllKvRam <= 0) || (nAllKvBbr < 0) )
+    {
+        log_warn("Could not read receiver configuration");
+        nDiffKv = -1;
+        goto out;
+    }
+    // Receivers without flash only persist in BBR
+    if (nAllKvFlash < 0)
+    {
+        nAllKvFlash = 0;
+    }
+
+    for (int ixKvCfg = 0; ixKvCfg < nAllKvCfg; ixKvCfg++)
+    {
+        const UBLOXCFG_KEYVAL_t *kvCfg = &allKvCfg[ixKvCfg];
+        const UBLOXCFG_KEYVAL_t *kvRam = bsearch(kvCfg, allKvRam, nAllKvRam, sizeof(*allKvRam), _kvCompareId);
+        const UBLOXCFG_KEYVAL_t *kvBbr = bsearch(kvCfg, allKvBbr, nAllKvBbr, sizeof(*allKvBbr), _kvCompareId);
+        const UBLOXCFG_KEYVAL_t *kvFlash = nAllKvFlash > 0 ?
+            bsearch(kvCfg, allKvFlash, nAllKvFlash, sizeof(*allKvFlash), _kvCompareId) : NULL;
+
+        // Items unknown to the receiver are not reported by VALGET, skip them as well
+        if (kvRam == NULL)
+        {
+            continue;
+        }
+        // At boot, BBR overrides Flash which overrides defaults
+        const UBLOXCFG_KEYVAL_t *kvBoot = kvBbr != NULL ? kvBbr : kvFlash;
+        if (kvRam->val._raw != kvCfg->val._raw)
+        {
+            _logDiff(kvCfg, kvRam, "current");
+        }
+        else if ( (kvBoot == NULL) || (kvBoot->val._raw != kvCfg->val._raw) )
+        {
+            _logDiff(kvCfg, kvBoot, kvBbr != NULL ? "BBR" : "Flash");
+        }
+        else
+        {
+            continue;
+        }
+        diffKv[nDiffKv++] = *kvCfg;
     }
-    return receiverconfigured;
 
+out:
+    free(allKvRam);
+    free(allKvBbr);
+    free(allKvFlash);
+    return nDiffKv;
+}
+
+bool check_gnss_config_in_ram(RX_t *rx, UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg)
+{
+    UBLOXCFG_KEYVAL_t *diffKv = malloc(nAllKvCfg * sizeof(UBLOXCFG_KEYVAL_t));
+    if (diffKv == NULL)
+    {
+        log_warn("malloc fail");
+        return false;
+    }
+    const int nDiffKv = get_gnss_config_diff(rx, allKvCfg, nAllKvCfg, diffKv);
+    free(diffKv);
+    return nDiffKv == 0;
 }
 
 /* ****************************************************************************************************************** */
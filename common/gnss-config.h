@@ -4,6 +4,21 @@
 #include <ff/ff_rx.h>
 #include <ubloxcfg/ubloxcfg.h>
 
+/**
+ * @brief Compute the items of allKvCfg whose value differs in the receiver's RAM layer
+ *
+ * @param diffKv Output differing items, must hold nAllKvCfg items
+ * @return number of differing items, -1 if current configuration could not be read
+ */
+int get_gnss_config_diff(RX_t *rx, const UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg, UBLOXCFG_KEYVAL_t *diffKv);
+/**
+ * @brief Compute the items of allKvCfg whose value differs in the receiver's RAM
+ * layer or in the configuration it loads at boot, from its BBR and Flash layers
+ *
+ * @param diffKv Output differing items, must hold nAllKvCfg items
+ * @return number of differing items, -1 if current configuration could not be read
+ */
+int get_gnss_persisted_config_diff(RX_t *rx, const UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg, UBLOXCFG_KEYVAL_t *diffKv);
 bool check_gnss_config_in_ram(RX_t *rx, UBLOXCFG_KEYVAL_t *allKvCfg, int nAllKvCfg);
 UBLOXCFG_KEYVAL_t *get_default_value_from_config(int *nKv, int major, int minor);
 
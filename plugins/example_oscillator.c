@@ -0,0 +1,93 @@
+/**
+ * @file example_oscillator.c
+ * @brief Minimal oscillator driver plugin
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Keeps its control value in memory. Copy it as a starting point for an out
+ * of tree driver: build it as a shared object against oscillatord's installed
+ * headers, drop it in oscillator-plugins-dir and set oscillator=example.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "oscillator.h"
+#include "oscillator_factory.h"
+
+#define FACTORY_NAME "example"
+
+#define EXAMPLE_SETPOINT_MIN 0
+#define EXAMPLE_SETPOINT_MAX 1000000
+
+struct example_oscillator {
+	struct oscillator oscillator;
+	uint32_t dac;
+};
+
+static int example_oscillator_get_ctrl(struct oscillator *oscillator,
+		struct oscillator_ctrl *ctrl)
+{
+	struct example_oscillator *example = (struct example_oscillator *) oscillator;
+
+	ctrl->dac = example->dac;
+	return 0;
+}
+
+static int example_oscillator_parse_attributes(struct oscillator *oscillator,
+		struct oscillator_attributes *attributes)
+{
+	attributes->temperature = 25.0;
+	attributes->locked = true;
+	return 0;
+}
+
+static int example_oscillator_apply_output(struct oscillator *oscillator,
+		struct od_output *output)
+{
+	struct example_oscillator *example = (struct example_oscillator *) oscillator;
+
+	log_debug("%s: setpoint %d", oscillator->name, output->setpoint);
+	example->dac = output->setpoint;
+	return 0;
+}
+
+static struct oscillator *example_oscillator_new(const struct config *config,
+		struct devices_path *devices_path)
+{
+	struct example_oscillator *example;
+
+	example = calloc(1, sizeof(*example));
+	if (example == NULL)
+		return NULL;
+
+	oscillator_factory_init(FACTORY_NAME, &example->oscillator, FACTORY_NAME);
+	example->dac = (EXAMPLE_SETPOINT_MIN + EXAMPLE_SETPOINT_MAX) / 2;
+
+	return &example->oscillator;
+}
+
+static void example_oscillator_destroy(struct oscillator **oscillator)
+{
+	memset(*oscillator, 0, sizeof(struct example_oscillator));
+	free(*oscillator);
+	*oscillator = NULL;
+}
+
+static const struct oscillator_factory example_oscillator_factory = {
+	.class = {
+			.name = FACTORY_NAME,
+			.get_ctrl = example_oscillator_get_ctrl,
+			.parse_attributes = example_oscillator_parse_attributes,
+			.apply_output = example_oscillator_apply_output,
+			/* Nothing here blocks */
+			.capabilities = OSCILLATOR_CAP_ASYNC_IO,
+			.dac_min = EXAMPLE_SETPOINT_MIN,
+			.dac_max = EXAMPLE_SETPOINT_MAX,
+	},
+	.new = example_oscillator_new,
+	.destroy = example_oscillator_destroy,
+};
+
+OSCILLATOR_DRIVER(example_oscillator_factory);
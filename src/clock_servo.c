@@ -0,0 +1,202 @@
+/**
+ * @file clock_servo.c
+ * @brief Offset measurement against a PHC and PI servo steering a clock
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/timex.h>
+
+#include <linux/ptp_clock.h>
+
+#include "clock_servo.h"
+#include "log.h"
+#include "utils.h"
+
+/* Gains of the PI servo for one sample per second, as phc2sys */
+#define CLOCK_SERVO_KP 0.7
+#define CLOCK_SERVO_KI 0.3
+#define CLOCK_SERVO_FIRST_STEP_THRESHOLD_NS 20000
+
+/* Frequency unit of struct timex, ppm with 16 bits fractional part */
+#define TIMEX_FREQ_PER_PPB 65.536
+
+static int64_t ptp_time_to_ns(const struct ptp_clock_time *t)
+{
+	return (int64_t) t->sec * NS_IN_SECOND + t->nsec;
+}
+
+/**
+ * @brief Find best way to measure offset of a PHC to the system clock
+ *
+ * @param fd PHC file descriptor
+ * @return enum phc_offset_method
+ */
+enum phc_offset_method phc_offset_probe(int fd)
+{
+	struct ptp_sys_offset_precise precise;
+
+	memset(&precise, 0, sizeof(precise));
+	if (ioctl(fd, PTP_SYS_OFFSET_PRECISE, &precise) == 0) {
+		log_info("PHC supports hardware cross timestamps");
+		return PHC_OFFSET_PRECISE;
+	}
+	return PHC_OFFSET_EXTENDED;
+}
+
+/**
+ * @brief Measure offset of a PHC to the system clock
+ *
+ * @param fd PHC file descriptor
+ * @param method measure method, from phc_offset_probe
+ * @param nb_samples number of PHC reads, the one in the tightest system time
+ * window is kept. Not used with PHC_OFFSET_PRECISE
+ * @param result Output offset
+ * @return 0 on success, -errno on error
+ */
+int phc_offset_measure(int fd, enum phc_offset_method method, int nb_samples, struct phc_offset *result)
+{
+	struct ptp_sys_offset_extended extended;
+	struct ptp_sys_offset_precise precise;
+	int64_t best_delay = INT64_MAX;
+	unsigned int i;
+
+	if (method == PHC_OFFSET_PRECISE) {
+		memset(&precise, 0, sizeof(precise));
+		if (ioctl(fd, PTP_SYS_OFFSET_PRECISE, &precise) != 0)
+			return -errno;
+		result->sys_time = ptp_time_to_ns(&precise.sys_realtime);
+		result->offset = ptp_time_to_ns(&precise.device) - result->sys_time;
+		result->delay = 0;
+		return 0;
+	}
+
+	memset(&extended, 0, sizeof(extended));
+	extended.n_samples = nb_samples < 1 ? 1 : (nb_samples > PTP_MAX_SAMPLES ? PTP_MAX_SAMPLES : nb_samples);
+	if (ioctl(fd, PTP_SYS_OFFSET_EXTENDED, &extended) != 0)
+		return -errno;
+
+	for (i = 0; i < extended.n_samples; i++) {
+		int64_t before = ptp_time_to_ns(&extended.ts[i][0]);
+		int64_t phc = ptp_time_to_ns(&extended.ts[i][1]);
+		int64_t after = ptp_time_to_ns(&extended.ts[i][2]);
+
+		if (after - before < best_delay) {
+			best_delay = after - before;
+			result->sys_time = before + best_delay / 2;
+			result->offset = phc - result->sys_time;
+			result->delay = best_delay;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Initialize PI servo
+ *
+ * @param servo
+ * @param initial_ppb current frequency adjustment of the clock
+ * @param max_ppb maximum frequency adjustment of the clock
+ */
+void clock_servo_init(struct clock_servo *servo, double initial_ppb, double max_ppb)
+{
+	servo->kp = CLOCK_SERVO_KP;
+	servo->ki = CLOCK_SERVO_KI;
+	servo->integral = initial_ppb;
+	servo->max_ppb = max_ppb;
+	servo->first_step_threshold = CLOCK_SERVO_FIRST_STEP_THRESHOLD_NS;
+	servo->state = CLOCK_SERVO_UNLOCKED;
+}
+
+/**
+ * @brief Feed servo with an offset
+ *
+ * @param servo
+ * @param offset offset of the steered clock to the reference, in ns
+ * @param state Output CLOCK_SERVO_JUMP if clock must be stepped by -offset
+ * @return double frequency adjustment to apply, in ppb
+ */
+double clock_servo_sample(struct clock_servo *servo, int64_t offset, enum clock_servo_state *state)
+{
+	double ppb;
+
+	if (servo->state == CLOCK_SERVO_UNLOCKED) {
+		servo->state = CLOCK_SERVO_LOCKED;
+		if (llabs(offset) > servo->first_step_threshold) {
+			*state = CLOCK_SERVO_JUMP;
+			return servo->integral;
+		}
+	}
+
+	/* Clock ahead of reference must slow down */
+	servo->integral -= servo->ki * offset;
+	servo->integral = fmax(-servo->max_ppb, fmin(servo->max_ppb, servo->integral));
+	ppb = servo->integral - servo->kp * offset;
+	*state = CLOCK_SERVO_LOCKED;
+	return fmax(-servo->max_ppb, fmin(servo->max_ppb, ppb));
+}
+
+/**
+ * @brief Get frequency adjustment of a clock
+ *
+ * @param clkid
+ * @param ppb Output frequency adjustment
+ * @return 0 on success, -errno on error
+ */
+int clock_get_frequency(clockid_t clkid, double *ppb)
+{
+	struct timex timex = { .modes = 0 };
+
+	if (clock_adjtime(clkid, &timex) < 0)
+		return -errno;
+	*ppb = timex.freq / TIMEX_FREQ_PER_PPB;
+	return 0;
+}
+
+/**
+ * @brief Set frequency adjustment of a clock
+ *
+ * @param clkid
+ * @param ppb frequency adjustment
+ * @return 0 on success, -errno on error
+ */
+int clock_set_frequency(clockid_t clkid, double ppb)
+{
+	struct timex timex = {
+		.modes = ADJ_FREQUENCY,
+		.freq = (long) (ppb * TIMEX_FREQ_PER_PPB),
+	};
+
+	if (clock_adjtime(clkid, &timex) < 0)
+		return -errno;
+	return 0;
+}
+
+/**
+ * @brief Step a clock
+ *
+ * @param clkid
+ * @param offset offset to add to the clock, in ns
+ * @return 0 on success, -errno on error
+ */
+int clock_step(clockid_t clkid, int64_t offset)
+{
+	struct timex timex = {
+		.modes = ADJ_SETOFFSET | ADJ_NANO,
+		.time.tv_sec = offset / NS_IN_SECOND,
+		.time.tv_usec = offset % NS_IN_SECOND,
+	};
+
+	if (timex.time.tv_usec < 0) {
+		timex.time.tv_sec--;
+		timex.time.tv_usec += NS_IN_SECOND;
+	}
+	if (clock_adjtime(clkid, &timex) < 0)
+		return -errno;
+	return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file clock_servo.h
+ * @brief Offset measurement against a PHC and PI servo steering a clock
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * PHC to system clock offsets are read with PTP_SYS_OFFSET_PRECISE when the
+ * driver supports hardware cross timestamps, with PTP_SYS_OFFSET_EXTENDED
+ * otherwise, keeping the sample read in the tightest system time window.
+ */
+#ifndef OSCILLATORD_CLOCK_SERVO_H
+#define OSCILLATORD_CLOCK_SERVO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+enum phc_offset_method {
+	PHC_OFFSET_PRECISE,
+	PHC_OFFSET_EXTENDED,
+};
+
+/**
+ * @struct phc_offset
+ * @brief Offset of a PHC to the system clock at a given system time
+ */
+struct phc_offset {
+	/** PHC time minus CLOCK_REALTIME, in ns */
+	int64_t offset;
+	/** Width of the system time window the PHC was read in, in ns */
+	int64_t delay;
+	/** CLOCK_REALTIME when PHC was read, in ns */
+	int64_t sys_time;
+};
+
+enum clock_servo_state {
+	CLOCK_SERVO_UNLOCKED,
+	CLOCK_SERVO_JUMP,
+	CLOCK_SERVO_LOCKED,
+};
+
+/**
+ * @struct clock_servo
+ * @brief PI servo computing frequency adjustments from offsets
+ */
+struct clock_servo {
+	double kp;
+	double ki;
+	/** Integral term, frequency adjustment in ppb */
+	double integral;
+	/** Maximum frequency adjustment, in ppb */
+	double max_ppb;
+	/** Offset above which clock is stepped on first sample, in ns */
+	int64_t first_step_threshold;
+	enum clock_servo_state state;
+};
+
+enum phc_offset_method phc_offset_probe(int fd);
+int phc_offset_measure(int fd, enum phc_offset_method method, int nb_samples, struct phc_offset *result);
+void clock_servo_init(struct clock_servo *servo, double initial_ppb, double max_ppb);
+double clock_servo_sample(struct clock_servo *servo, int64_t offset, enum clock_servo_state *state);
+int clock_get_frequency(clockid_t clkid, double *ppb);
+int clock_set_frequency(clockid_t clkid, double ppb);
+int clock_step(clockid_t clkid, int64_t offset);
+
+#endif /* OSCILLATORD_CLOCK_SERVO_H */
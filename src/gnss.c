@@ -1,13 +1,12 @@
 #include <errno.h>
 #include <error.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/timex.h>
-#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -20,7 +19,11 @@
 
 #include "gnss.h"
 #include "gnss-config.h"
+#include "gnss_assistance.h"
 #include "log.h"
+#include "phasemeter.h"
+#include "survey_cache.h"
+#include "ubx_capture.h"
 #include "utils.h"
 #include "f9_defvalsets.h"
 
@@ -29,7 +32,29 @@
 #define GNSS_CONNECT_MAX_TRY 5
 
 #define GNSS_TIMEOUT_MS 1200
+/** Consumers give up if no epoch is published for this long */
+#define GNSS_EPOCH_TIMEOUT_MS 10000
 #define GNSS_RECONFIGURE_MAX_TRY 5
+/** Baudrate used to connect to the receiver, set by default configuration */
+#define GNSS_DEFAULT_BAUDRATE 115200
+/** Rate of messages only needed occasionally, in navigation epochs */
+#define GNSS_SLOW_MSG_RATE 10
+/** Leap second information is needed every epoch when the event is closer than this (s) */
+#define GNSS_LEAP_SECOND_WATCH_S (60 * 60 * 24)
+/** With a fixed antenna position, time accuracy above this limit (ns) ... */
+#define GNSS_FIXED_POS_MAX_TACC_NS 100
+/** ... for this number of consecutive epochs ... */
+#define GNSS_FIXED_POS_MAX_BAD_EPOCHS 60
+/** ... with an RMS of pseudorange residuals above this limit (m) means the antenna moved */
+#define GNSS_FIXED_POS_MAX_PRRES_M 10.0
+/** Serial latencies are reported once every GNSS_LATENCY_REPORT_PERIOD epochs */
+#define GNSS_LATENCY_REPORT_PERIOD 60
+/* Period of the navigation database dumps (s) */
+#define GNSS_ASSISTANCE_DEFAULT_PERIOD_S 3600
+/* PHC time before 2022-01-01 is considered as never set (TAI) */
+#define GNSS_PHC_MIN_VALID_TAI (1640995200 + 37)
+/* Maximum offset between PHC and GNSS PPS once PHC time is set (ns) */
+#define GNSS_PHC_SET_MAX_ERROR_NS 10000
 #define SEC_IN_WEEK 604800
 
 #define GPS_EPOCH_TO_TAI 315964819
@@ -59,6 +84,8 @@
 #endif
 
 #define RTCM_SOCK_PATH "/run/oscillatord/rtcm.sock"
+#define RTCM_DEFAULT_MAX_CLIENTS 4
+#define RTCM_DEFAULT_BUFFER_SIZE 65536
 
 /** The resolution of our phasemeter in pico seconds */
 #define QERR_ABS_THRESHOLD_PS 5000
@@ -154,6 +181,42 @@ static time_t gnss_get_utc_time(EPOCH_t *epoch)
 	return time;
 }
 
+/**
+ * @brief Parse UBX-NAV-SAT msg to get the pseudorange residuals of the
+ * satellites used in the navigation solution
+ *
+ * @param gnss
+ * @param msg msg received from the receiver
+ */
+static void gnss_parse_ubx_nav_sat(struct gnss *gnss, PARSER_MSG_t *msg)
+{
+	UBX_NAV_SAT_V1_GROUP0_t gr0;
+	UBX_NAV_SAT_V1_GROUP1_t gr1;
+	int offs = UBX_HEAD_SIZE;
+	double sum = 0.0;
+	int used = 0;
+
+	if (msg->size < (int) UBX_NAV_SAT_V1_MIN_SIZE ||
+	    UBX_NAV_SAT_VERSION_GET(msg->data) != UBX_NAV_SAT_V1_VERSION)
+		return;
+	memcpy(&gr0, &msg->data[offs], sizeof(gr0));
+	offs += sizeof(gr0);
+
+	for (int i = 0; i < gr0.numSvs && offs <= msg->size - 2 - (int) sizeof(gr1); i++) {
+		memcpy(&gr1, &msg->data[offs], sizeof(gr1));
+		offs += sizeof(gr1);
+		if (!FLAG(gr1.flags, UBX_NAV_SAT_V1_FLAGS_SVUSED))
+			continue;
+		sum += pow(gr1.prRes * UBX_NAV_SAT_V1_PRRES_SCALE, 2);
+		used++;
+	}
+	if (used == 0)
+		return;
+	gnss->fixed_position_prres_rms = sqrt(sum / used);
+	log_trace("UBX-NAV-SAT: pseudorange residuals rms %.1f m over %d satellites",
+		gnss->fixed_position_prres_rms, used);
+}
+
 /**
  * @brief Parse UBX-NAV-TIMELS msg to get leap second data
  *
@@ -292,6 +355,11 @@ static enum SurveyInState gnss_parse_ubx_tim_svin(struct gps_device_t *session,
 			          gr0.active);
 		}
 		session->survey_in_position_error = sqrt(gr0.meanV)/1000;
+		session->survey_position.ecef_x = gr0.meanX;
+		session->survey_position.ecef_y = gr0.meanY;
+		session->survey_position.ecef_z = gr0.meanZ;
+		/* meanV is in mm^2, fixed position accuracy in 0.1 mm */
+		session->survey_position.accuracy = sqrt(gr0.meanV) * 10;
 		if (!gr0.active && gr0.dur >= SVIN_MIN_DUR)
 			return gr0.valid ? SURVEY_IN_COMPLETED : SURVEY_IN_KO;
 		else if (gr0.dur < SVIN_MAX_DUR)
@@ -488,13 +556,277 @@ static bool set_cable_delay(UBLOXCFG_KEYVAL_t* keyValuePairs, size_t length, con
 	return false;
 }
 
+/** UBX messages whose UART1 output rate is managed at runtime, see enum gnss_msg */
+static const char *gnss_msg_names[GNSS_MSG_COUNT] = {
+	[GNSS_MSG_NAV_PVT] = "UBX-NAV-PVT",
+	[GNSS_MSG_NAV_EOE] = "UBX-NAV-EOE",
+	[GNSS_MSG_NAV_TIMEUTC] = "UBX-NAV-TIMEUTC",
+	[GNSS_MSG_NAV_TIMELS] = "UBX-NAV-TIMELS",
+	[GNSS_MSG_TIM_TP] = "UBX-TIM-TP",
+	[GNSS_MSG_TIM_SVIN] = "UBX-TIM-SVIN",
+	[GNSS_MSG_MON_RF] = "UBX-MON-RF",
+	[GNSS_MSG_NAV_SAT] = "UBX-NAV-SAT",
+};
+
+/**
+ * @brief Get UART1 output rate configuration item ID of a managed message
+ *
+ * @return item ID, 0 if not supported
+ */
+static uint32_t gnss_msg_rate_id(enum gnss_msg msg)
+{
+	const UBLOXCFG_MSGRATE_t *items = ubloxcfg_getMsgRateCfg(gnss_msg_names[msg]);
+
+	if (items == NULL || items->itemUart1 == NULL)
+		return 0;
+	return items->itemUart1->id;
+}
+
+/** Messages whose rate only lives in RAM, see remove_managed_msg_rates */
+static const enum gnss_msg gnss_runtime_msgs[] = {
+	GNSS_MSG_NAV_TIMELS,
+	GNSS_MSG_TIM_SVIN,
+	GNSS_MSG_MON_RF,
+	GNSS_MSG_NAV_SAT,
+};
+
+#define GNSS_RUNTIME_MSG_COUNT (sizeof(gnss_runtime_msgs) / sizeof(gnss_runtime_msgs[0]))
+
+/**
+ * @brief Remove items whose rate varies at runtime from the configuration,
+ * so that their runtime values are neither reported as differences nor
+ * persisted
+ *
+ * Navigation solution and timing messages stay in the persisted
+ * configuration: the profile is only applied on navigation epochs, which
+ * would never be collected if the receiver booted with these disabled.
+ *
+ * @param keyValuePairs configuration
+ * @param length Input/Output number of items
+ */
+static void remove_managed_msg_rates(UBLOXCFG_KEYVAL_t *keyValuePairs, int *length)
+{
+	uint32_t ids[GNSS_RUNTIME_MSG_COUNT];
+	int n = 0;
+
+	for (size_t i = 0; i < GNSS_RUNTIME_MSG_COUNT; i++)
+		ids[i] = gnss_msg_rate_id(gnss_runtime_msgs[i]);
+
+	for (int i = 0; i < *length; i++) {
+		bool managed = false;
+
+		for (size_t j = 0; j < GNSS_RUNTIME_MSG_COUNT; j++)
+			managed |= ids[j] != 0 && keyValuePairs[i].id == ids[j];
+		if (!managed)
+			keyValuePairs[n++] = keyValuePairs[i];
+	}
+	*length = n;
+}
+
+/**
+ * @brief Compute the UART1 output rates the daemon needs in its current state
+ *
+ * Navigation solution and timing messages are always needed. Survey-in
+ * status is dropped once survey-in is over, leap second information is
+ * slowed down once known unless an event is close, antenna status is
+ * slowed down when nothing monitors it and satellite residuals are only
+ * output while time accuracy is bad with a fixed antenna position.
+ *
+ * @param gnss
+ * @param rates Output rate of each message, in navigation epochs
+ */
+static void gnss_msg_profile(const struct gnss *gnss, uint8_t rates[GNSS_MSG_COUNT])
+{
+	const struct gps_device_t *session = gnss->session;
+	const struct gps_context_t *context = session->context;
+
+	rates[GNSS_MSG_NAV_PVT] = 1;
+	rates[GNSS_MSG_NAV_EOE] = 1;
+	rates[GNSS_MSG_NAV_TIMEUTC] = 1;
+	rates[GNSS_MSG_TIM_TP] = 1;
+	rates[GNSS_MSG_NAV_TIMELS] = context->lsset &&
+		(context->lsChange == 0 || context->timeToLsEvent > GNSS_LEAP_SECOND_WATCH_S) ?
+		GNSS_SLOW_MSG_RATE : 1;
+	rates[GNSS_MSG_TIM_SVIN] = session->survey_completed || session->bypass_survey ? 0 : 1;
+	rates[GNSS_MSG_MON_RF] = gnss->gnss_info != NULL ? 1 : GNSS_SLOW_MSG_RATE;
+	rates[GNSS_MSG_NAV_SAT] = gnss->fixed_position && gnss->fixed_position_bad_epochs > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Apply message profile to the receiver's RAM layer if it changed
+ *
+ * @param gnss
+ */
+static void gnss_apply_msg_profile(struct gnss *gnss)
+{
+	UBLOXCFG_KEYVAL_t kv[GNSS_MSG_COUNT];
+	uint8_t rates[GNSS_MSG_COUNT];
+	int nKv = 0;
+
+	if (!gnss->msg_profile || gnss->rx == NULL)
+		return;
+
+	gnss_msg_profile(gnss, rates);
+	for (int i = 0; i < GNSS_MSG_COUNT; i++) {
+		uint32_t id = gnss_msg_rate_id(i);
+
+		if (id == 0 || rates[i] == gnss->msg_rates[i])
+			continue;
+		kv[nKv].id = id;
+		kv[nKv].val.U1 = rates[i];
+		nKv++;
+	}
+	if (nKv == 0)
+		return;
+
+	if (!rxSetConfig(gnss->rx, kv, nKv, true, false, false)) {
+		log_warn("Could not apply GNSS message rates");
+		return;
+	}
+	for (int i = 0; i < GNSS_MSG_COUNT; i++) {
+		if (rates[i] != gnss->msg_rates[i])
+			log_info("GNSS: %s output rate set to %d", gnss_msg_names[i], rates[i]);
+		gnss->msg_rates[i] = rates[i];
+	}
+}
+
+/**
+ * @brief Forget applied message rates, so that the profile is applied again
+ *
+ * Must be called when the receiver may have reloaded its RAM configuration.
+ *
+ * @param gnss
+ */
+static void gnss_invalidate_msg_profile(struct gnss *gnss)
+{
+	memset(gnss->msg_rates, GNSS_MSG_RATE_UNKNOWN, sizeof(gnss->msg_rates));
+}
+
+/**
+ * @brief Apply the whole message profile again after the receiver was
+ * (re)started or reconfigured
+ *
+ * @param gnss
+ */
+static void gnss_reload_msg_profile(struct gnss *gnss)
+{
+	gnss_invalidate_msg_profile(gnss);
+	gnss_apply_msg_profile(gnss);
+}
+
+/**
+ * @brief Replace time mode of the default configuration by a fixed position
+ *
+ * @return true if all items were found
+ */
+static bool set_fixed_position(UBLOXCFG_KEYVAL_t* keyValuePairs, size_t length, const struct survey_position *position)
+{
+	int found = 0;
+
+	UBLOXCFG_KEYVAL_t* pair = keyValuePairs + length;
+	while (pair --> keyValuePairs)
+	{
+		switch (pair->id) {
+		case UBLOXCFG_CFG_TMODE_MODE_ID:
+			pair->val.E1 = UBLOXCFG_CFG_TMODE_MODE_FIXED;
+			break;
+		case UBLOXCFG_CFG_TMODE_POS_TYPE_ID:
+			pair->val.E1 = UBLOXCFG_CFG_TMODE_POS_TYPE_ECEF;
+			break;
+		case UBLOXCFG_CFG_TMODE_ECEF_X_ID:
+			pair->val.I4 = position->ecef_x;
+			break;
+		case UBLOXCFG_CFG_TMODE_ECEF_Y_ID:
+			pair->val.I4 = position->ecef_y;
+			break;
+		case UBLOXCFG_CFG_TMODE_ECEF_Z_ID:
+			pair->val.I4 = position->ecef_z;
+			break;
+		case UBLOXCFG_CFG_TMODE_FIXED_POS_ACC_ID:
+			pair->val.U4 = position->accuracy;
+			break;
+		default:
+			continue;
+		}
+		found++;
+	}
+	return found == 6;
+}
+
+/**
+ * @brief Replace UART1 baudrate of the default configuration
+ *
+ * @return true if the item was found
+ */
+static bool set_baudrate(UBLOXCFG_KEYVAL_t* keyValuePairs, size_t length, int baudrate)
+{
+	UBLOXCFG_KEYVAL_t* pair = keyValuePairs + length;
+	while (pair --> keyValuePairs)
+	{
+		if (pair->id == UBLOXCFG_CFG_UART1_BAUDRATE_ID)
+		{
+			pair->val.U4 = (uint32_t)baudrate;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Switch receiver's UART1 and host serial to a new baudrate
+ *
+ * The new baudrate is first applied to the RAM layer only and verified by
+ * polling the receiver's version before being persisted in BBR and flash.
+ * If the receiver does not answer, both ends go back to the previous baudrate.
+ *
+ * @param rx pointer to serial communication handler
+ * @param baudrate requested baudrate
+ * @return baudrate in use after the switch, -1 if receiver does not answer anymore
+ */
+static int gnss_switch_baudrate(RX_t *rx, int baudrate)
+{
+	UBLOXCFG_KEYVAL_t kv = { .id = UBLOXCFG_CFG_UART1_BAUDRATE_ID, .val.U4 = (uint32_t)baudrate };
+	const int previous = rxGetBaudrate(rx);
+	char verStr[100];
+
+	if (previous == baudrate)
+		return baudrate;
+
+	log_info("Switching GNSS serial from %d to %d bauds", previous, baudrate);
+	/* Receiver switches right away, its acknowledgement may be lost */
+	rxSetConfig(rx, &kv, 1, true, false, false);
+	usleep(100 * 1000);
+	if (rxSetBaudrate(rx, baudrate) && rxGetVerStr(rx, verStr, sizeof(verStr))) {
+		if (!rxSetConfig(rx, &kv, 1, true, true, true))
+			log_warn("Could not persist GNSS serial baudrate %d", baudrate);
+		log_info("GNSS serial now running at %d bauds", baudrate);
+		return baudrate;
+	}
+
+	log_warn("GNSS receiver does not answer at %d bauds, falling back to %d", baudrate, previous);
+	kv.val.U4 = (uint32_t)previous;
+	if (rxAutobaud(rx) && rxGetBaudrate(rx) != previous) {
+		rxSetConfig(rx, &kv, 1, true, false, false);
+		usleep(100 * 1000);
+	}
+	if (!rxSetBaudrate(rx, previous) || !rxGetVerStr(rx, verStr, sizeof(verStr))) {
+		log_error("GNSS receiver does not answer at %d bauds either", previous);
+		return -1;
+	}
+	return previous;
+}
+
 /**
  * @brief Send configuration from f9_defvalsets.h to GNSS receiver
  *
  * @param rx pointer to serial communication handler
+ * @param baudrate UART1 baudrate to keep in configuration
+ * @param msg_profile message rates are managed at runtime
+ * @param fixed_position antenna position to use instead of survey-in, may be NULL
  * @return boolean indicating receiver has correctly been reset to configuration
  */
-static bool gnss_set_configuration(RX_t* rx, const struct config* config, int major, int minor)
+static bool gnss_set_configuration(RX_t* rx, const struct config* config, int major, int minor, int baudrate, bool msg_profile,
+	const struct survey_position *fixed_position)
 {
 	bool               receiver_configured = false;
 	int                tries               = 0;
@@ -505,22 +837,44 @@ static bool gnss_set_configuration(RX_t* rx, const struct config* config, int ma
 
 	set_preferred_time_scale(allKvCfg, nAllKvCfg, config);
 	set_cable_delay(allKvCfg, nAllKvCfg, config);
+	set_baudrate(allKvCfg, nAllKvCfg, baudrate);
+	if (msg_profile)
+		remove_managed_msg_rates(allKvCfg, &nAllKvCfg);
+	if (fixed_position != NULL && !set_fixed_position(allKvCfg, nAllKvCfg, fixed_position)) {
+		log_error("Default configuration does not define time mode");
+		free(allKvCfg);
+		return false;
+	}
 
-	/* Check if receiver is already configured */
-	receiver_configured = check_gnss_config_in_ram(rx, allKvCfg, nAllKvCfg);
+	/* Only items that differ from the receiver's current or boot configuration are written */
+	UBLOXCFG_KEYVAL_t *diffKv = malloc(nAllKvCfg * sizeof(UBLOXCFG_KEYVAL_t));
+	if (diffKv == NULL) {
+		log_error("Could not allocate configuration diff");
+		free(allKvCfg);
+		return false;
+	}
+	int nDiffKv = get_gnss_persisted_config_diff(rx, allKvCfg, nAllKvCfg, diffKv);
+	if (nDiffKv < 0) {
+		log_warn("Could not compare receiver configuration, writing all %d items", nAllKvCfg);
+		memcpy(diffKv, allKvCfg, nAllKvCfg * sizeof(UBLOXCFG_KEYVAL_t));
+		nDiffKv = nAllKvCfg;
+	}
+	receiver_configured = nDiffKv == 0;
 	if (receiver_configured)
 		log_info("Receiver already configured to desired configuration");
 	else
-		log_info("Receiver not configured to desired configuration, starting reconfiguration");
+		log_info("Receiver not configured to desired configuration, %d of %d items differ, starting reconfiguration",
+			nDiffKv, nAllKvCfg);
 
 	while (!receiver_configured) {
 		log_info("Configuring receiver with ART parameters...\n");
-		bool res = rxSetConfig(rx, allKvCfg, nAllKvCfg, true, true, true);
+		bool res = rxSetConfig(rx, diffKv, nDiffKv, true, true, true);
 
 		if (res) {
 			log_info("Successfully reconfigured GNSS receiver");
 			log_debug("Performing hardware reset");
 			if (!rxReset(rx, RX_RESET_HARD)) {
+				free(diffKv);
 				free(allKvCfg);
 				return false;
 			}
@@ -533,10 +887,12 @@ static bool gnss_set_configuration(RX_t* rx, const struct config* config, int ma
 		else
 		{
 			log_error("Could not configure GNSS receiver\n");
+			free(diffKv);
 			free(allKvCfg);
 			return false;
 		}
 	}
+	free(diffKv);
 	free(allKvCfg);
 	return true;
 }
@@ -588,106 +944,231 @@ static bool gnss_set_rtcm_config(RX_t *rx)
 }
 
 /**
- * @brief Create a Unix domain socket for RTCM output.
+ * @brief Get current GPS time from the PHC, if it has been set
  *
- * Creates a listening socket at RTCM_SOCK_PATH. Clients connect to
- * receive raw RTCM3 frames. Only one client is served at a time;
- * a new connection replaces the previous one.
+ * PHC keeps TAI time across daemon restarts, it is only meaningful for
+ * time aiding if it has been set by a previous run.
  *
- * @return listening socket fd, or -1 on error
+ * @param gnss
+ * @param gps_time GPS time since GPS epoch
+ * @return 0 on success, -errno if PHC time is unknown
  */
-static int rtcm_sock_create(void)
+static int gnss_get_phc_gps_time(struct gnss *gnss, struct timespec *gps_time)
 {
-	struct sockaddr_un addr = {
-		.sun_family = AF_UNIX,
-		.sun_path = RTCM_SOCK_PATH,
-	};
-	int fd;
+	if (gnss->fd_clock < 0 || clock_gettime(FD_TO_CLOCKID(gnss->fd_clock), gps_time) != 0)
+		return -errno;
+	if (gps_time->tv_sec < GNSS_PHC_MIN_VALID_TAI)
+		return -EINVAL;
+	gps_time->tv_sec -= GPS_EPOCH_TO_TAI;
+	return 0;
+}
 
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (fd < 0) {
-		log_warn("RTCM socket create failed: %s", strerror(errno));
-		return -1;
+/**
+ * @brief Open, configure and start the receiver
+ *
+ * @param gnss
+ * @param config config structure of the program
+ * @param gnss_device_tty path of the receiver's serial
+ * @return true on success
+ */
+static bool gnss_open_receiver(struct gnss *gnss, const struct config *config, char *gnss_device_tty)
+{
+	RX_OPTS_t    opts = RX_OPTS_DEFAULT();
+	opts.autobaud     = true;
+	opts.detect       = RX_DET_UBX;
+	long baudrate     = config_get_unsigned_number(config, "gnss-baudrate");
+	struct survey_position position;
+
+	/*
+	 * Always detect the receiver's baudrate: it may still run at one
+	 * persisted by a previous run with another gnss-baudrate
+	 */
+	if (baudrate <= 0)
+		baudrate = GNSS_DEFAULT_BAUDRATE;
+
+	gnss->rx = rxInit(gnss_device_tty, &opts);
+	if (gnss->rx == NULL)
+		return false;
+
+	if (!gnss_connect(gnss->rx))
+		goto err_gnss_connect;
+
+	/* Fetch receiver version and save it in gnss structure*/
+	char verStr[100];
+    if (rxGetVerStr(gnss->rx, verStr, sizeof(verStr))) {
+		if (parse_receiver_version(verStr, &gnss->receiver_version_major, &gnss->receiver_version_minor))
+			log_debug("Receiver version successfully detected ! Major is %d, Minor is %d ", gnss->receiver_version_major, gnss->receiver_version_minor);
+		else
+			log_warn("Receiver version parsing failed");
 	}
+	else
+		log_warn("Receiver version get command failed");
 
-	unlink(RTCM_SOCK_PATH);
-	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		log_warn("RTCM socket bind failed: %s", strerror(errno));
-		close(fd);
-		return -1;
+	/* Skip survey-in if antenna position is already known */
+	if (gnss->survey_cache_path[0] != '\0' && !gnss->session->bypass_survey &&
+	    survey_cache_load(gnss->survey_cache_path, &position) == 0) {
+		log_info("Using antenna position of a previous survey-in: ECEF %d, %d, %d cm, accuracy %.1f mm",
+			position.ecef_x, position.ecef_y, position.ecef_z, position.accuracy / 10.0);
+		gnss->fixed_position = true;
+		gnss->fixed_position_bad_epochs = 0;
+		gnss->fixed_position_prres_rms = -1.0;
+		gnss->session->survey_in_position_error = position.accuracy / 10000.0;
 	}
 
-	if (listen(fd, 1) < 0) {
-		log_warn("RTCM socket listen failed: %s", strerror(errno));
-		close(fd);
-		unlink(RTCM_SOCK_PATH);
-		return -1;
+	gnss->baudrate = gnss_switch_baudrate(gnss->rx, baudrate);
+	if (gnss->baudrate < 0)
+		goto err_gnss_connect;
+
+	if (!gnss_set_configuration(gnss->rx, config, gnss->receiver_version_major, gnss->receiver_version_minor, gnss->baudrate, gnss->msg_profile,
+			gnss->fixed_position ? &position : NULL))
+		goto err_gnss_connect;
+
+	/* Enable RTCM3 output on UART1 if configured */
+	if (config_get_bool_default(config, "gnss-rtcm-enabled", false)) {
+		if (gnss_set_rtcm_config(gnss->rx)) {
+			long max_clients = config_get_unsigned_number(config, "gnss-rtcm-max-clients");
+			long buffer_size = config_get_unsigned_number(config, "gnss-rtcm-client-buffer-size");
+
+			if (max_clients <= 0)
+				max_clients = RTCM_DEFAULT_MAX_CLIENTS;
+			if (buffer_size <= 0)
+				buffer_size = RTCM_DEFAULT_BUFFER_SIZE;
+			mkdir("/run/oscillatord", 0755);
+			gnss->rtcm = rtcm_server_new(RTCM_SOCK_PATH, max_clients, buffer_size);
+		} else {
+			log_warn("Failed to enable RTCM output");
+		}
 	}
 
-	log_info("RTCM socket listening at %s", RTCM_SOCK_PATH);
-	return fd;
+	/* Give back time and navigation database saved by a previous run */
+	if (gnss->assistance != NULL) {
+		struct timespec gps_time;
+
+		gnss_assistance_restore(gnss->assistance, gnss->rx,
+			gnss_get_phc_gps_time(gnss, &gps_time) == 0 ? &gps_time : NULL);
+	}
+
+	if (!rxReset(gnss->rx, RX_RESET_GNSS_START)) {
+		log_error("Could not start GNSS receiver");
+		goto err_gnss_connect;
+	}
+	gnss_reload_msg_profile(gnss);
+
+	return true;
+
+err_gnss_connect:
+	rtcm_server_destroy(gnss->rtcm);
+	gnss->rtcm = NULL;
+	gnss_assistance_destroy(gnss->assistance);
+	gnss->assistance = NULL;
+	free(gnss->rx);
+	gnss->rx = NULL;
+	log_error("Could not connect to GNSS serial at %s", gnss_device_tty);
+	return false;
 }
 
 /**
- * @brief Background thread that accepts RTCM client connections.
+ * @brief Open a capture file for replay in place of the receiver
  *
- * Blocks on accept(). When a new client connects, it replaces the
- * previous client fd (closing the old one). The gnss_thread writes
- * RTCM frames to rtcm_client_fd without blocking.
+ * @param gnss
+ * @param config config structure of the program
+ * @param path capture file to replay
+ * @return true on success
  */
-static void *rtcm_accept_thread_fn(void *p_data)
+static bool gnss_open_replay(struct gnss *gnss, const struct config *config, const char *path)
 {
-	struct gnss *gnss = (struct gnss *)p_data;
-
-	while (gnss->rtcm_accept_running) {
-		int client_fd = accept(gnss->rtcm_listen_fd, NULL, NULL);
-		if (client_fd < 0) {
-			if (errno == EINVAL || errno == EBADF)
-				break; /* socket closed, shutting down */
-			log_warn("RTCM accept failed: %s", strerror(errno));
-			continue;
-		}
-
-		/* Swap in the new client fd under mutex */
-		pthread_mutex_lock(&gnss->mutex_data);
-		int old_fd = gnss->rtcm_client_fd;
-		gnss->rtcm_client_fd = client_fd;
-		pthread_mutex_unlock(&gnss->mutex_data);
-
-		if (old_fd >= 0)
-			close(old_fd);
+	const char *speed_str = config_get_default(config, "gnss-replay-speed", "1");
+	char *end;
+	double speed;
 
-		log_info("RTCM client connected (fd %d)", client_fd);
+	errno = 0;
+	speed = strtod(speed_str, &end);
+	if (errno != 0 || *end != '\0' || speed < 0) {
+		log_error("Invalid gnss-replay-speed %s", speed_str);
+		return false;
 	}
 
-	return NULL;
+	gnss->replay = ubx_replay_open(path, speed);
+	return gnss->replay != NULL;
 }
 
 /**
- * @brief Clean up RTCM socket resources.
+ * @brief Record reception time of TIM-TP and NAV-PVT messages
+ *
+ * Both are output once per second right after the top of the second, so the
+ * sub-second part of the PHC time at reception is the delay to get them
+ * through the serial link once PHC is set.
+ *
+ * @param gnss
+ * @param msg received UBX message
  */
-static void rtcm_sock_cleanup(struct gnss *gnss)
+static void gnss_measure_latency(struct gnss *gnss, const PARSER_MSG_t *msg)
 {
-	gnss->rtcm_accept_running = false;
+	uint8_t clsId = UBX_CLSID(msg->data);
+	uint8_t msgId = UBX_MSGID(msg->data);
+	struct gnss_latency *latency;
+	struct timespec ts;
+
+	if (clsId == UBX_TIM_CLSID && msgId == UBX_TIM_TP_MSGID)
+		latency = &gnss->tim_tp_latency;
+	else if (clsId == UBX_NAV_CLSID && msgId == UBX_NAV_PVT_MSGID)
+		latency = &gnss->nav_pvt_latency;
+	else
+		return;
+
+	if (gnss->fd_clock < 0 || clock_gettime(FD_TO_CLOCKID(gnss->fd_clock), &ts) != 0)
+		return;
 
-	/* Close listening socket to unblock accept() */
-	if (gnss->rtcm_listen_fd >= 0) {
-		shutdown(gnss->rtcm_listen_fd, SHUT_RDWR);
-		close(gnss->rtcm_listen_fd);
-		gnss->rtcm_listen_fd = -1;
+	if (latency->count == 0 || ts.tv_nsec < latency->min_ns)
+		latency->min_ns = ts.tv_nsec;
+	if (latency->count == 0 || ts.tv_nsec > latency->max_ns)
+		latency->max_ns = ts.tv_nsec;
+	latency->sum_ns += ts.tv_nsec;
+	latency->count++;
+}
+
+/**
+ * @brief Log serial latency of a message over the last period and restart measure
+ *
+ * @param latency
+ * @param name message name
+ */
+static void gnss_report_latency(struct gnss_latency *latency, const char *name)
+{
+	if (latency->count == 0) {
+		latency->mean_us = -1;
+		return;
 	}
 
-	pthread_join(gnss->rtcm_accept_thread, NULL);
+	latency->mean_us = latency->sum_ns / latency->count / 1000;
+	log_info("GNSS serial latency of %s: mean %d us, min %" PRId64 " us, max %" PRId64 " us",
+		name, latency->mean_us, latency->min_ns / 1000, latency->max_ns / 1000);
+	latency->count = 0;
+	latency->sum_ns = 0;
+}
 
-	pthread_mutex_lock(&gnss->mutex_data);
-	int cfd = gnss->rtcm_client_fd;
-	gnss->rtcm_client_fd = -1;
-	pthread_mutex_unlock(&gnss->mutex_data);
+/**
+ * @brief Get next message from the receiver or the replayed capture
+ *
+ * @param gnss
+ * @return PARSER_MSG_t*, NULL on timeout
+ */
+static PARSER_MSG_t *gnss_get_next_message(struct gnss *gnss)
+{
+	PARSER_MSG_t *msg;
+
+	if (gnss->replay != NULL)
+		msg = ubx_replay_next(gnss->replay, GNSS_TIMEOUT_MS);
+	else
+		msg = rxGetNextMessageTimeout(gnss->rx, GNSS_TIMEOUT_MS);
 
-	if (cfd >= 0)
-		close(cfd);
+	if (msg != NULL && gnss->capture != NULL)
+		ubx_capture_write(gnss->capture, msg);
 
-	unlink(RTCM_SOCK_PATH);
+	if (msg != NULL && gnss->replay == NULL && msg->type == PARSER_MSGTYPE_UBX)
+		gnss_measure_latency(gnss, msg);
+
+	return msg;
 }
 
 /**
@@ -701,21 +1182,17 @@ static void rtcm_sock_cleanup(struct gnss *gnss)
 struct gnss * gnss_init(const struct config *config, char *gnss_device_tty, struct gps_device_t *session, int fd_clock)
 {
 	struct gnss* gnss;
+	const char *replay_path;
+	const char *capture_path;
+	const char *assistance_path;
 	int          ret  = -1;
-	RX_OPTS_t    opts = RX_OPTS_DEFAULT();
-	opts.autobaud     = true;
-	opts.detect       = RX_DET_UBX;
-
-	if (strchr(gnss_device_tty, '@')) {
-		opts.autobaud = false;
-	}
 
 	if (session == NULL) {
 		log_error("No gps session provided");
 		return NULL;
 	}
 
-	gnss = (struct gnss *) malloc(sizeof(struct gnss));
+	gnss = (struct gnss *) calloc(1, sizeof(struct gnss));
 	if (gnss == NULL) {
 		log_error("could not allocate memory for gnss");
 		return NULL;
@@ -727,63 +1204,16 @@ struct gnss * gnss_init(const struct config *config, char *gnss_device_tty, stru
 	/* Init Antenna Status and Power to undefined values according to UBX Protocol */
 	gnss->session->antenna_status = ANT_STATUS_UNDEFINED;
 	gnss->session->antenna_power = ANT_POWER_UNDEFINED;
-	gnss->rx = rxInit(gnss_device_tty, &opts);
 	gnss->action = GNSS_ACTION_NONE;
 	/* Init Survey In Error to undefined values */
 	gnss->session->survey_in_position_error =-1.0;
 	/* Init receiver version values */
 	gnss->receiver_version_minor = -1;
 	gnss->receiver_version_major = -1;
-	if (gnss->rx == NULL)
-		goto err_rxInit;
-
-	if (!gnss_connect(gnss->rx))
-		goto err_gnss_connect;
-
-	/* Fetch receiver version and save it in gnss structure*/
-	char verStr[100];
-    if (rxGetVerStr(gnss->rx, verStr, sizeof(verStr))) {
-		if (parse_receiver_version(verStr, &gnss->receiver_version_major, &gnss->receiver_version_minor))
-			log_debug("Receiver version successfully detected ! Major is %d, Minor is %d ", gnss->receiver_version_major, gnss->receiver_version_minor);
-		else
-			log_warn("Receiver version parsing failed");
-	}
-	else
-		log_warn("Receiver version get command failed");
-
-	if (!gnss_set_configuration(gnss->rx, config, gnss->receiver_version_major, gnss->receiver_version_minor))
-		goto err_gnss_connect;
-
-	/* Enable RTCM3 output on UART1 if configured */
-	gnss->rtcm_enabled = false;
-	gnss->rtcm_listen_fd = -1;
-	gnss->rtcm_client_fd = -1;
-	gnss->rtcm_accept_running = false;
-	if (config_get_bool_default(config, "gnss-rtcm-enabled", false)) {
-		if (gnss_set_rtcm_config(gnss->rx)) {
-			gnss->rtcm_enabled = true;
-			mkdir("/run/oscillatord", 0755);
-			gnss->rtcm_listen_fd = rtcm_sock_create();
-			if (gnss->rtcm_listen_fd >= 0) {
-				gnss->rtcm_accept_running = true;
-				if (pthread_create(&gnss->rtcm_accept_thread, NULL,
-					rtcm_accept_thread_fn, gnss) != 0) {
-					log_warn("Failed to create RTCM accept thread");
-					gnss->rtcm_accept_running = false;
-					close(gnss->rtcm_listen_fd);
-					gnss->rtcm_listen_fd = -1;
-					unlink(RTCM_SOCK_PATH);
-				}
-			}
-		} else {
-			log_warn("Failed to enable RTCM output");
-		}
-	}
-
-	gnss->stop = false;
-
-	/* Initialize receiver's survey in flag */
-	gnss->session->survey_completed = false;
+	gnss->tim_tp_latency.mean_us = -1;
+	gnss->msg_profile = config_get_bool_default(config, "gnss-message-profile", true);
+	gnss_invalidate_msg_profile(gnss);
+	gnss->nav_pvt_latency.mean_us = -1;
 
 	/* Check wether receiver's survey in should be bypassed or not */
 	gnss->session->bypass_survey = config_get_bool_default(
@@ -795,14 +1225,48 @@ struct gnss * gnss_init(const struct config *config, char *gnss_device_tty, stru
 		log_warn("Please note that performance may be degraded and holdover might not reached specified limits");
 	}
 
-	if (!rxReset(gnss->rx, RX_RESET_GNSS_START)) {
-		log_error("Could not start GNSS receiver");
-		goto err_gnss_connect;
+	snprintf(gnss->survey_cache_path, sizeof(gnss->survey_cache_path), "%s",
+		config_get_default(config, "gnss-survey-cache", ""));
+
+	/* Messages come from a capture file instead of the receiver if requested */
+	replay_path = config_get(config, "gnss-replay-file");
+	assistance_path = config_get(config, "gnss-assistance-file");
+	if (assistance_path != NULL && replay_path == NULL) {
+		long period = GNSS_ASSISTANCE_DEFAULT_PERIOD_S;
+
+		if (config_get(config, "gnss-assistance-period") != NULL) {
+			period = config_get_unsigned_number(config, "gnss-assistance-period");
+			if (period < 0) {
+				log_error("Invalid gnss-assistance-period");
+				goto err_open;
+			}
+		}
+		gnss->assistance = gnss_assistance_new(assistance_path, period);
+	}
+	if (replay_path != NULL) {
+		log_warn("GNSS receiver is replaced by capture %s", replay_path);
+		if (!gnss_open_replay(gnss, config, replay_path))
+			goto err_open;
+	} else if (!gnss_open_receiver(gnss, config, gnss_device_tty)) {
+		goto err_open;
 	}
 
+	capture_path = config_get(config, "gnss-capture-file");
+	if (capture_path != NULL)
+		gnss->capture = ubx_capture_open(capture_path);
+
+	gnss->stop = false;
+
+	/* Initialize receiver's survey in flag */
+	gnss->session->survey_completed = gnss->fixed_position;
+
+	pthread_condattr_t cond_attr;
+
 	pthread_mutex_init(&gnss->mutex_data, NULL);
-	pthread_cond_init(&gnss->cond_time, NULL);
-	pthread_cond_init(&gnss->cond_data, NULL);
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&gnss->cond_data, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
 
 	ret = pthread_create(
 		&gnss->thread,
@@ -812,36 +1276,107 @@ struct gnss * gnss_init(const struct config *config, char *gnss_device_tty, stru
 	);
 
 	if (ret != 0) {
-		rxClose(gnss->rx);
-		goto err_gnss_connect;
+		ubx_capture_close(gnss->capture);
+		ubx_replay_close(gnss->replay);
+		rtcm_server_destroy(gnss->rtcm);
+		if (gnss->rx != NULL) {
+			rxClose(gnss->rx);
+			free(gnss->rx);
+		}
+		goto err_open;
 	}
 
 	return gnss;
 
-err_gnss_connect:
-	free(gnss->rx);
-	log_error("Could not connect to GNSS serial at %s", gnss_device_tty);
-err_rxInit:
+err_open:
+	gnss_assistance_destroy(gnss->assistance);
 	free(gnss);
 	error(EXIT_FAILURE, -ret, "gnss_init");
 	return NULL;
 }
 
 /**
- * @brief Wait for next TAI time retrieved from the device
+ * @brief Publish the data of the epoch that has just been parsed
  *
- * @param gnss thread structure
- * @return time_t
+ * Only the gnss thread writes gnss->session, the lock is only held to copy
+ * the values consumers need.
+ *
+ * @param gnss
  */
-static time_t gnss_get_next_fix_tai_time(struct gnss * gnss)
+static void gnss_publish_epoch(struct gnss *gnss)
 {
-	time_t time;
+	const struct gps_device_t *session = gnss->session;
+
 	pthread_mutex_lock(&gnss->mutex_data);
-	pthread_cond_wait(&gnss->cond_time, &gnss->mutex_data);
-	time = gnss->session->tai_time;
+	gnss->epoch = (struct gnss_epoch) {
+		.number = gnss->epoch.number + 1,
+		.valid = session->valid,
+		.survey_completed = session->survey_completed,
+		.tai_time_set = session->tai_time_set,
+		.tai_time = session->tai_time,
+		.qErr = session->context->qErr_last_epoch,
+		.last_fix_utc_time = session->last_fix_utc_time,
+		.lsset = session->context->lsset,
+		.leap_seconds = session->context->leap_seconds,
+	};
+	pthread_cond_broadcast(&gnss->cond_data);
 	pthread_mutex_unlock(&gnss->mutex_data);
-	return time;
+}
+
+/**
+ * @brief Wait for an epoch more recent than a given one
+ *
+ * Returns immediately if such an epoch has already been published, so no
+ * epoch signaled between two calls can be missed.
+ *
+ * @param gnss
+ * @param after number of the last epoch known by the caller
+ * @param timeout_ms maximum time to wait
+ * @param epoch Output latest epoch
+ * @return 0 on success, -ETIMEDOUT if no new epoch was published in time
+ */
+int gnss_wait_epoch(struct gnss *gnss, uint64_t after, unsigned int timeout_ms, struct gnss_epoch *epoch)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&gnss->mutex_data);
+	while (gnss->epoch.number <= after && ret == 0)
+		ret = pthread_cond_timedwait(&gnss->cond_data, &gnss->mutex_data, &deadline);
+	if (gnss->epoch.number > after) {
+		*epoch = gnss->epoch;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&gnss->mutex_data);
+
+	return -ret;
+}
+
+/**
+ * @brief Wait for the next epoch of the main thread's consumers
+ *
+ * @param gnss
+ * @param epoch Output epoch
+ * @return 0 on success, -ETIMEDOUT on error
+ */
+static int gnss_consume_epoch(struct gnss *gnss, struct gnss_epoch *epoch)
+{
+	int ret = gnss_wait_epoch(gnss, gnss->consumed_epoch, GNSS_EPOCH_TIMEOUT_MS, epoch);
 
+	if (ret != 0) {
+		log_error("No GNSS epoch published for %d ms", GNSS_EPOCH_TIMEOUT_MS);
+		return ret;
+	}
+	gnss->consumed_epoch = epoch->number;
+	return 0;
 }
 
 /**
@@ -853,19 +1388,20 @@ static time_t gnss_get_next_fix_tai_time(struct gnss * gnss)
  */
 int gnss_get_epoch_data(struct gnss *gnss, bool *valid, bool *survey, int32_t *qErr)
 {
+	struct gnss_epoch epoch;
+
 	if (!gnss) {
 		return -1;
 	}
 
-	pthread_mutex_lock(&gnss->mutex_data);
-	pthread_cond_wait(&gnss->cond_data, &gnss->mutex_data);
+	if (gnss_consume_epoch(gnss, &epoch) != 0)
+		return -1;
 	if (survey != NULL)
-		*survey = gnss->session->survey_completed;
+		*survey = epoch.survey_completed;
 	if (valid != NULL)
-		*valid = gnss->session->valid;
+		*valid = epoch.valid;
 	if (qErr != NULL)
-		*qErr = gnss->session->context->qErr_last_epoch;
-	pthread_mutex_unlock(&gnss->mutex_data);
+		*qErr = epoch.qErr;
 	return 0;
 }
 
@@ -878,77 +1414,116 @@ int gnss_get_epoch_data(struct gnss *gnss, bool *valid, bool *survey, int32_t *q
  */
 int gnss_get_fix_info(struct gnss *gnss, bool *valid, struct timespec *fixUtc)
 {
+	struct gnss_epoch epoch;
+
 	if (!gnss) {
 		return -1;
 	}
 
-	pthread_mutex_lock(&gnss->mutex_data);
-	pthread_cond_wait(&gnss->cond_data, &gnss->mutex_data);
+	if (gnss_consume_epoch(gnss, &epoch) != 0)
+		return -1;
 	if (valid != NULL)
-		*valid = gnss->session->valid;
+		*valid = epoch.valid;
 	if (fixUtc != NULL)
-		*fixUtc = gnss->session->last_fix_utc_time;
-	pthread_mutex_unlock(&gnss->mutex_data);
+		*fixUtc = epoch.last_fix_utc_time;
 	return 0;
 }
 
 /**
- * @brief Check that time set in PHC is the same as the one coming from the GNSS receiver
+ * @brief Get TAI time and PHC timestamp of the last GNSS PPS
+ *
+ * Waits for the next valid epoch: its TAI time is the one of the last pulse,
+ * which has been timestamped by the phasemeter a few hundreds of milliseconds
+ * before the epoch ends. Epochs already published are skipped, and exactly
+ * one pulse must have been timestamped while waiting for the epoch, otherwise
+ * epoch and pulse may be a second apart.
  *
  * @param gnss
- * @return true
- * @return false
+ * @param phasemeter
+ * @param tai_time Output TAI time of the pulse
+ * @param timestamp Output PHC time of the pulse in ns
+ * @return 0 on success, -EAGAIN if no pulse matches the epoch, -EINTR if
+ * program is stopping, -ETIMEDOUT on error
  */
-static bool gnss_check_ptp_clock_time(struct gnss *gnss)
+static int gnss_get_pps_edge(struct gnss *gnss, struct phasemeter *phasemeter, time_t *tai_time, int64_t *timestamp)
 {
+	struct gnss_epoch epoch;
 	struct timespec ts;
-	bool valid = false;
-	time_t gnss_time;
+	uint64_t pps_count;
+	int64_t elapsed;
 	int ret;
-	if (gnss->fd_clock < 0) {
-		log_warn("Bad clock file descriptor");
-		return -1;
-	}
-	if (gnss_get_epoch_data(gnss, &valid, NULL, NULL))
-		return -1;
-	if (valid) {
-		gnss_time = gnss_get_next_fix_tai_time(gnss);
-		ret = clock_gettime(FD_TO_CLOCKID(gnss->fd_clock), &ts);
-		if (ret == 0) {
-			log_debug("GNSS tai time is %ld", gnss_time);
-			log_debug("Time set on PHC is %ld", ts.tv_sec);
-			if (ts.tv_sec == gnss_time) {
-				log_info("PHC time is set to GNSS one");
-				return true;
-			} else {
-				log_error("GNSS time is not the same as PTP clock time");
-			}
-		} else
-			log_error("Could get not PHC time");
-	} else {
-		log_error("GNSS get valid is false");
-	}
-	return false;
 
+	/* Buffered epochs may describe older pulses */
+	if (gnss_wait_epoch(gnss, 0, 0, &epoch) == 0)
+		gnss->consumed_epoch = epoch.number;
+
+	do {
+		pps_count = phasemeter_get_gnss_pps(phasemeter, timestamp);
+		ret = gnss_consume_epoch(gnss, &epoch);
+		if (ret != 0)
+			return ret;
+	} while (loop && !(epoch.valid && epoch.tai_time_set));
+	if (!loop)
+		return -EINTR;
+
+	if (phasemeter_get_gnss_pps(phasemeter, timestamp) != pps_count + 1)
+		return -EAGAIN;
+	if (clock_gettime(FD_TO_CLOCKID(gnss->fd_clock), &ts) != 0)
+		return -errno;
+
+	/* Pulse must be the last one, GNSS PPS may be off while fix is not valid */
+	elapsed = ts.tv_sec * NS_IN_SECOND + ts.tv_nsec - *timestamp;
+	if (elapsed < 0 || elapsed >= NS_IN_SECOND)
+		return -EAGAIN;
+
+	*tai_time = epoch.tai_time;
+	return 0;
+}
+
+/**
+ * @brief Shift PHC time by an offset
+ *
+ * @param fd_clock PHC file descriptor
+ * @param offset offset in ns
+ * @return 0 on success, -errno on error
+ */
+static int gnss_shift_ptp_clock(int fd_clock, int64_t offset)
+{
+	struct timex timex = {
+		.modes = ADJ_SETOFFSET | ADJ_NANO,
+		.time.tv_sec = offset / NS_IN_SECOND,
+		.time.tv_usec = offset % NS_IN_SECOND,
+	};
+
+	if (timex.time.tv_usec < 0) {
+		timex.time.tv_sec--;
+		timex.time.tv_usec += NS_IN_SECOND;
+	}
+	if (clock_adjtime(FD_TO_CLOCKID(fd_clock), &timex) < 0)
+		return -errno;
+	return 0;
 }
 
 /**
  * @brief Set PHC time to GNSS receiver time
  *
+ * PHC timestamp of a GNSS pulse is matched with the TAI time of that pulse,
+ * the PHC is then shifted by the difference in a single step so that the
+ * pulse happens at the top of the second. Result is checked on the next pulse.
+ *
  * @param gnss
+ * @param phasemeter timestamps GNSS PPS with the PHC
  * @return int: 0 on success, -1 on error
  */
-int gnss_set_ptp_clock_time(struct gnss *gnss)
+int gnss_set_ptp_clock_time(struct gnss *gnss, struct phasemeter *phasemeter)
 {
-	clockid_t clkid;
-	struct timespec ts;
-	time_t gnss_time;
-	int ret;
-	bool valid = false;
+	int64_t timestamp;
+	int64_t offset;
+	time_t tai_time;
 	bool clock_set = false;
-	bool clock_valid = false;
+	int ret;
 
-	if (!gnss) {
+	if (!gnss || !phasemeter) {
 		return -1;
 	}
 
@@ -956,61 +1531,131 @@ int gnss_set_ptp_clock_time(struct gnss *gnss)
 		log_warn("Bad clock file descriptor");
 		return -1;
 	}
-	clkid = FD_TO_CLOCKID(gnss->fd_clock);
 
-	while(!clock_valid && loop) {
-		if (gnss_get_epoch_data(gnss, &valid, NULL, NULL))
+	while (loop) {
+		ret = gnss_get_pps_edge(gnss, phasemeter, &tai_time, &timestamp);
+		if (ret == -ETIMEDOUT)
 			return -1;
+		/* Stopping, leave PHC as it is */
+		if (ret == -EINTR)
+			break;
+		if (ret != 0) {
+			log_debug("No GNSS PPS matching epoch, waiting for next one");
+			continue;
+		}
 
-		if (valid) {
-			/* Set clock time according to gnss data */
-			if (!clock_set) {
-				/* Configure PHC time */
-				/* Wait to get next gnss TAI time */
-				gnss_time = gnss_get_next_fix_tai_time(gnss);
-				/* Then get clock time to preserve nanoseconds */
-				ret = clock_gettime(clkid, &ts);
-				if (ret == 0) {
-					if (ts.tv_sec == gnss_time) {
-						log_info("PTP Clock time already set");
-						clock_set = true;
-					} else {
-						ts.tv_sec = gnss_time;
-						ret = clock_settime(clkid, &ts);
-						if (ret == 0) {
-							clock_set = true;
-							log_debug("PTP Clock Set");
-							sleep(4);
-						}
-					}
-				} else {
-					log_warn("Could not get PTP clock time");
-					return -1;
-				}
-			/* PHC time has been set, check time is correctly set */
-			} else {
-				if (gnss_check_ptp_clock_time(gnss)) {
-					log_debug("PHC time correctly set");
-					clock_valid = true;
-				} else {
-					log_warn("PHC time is not valid, resetting it");
-					clock_set = false;
-				}
-			}
-		} else {
-			sleep(2);
+		offset = tai_time * NS_IN_SECOND - timestamp;
+		if (llabs(offset) <= GNSS_PHC_SET_MAX_ERROR_NS) {
+			if (clock_set)
+				log_info("PHC time set to GNSS time, residual offset %" PRIi64 " ns", offset);
+			else
+				log_info("PTP Clock time already set, offset %" PRIi64 " ns", offset);
+			return 0;
 		}
+		if (clock_set)
+			log_warn("PHC time is not valid (offset %" PRIi64 " ns), resetting it", offset);
+
+		ret = gnss_shift_ptp_clock(gnss->fd_clock, offset);
+		if (ret != 0) {
+			log_error("Could not set PTP clock time: %s", strerror(-ret));
+			return -1;
+		}
+		log_debug("PTP Clock shifted by %" PRIi64 " ns", offset);
+		clock_set = true;
 	}
 	return 0;
 }
 
-static bool reset_serial(RX_t* rx)
+/**
+ * @brief Leave fixed position mode and start a new survey-in
+ *
+ * Time mode items are set back to the default configuration's values in all
+ * layers, and the cached position is removed.
+ *
+ * @param gnss
+ */
+static void gnss_restart_survey_in(struct gnss *gnss)
+{
+	UBLOXCFG_KEYVAL_t kv[] = {
+		{ .id = UBLOXCFG_CFG_TMODE_MODE_ID, .val.E1 = UBLOXCFG_CFG_TMODE_MODE_SURVEY_IN },
+		{ .id = UBLOXCFG_CFG_TMODE_ECEF_X_ID, .val.I4 = 0 },
+		{ .id = UBLOXCFG_CFG_TMODE_ECEF_Y_ID, .val.I4 = 0 },
+		{ .id = UBLOXCFG_CFG_TMODE_ECEF_Z_ID, .val.I4 = 0 },
+		{ .id = UBLOXCFG_CFG_TMODE_FIXED_POS_ACC_ID, .val.U4 = 0 },
+	};
+
+	if (!rxSetConfig(gnss->rx, kv, ARRAY_SIZE(kv), true, true, true)) {
+		log_error("Could not restart GNSS survey-in");
+		return;
+	}
+	if (unlink(gnss->survey_cache_path) != 0 && errno != ENOENT)
+		log_warn("Could not remove survey-in cache %s: %s", gnss->survey_cache_path, strerror(errno));
+
+	gnss->fixed_position = false;
+	gnss->fixed_position_bad_epochs = 0;
+	gnss->fixed_position_prres_rms = -1.0;
+	gnss->session->survey_completed = false;
+	gnss->session->survey_in_position_error = -1.0;
+	log_info("GNSS survey-in restarted");
+}
+
+/**
+ * @brief Watch time accuracy while using a cached antenna position
+ *
+ * A wrong fixed position biases the timing solution, so a time accuracy
+ * staying above GNSS_FIXED_POS_MAX_TACC_NS with a valid fix hints that the
+ * antenna moved. Time accuracy also degrades with bad sky visibility or
+ * jamming, so the position is only dropped and a new survey-in started if
+ * the pseudorange residuals of the used satellites, output in UBX-NAV-SAT
+ * while time accuracy is bad, confirm the position does not fit.
+ *
+ * @param gnss
+ */
+static void gnss_check_fixed_position(struct gnss *gnss)
 {
+	const struct gps_device_t *session = gnss->session;
+
+	if (gnss->rx == NULL || !session->fixOk || session->time_accuracy < 0)
+		return;
+
+	if (session->time_accuracy <= GNSS_FIXED_POS_MAX_TACC_NS) {
+		gnss->fixed_position_bad_epochs = 0;
+		gnss->fixed_position_prres_rms = -1.0;
+		return;
+	}
+
+	if (++gnss->fixed_position_bad_epochs < GNSS_FIXED_POS_MAX_BAD_EPOCHS)
+		return;
+
+	if (gnss->fixed_position_prres_rms < 0) {
+		log_warn("GNSS time accuracy is %" PRId64 " ns with a fixed antenna position but no UBX-NAV-SAT received, keeping position",
+			session->time_accuracy);
+	} else if (gnss->fixed_position_prres_rms <= GNSS_FIXED_POS_MAX_PRRES_M) {
+		log_warn("GNSS time accuracy is %" PRId64 " ns but pseudorange residuals are %.1f m, keeping fixed antenna position",
+			session->time_accuracy, gnss->fixed_position_prres_rms);
+	} else {
+		log_warn("GNSS time accuracy is %" PRId64 " ns and pseudorange residuals are %.1f m with a fixed antenna position, antenna may have moved",
+			session->time_accuracy, gnss->fixed_position_prres_rms);
+		gnss_restart_survey_in(gnss);
+		return;
+	}
+	gnss->fixed_position_bad_epochs = 0;
+	gnss->fixed_position_prres_rms = -1.0;
+}
+
+static bool reset_serial(struct gnss *gnss)
+{
+	RX_t *rx = gnss->rx;
+
 	log_debug("Reseting receiver serial connection");
 	rxClose(rx);
 	usleep(500 * 1000);
-	if (rxOpen(rx))
+	if (rxOpen(rx)) {
+		/* Receiver keeps the baudrate negotiated at startup */
+		if (rxGetBaudrate(rx) != gnss->baudrate && !rxSetBaudrate(rx, gnss->baudrate))
+			log_warn("Could not restore GNSS serial baudrate %d", gnss->baudrate);
 		return true;
+	}
 	log_error("Unable to re-open serial connection");
 	return false;
 }
@@ -1032,6 +1677,7 @@ static void * gnss_thread(void * p_data)
 	int rtcm_log_counter = 0;
 	int rtcm_msg_count = 0;
 	int rtcm_byte_count = 0;
+	int latency_report_counter = 0;
 
 	epochInit(&coll);
 
@@ -1041,34 +1687,21 @@ static void * gnss_thread(void * p_data)
 
 	while (!stop)
 	{
-		PARSER_MSG_t *msg = rxGetNextMessageTimeout(gnss->rx, GNSS_TIMEOUT_MS);
+		PARSER_MSG_t *msg = gnss_get_next_message(gnss);
+		if (msg != NULL && gnss->assistance != NULL &&
+		    gnss_assistance_handle_msg(gnss->assistance, msg))
+			msg = NULL;
+		if (gnss->assistance != NULL)
+			gnss_assistance_update(gnss->assistance, gnss->rx);
 		if (msg != NULL)
 		{
-			/* Forward RTCM3 frames to socket client if connected */
-			if (gnss->rtcm_enabled && msg->type == PARSER_MSGTYPE_RTCM3) {
+			/* Forward RTCM3 frames to socket clients, never blocks */
+			if (gnss->rtcm != NULL && msg->type == PARSER_MSGTYPE_RTCM3) {
 				rtcm_msg_count++;
 				rtcm_byte_count += msg->size;
-				pthread_mutex_lock(&gnss->mutex_data);
-				int cfd = gnss->rtcm_client_fd;
-				pthread_mutex_unlock(&gnss->mutex_data);
-				if (cfd >= 0) {
-					ssize_t ret = send(cfd, msg->data, msg->size,
-						MSG_NOSIGNAL);
-					if (ret < 0) {
-						log_info("RTCM client disconnected");
-						pthread_mutex_lock(&gnss->mutex_data);
-						if (gnss->rtcm_client_fd == cfd) {
-							gnss->rtcm_client_fd = -1;
-							pthread_mutex_unlock(&gnss->mutex_data);
-							close(cfd);
-						} else {
-							pthread_mutex_unlock(&gnss->mutex_data);
-						}
-					}
-				}
+				rtcm_server_publish(gnss->rtcm, msg->data, msg->size);
 			}
 
-			pthread_mutex_lock(&gnss->mutex_data);
 			session = gnss->session;
 			// Epoch collect is used to fetch navigation data such as time and leap seconds
 			if(epochCollect(&coll, msg, &epoch))
@@ -1102,21 +1735,30 @@ static void * gnss_thread(void * p_data)
 				else
 					session->time_accuracy = -1;
 
-				pthread_cond_signal(&gnss->cond_data);
+				if (gnss->fixed_position)
+					gnss_check_fixed_position(gnss);
+				gnss_publish_epoch(gnss);
+				gnss_apply_msg_profile(gnss);
 
-				if (session->tai_time_set)
-					pthread_cond_signal(&gnss->cond_time);
-				else
+				if (!session->tai_time_set)
 					log_warn("Could not tai time from gnss, please check GNSS Configuration if this message keeps appearing more than 25 minutes");
 
+				if (++latency_report_counter >= GNSS_LATENCY_REPORT_PERIOD) {
+					gnss_report_latency(&gnss->tim_tp_latency, "UBX-TIM-TP");
+					gnss_report_latency(&gnss->nav_pvt_latency, "UBX-NAV-PVT");
+					latency_report_counter = 0;
+				}
+
 				/* Log RTCM status periodically (every 60 epochs / ~60s) */
-				if (gnss->rtcm_enabled) {
+				if (gnss->rtcm != NULL) {
 					rtcm_log_counter++;
 					if (rtcm_log_counter >= 60) {
-						log_info("RTCM: %d frames, %d bytes in last %ds (client %s)",
+						struct rtcm_stats stats;
+
+						rtcm_server_get_stats(gnss->rtcm, &stats);
+						log_info("RTCM: %d frames, %d bytes in last %ds (%d clients)",
 							rtcm_msg_count, rtcm_byte_count, rtcm_log_counter,
-							gnss->rtcm_client_fd >= 0 ?
-								"connected" : "waiting");
+							stats.nb_clients);
 						rtcm_msg_count = 0;
 						rtcm_byte_count = 0;
 						rtcm_log_counter = 0;
@@ -1137,19 +1779,25 @@ static void * gnss_thread(void * p_data)
 						 * Reset data because we cannot assume either of these
 						 */
 						gnss_reset_session_navigation_data(gnss->session);
-						pthread_cond_signal(&gnss->cond_data);
+						gnss_publish_epoch(gnss);
 					}
 				// Parse UBX-NAV-TIMELS messages there because library does not do it
 				} else if (clsId == UBX_NAV_CLSID && msgId == UBX_NAV_TIMELS_MSGID)
 					gnss_parse_ubx_nav_timels(session, msg);
 				else if (clsId == UBX_TIM_CLSID && msgId == UBX_TIM_TP_MSGID)
 					gnss_parse_ubx_tim_tp(session, msg);
-				else if (clsId == UBX_TIM_CLSID && msgId == UBX_TIM_SVIN_MSGID) {
+				else if (clsId == UBX_NAV_CLSID && msgId == UBX_NAV_SAT_MSGID) {
+					if (gnss->fixed_position && gnss->fixed_position_bad_epochs > 0)
+						gnss_parse_ubx_nav_sat(gnss, msg);
+				} else if (clsId == UBX_TIM_CLSID && msgId == UBX_TIM_SVIN_MSGID) {
 					enum SurveyInState surveyInState = gnss_parse_ubx_tim_svin(session, msg);
 					if (!session->survey_completed && !gnss->session->bypass_survey) {
 						switch (surveyInState) {
 						case SURVEY_IN_COMPLETED:
 							session->survey_completed = true;
+							if (gnss->survey_cache_path[0] != '\0' &&
+							    survey_cache_save(gnss->survey_cache_path, &session->survey_position) == 0)
+								log_info("Survey-in position saved to %s", gnss->survey_cache_path);
 							break;
 						case SURVEY_IN_IN_PROGRESS:
 						case SURVEY_IN_UNKNOWN:
@@ -1163,33 +1811,38 @@ static void * gnss_thread(void * p_data)
 					}
 				}
 			}
-			pthread_mutex_unlock(&gnss->mutex_data);
 		} else {
 			log_warn("UART GNSS Timeout !");
-			pthread_mutex_lock(&gnss->mutex_data);
 			/* Reset data because we cannot assume either of these */
 			gnss_reset_session_navigation_data(gnss->session);
-			reset_serial(gnss->rx);
-			pthread_cond_signal(&gnss->cond_data);
-			pthread_mutex_unlock(&gnss->mutex_data);
+			if (gnss->rx != NULL)
+				reset_serial(gnss);
+			/* Receiver may have restarted with its persisted configuration */
+			gnss_reload_msg_profile(gnss);
+			gnss_publish_epoch(gnss);
 			usleep(5 * 1000);
 		}
 
 		/* this thread is the only writer to gnss->session, it's safe read the same values without mutex_data locked */
 		if (gnss->gnss_info) {
-			struct gnss_state *gnss_info = gnss->gnss_info;
-			pthread_mutex_lock(&gnss_info->lock);
-			gnss_info->antenna_power = gnss->session->antenna_power;
-			gnss_info->antenna_status = gnss->session->antenna_status;
-			gnss_info->fix = gnss->session->fix;
-			gnss_info->fixOk = gnss->session->fixOk;
-			gnss_info->leap_seconds = gnss->session->context->leap_seconds;
-			gnss_info->lsChange = gnss->session->context->lsChange;
-			gnss_info->satellites_count = gnss->session->satellites_count;
-			gnss_info->survey_in_position_error = gnss->session->survey_in_position_error;
-			gnss_info->time_accuracy = gnss->session->time_accuracy;
-			gnss_info->position_accuracy = gnss->session->position_accuracy;
-			pthread_mutex_unlock(&gnss_info->lock);
+			struct gnss_state gnss_info = {
+				.antenna_power = gnss->session->antenna_power,
+				.antenna_status = gnss->session->antenna_status,
+				.fix = gnss->session->fix,
+				.fixOk = gnss->session->fixOk,
+				.leap_seconds = gnss->session->context->leap_seconds,
+				.lsChange = gnss->session->context->lsChange,
+				.satellites_count = gnss->session->satellites_count,
+				.survey_in_position_error = gnss->session->survey_in_position_error,
+				.time_accuracy = gnss->session->time_accuracy,
+				.position_accuracy = gnss->session->position_accuracy,
+				.baudrate = gnss->baudrate,
+				.tim_tp_latency_us = gnss->tim_tp_latency.mean_us,
+				.nav_pvt_latency_us = gnss->nav_pvt_latency.mean_us,
+			};
+			if (gnss->rtcm != NULL)
+				rtcm_server_get_stats(gnss->rtcm, &gnss_info.rtcm);
+			snapshot_publish(gnss->gnss_info, &gnss_info);
 		}
 
 		pthread_mutex_lock(&gnss->mutex_data);
@@ -1198,7 +1851,9 @@ static void * gnss_thread(void * p_data)
 		gnss->action = GNSS_ACTION_NONE;
 		pthread_mutex_unlock(&gnss->mutex_data);
 
-		if (action == GNSS_ACTION_START) {
+		if (action != GNSS_ACTION_NONE && gnss->rx == NULL) {
+			log_warn("GNSS action %d ignored while replaying a capture", action);
+		} else if (action == GNSS_ACTION_START) {
 			log_debug("Performing GNSS START");
 			if (!rxReset(gnss->rx, RX_RESET_GNSS_START))
 				log_error("Could not start GNSS Receiver");
@@ -1230,14 +1885,28 @@ static void * gnss_thread(void * p_data)
 				log_info("GNSS COLD RESET performed");
 		} else if (action == GNSS_ACTION_RESET_SERIAL)
 		{
-			reset_serial(gnss->rx);
+			reset_serial(gnss);
 		}
+		if (gnss->rx != NULL && (action == GNSS_ACTION_SOFT || action == GNSS_ACTION_HARD ||
+		    action == GNSS_ACTION_COLD || action == GNSS_ACTION_RESET_SERIAL))
+			gnss_reload_msg_profile(gnss);
 	}
 
 	log_debug("Closing gnss session");
-	rxClose(gnss->rx);
-	free(gnss->rx);
-	gnss->rx = NULL;
+	if (gnss->assistance != NULL) {
+		gnss_assistance_dump(gnss->assistance, gnss->rx);
+		gnss_assistance_destroy(gnss->assistance);
+		gnss->assistance = NULL;
+	}
+	if (gnss->rx != NULL) {
+		rxClose(gnss->rx);
+		free(gnss->rx);
+		gnss->rx = NULL;
+	}
+	ubx_replay_close(gnss->replay);
+	ubx_capture_close(gnss->capture);
+	rtcm_server_destroy(gnss->rtcm);
+	gnss->rtcm = NULL;
 	free(gnss);
 	gnss = NULL;
 	return NULL;
@@ -1257,10 +1926,8 @@ void gnss_stop(struct gnss *gnss)
 	gnss->stop = true;
 	pthread_mutex_unlock(&gnss->mutex_data);
 
+	/* gnss is freed by the thread on exit */
 	pthread_join(gnss->thread, NULL);
-
-	if (gnss->rtcm_enabled)
-		rtcm_sock_cleanup(gnss);
 }
 
 void gnss_set_action(struct gnss *gnss, enum gnss_action action)
@@ -21,6 +21,9 @@
 
 #include "config.h"
 #include "ntpshm/ppsthread.h"
+#include "rtcm_server.h"
+#include "survey_cache.h"
+#include "snapshot.h"
 
 #define MAX_DEVICES 4
 #define NTPSHMSEGS      (MAX_DEVICES * 2)       /* number of NTP SHM segments */
@@ -31,6 +34,7 @@
 
 typedef struct timespec timespec_t;	/* Unix time as sec, nsec */
 struct gps_device_t;
+struct phasemeter;
 
 /*
  * Each input source has an associated type.  This is currently used in two
@@ -141,7 +145,45 @@ struct gnss_state {
 	int8_t antenna_power;
 	int8_t antenna_status;
 	bool fixOk;
-	pthread_mutex_t lock;
+	/** Serial baudrate in use, 0 if unknown */
+	int baudrate;
+	/** Mean serial latency of the last period, -1 if unknown */
+	int32_t tim_tp_latency_us;
+	int32_t nav_pvt_latency_us;
+	struct rtcm_stats rtcm;
+};
+
+/**
+ * @struct gnss_latency
+ * @brief Delay between the top of the second and the reception of a message
+ */
+struct gnss_latency {
+	int count;
+	int64_t sum_ns;
+	int64_t min_ns;
+	int64_t max_ns;
+	/** Mean of the last completed period, -1 if unknown */
+	int32_t mean_us;
+};
+
+/**
+ * @struct gnss_epoch
+ * @brief Data of the last parsed epoch, published by the gnss thread
+ */
+struct gnss_epoch {
+	/** Increased with each published epoch, starts at 1 */
+	uint64_t number;
+	/** Fix >= time only and FixOk */
+	bool valid;
+	bool survey_completed;
+	bool tai_time_set;
+	int tai_time;
+	/** Quantization error of the previous epoch */
+	int32_t qErr;
+	struct timespec last_fix_utc_time;
+	/** GPS - UTC, only valid if lsset */
+	bool lsset;
+	int leap_seconds;
 };
 
 /**
@@ -154,6 +196,18 @@ struct gps_device_t {
 	sourcetype_t sourcetype;
 	volatile struct shmTime *shm_clock;
 	volatile struct shmTime *shm_pps;
+	/** Whether PPS samples are written to an NTP SHM segment */
+	bool shm_enabled;
+	/** Path of chrony's SOCK refclock socket, empty if disabled */
+	char chrony_path[PATH_MAX];
+	/** Socket connected to chrony_path, -1 if not connected */
+	int chronyfd;
+	/** Precision of PPS samples, log2 of their jitter in seconds */
+	int pps_precision;
+	/** Jitter of PPS offsets in seconds, and data to update it */
+	double pps_jitter;
+	double pps_last_offset;
+	int pps_samples;
 	/** pointer to thread catching PPS event to fill the NTP SHM*/
 	volatile struct pps_thread_t pps_thread;
 	/** count of fixes from this device */
@@ -180,10 +234,29 @@ struct gps_device_t {
 	bool survey_completed;
 	/** Survey in error in meter from meanV field from UBX-TIM-SVIN msg */
 	float survey_in_position_error;
+	/** Mean position of the last UBX-TIM-SVIN msg */
+	struct survey_position survey_position;
 	int64_t position_accuracy; // in meters
 	int64_t time_accuracy; // in nanoseconds
 };
 
+/**
+ * @brief UBX messages whose output rate follows the daemon's needs
+ */
+enum gnss_msg {
+	GNSS_MSG_NAV_PVT,
+	GNSS_MSG_NAV_EOE,
+	GNSS_MSG_NAV_TIMEUTC,
+	GNSS_MSG_NAV_TIMELS,
+	GNSS_MSG_TIM_TP,
+	GNSS_MSG_TIM_SVIN,
+	GNSS_MSG_MON_RF,
+	GNSS_MSG_NAV_SAT,
+	GNSS_MSG_COUNT
+};
+
+#define GNSS_MSG_RATE_UNKNOWN 0xff
+
 /**
  * @struct gnss
  * @brief General thread structure
@@ -193,27 +266,51 @@ struct gnss {
 	RX_t *rx;
 	struct gps_device_t *session;
 	pthread_t thread;
+	/** Protects epoch, stop and action */
 	pthread_mutex_t mutex_data;
-	pthread_cond_t cond_time;
+	/** Signaled when epoch is published */
 	pthread_cond_t cond_data;
+	struct gnss_epoch epoch;
+	/** Last epoch returned to the main thread, only used by it */
+	uint64_t consumed_epoch;
 	int fd_clock;
 	enum gnss_action action;
 	bool stop;
 	int receiver_version_major;
 	int receiver_version_minor;
-	struct gnss_state *gnss_info;
-	bool rtcm_enabled;
-	int rtcm_listen_fd;
-	int rtcm_client_fd;
-	pthread_t rtcm_accept_thread;
-	bool rtcm_accept_running;
+	/** Baudrate of the receiver's serial link */
+	int baudrate;
+	struct gnss_latency tim_tp_latency;
+	struct gnss_latency nav_pvt_latency;
+	/** File where antenna position is saved after survey-in, empty if disabled */
+	char survey_cache_path[PATH_MAX];
+	/** Receiver runs in fixed position mode with a cached position */
+	bool fixed_position;
+	int fixed_position_bad_epochs;
+	/** RMS of pseudorange residuals of used satellites (m), negative if not received since time accuracy went bad */
+	double fixed_position_prres_rms;
+	/** Message rates are managed at runtime */
+	bool msg_profile;
+	/** Message rates applied on UART1, GNSS_MSG_RATE_UNKNOWN if unknown */
+	uint8_t msg_rates[GNSS_MSG_COUNT];
+	/** Published for monitoring, if not NULL */
+	struct snapshot *gnss_info;
+	/** Navigation database save and restore, NULL if disabled */
+	struct gnss_assistance *assistance;
+	/** RTCM3 frames distribution, NULL if disabled */
+	struct rtcm_server *rtcm;
+	/** Every received message is recorded if not NULL */
+	struct ubx_capture *capture;
+	/** Messages are read from a capture instead of rx if not NULL */
+	struct ubx_replay *replay;
 };
 
 struct gnss* gnss_init(const struct config *config, char *gnss_device_tty, struct gps_device_t *session, int fd_clock);
+int gnss_wait_epoch(struct gnss *gnss, uint64_t after, unsigned int timeout_ms, struct gnss_epoch *epoch);
 int gnss_get_epoch_data(struct gnss *gnss, bool *valid, bool *survey, int32_t *qErr);
 void gnss_stop(struct gnss *gnss);
 void gnss_set_action(struct gnss *gnss, enum gnss_action action);
-int gnss_set_ptp_clock_time(struct gnss *gnss);
+int gnss_set_ptp_clock_time(struct gnss *gnss, struct phasemeter *phasemeter);
 int gnss_get_fix_info(struct gnss *gnss, bool *valid, struct timespec *fixUtc);
 
 #endif
@@ -0,0 +1,294 @@
+/**
+ * @file gnss_assistance.c
+ * @brief Save and restore of the receiver's navigation database
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ff/ff_ubx.h>
+
+#include "gnss_assistance.h"
+#include "log.h"
+#include "utils.h"
+
+#define SEC_IN_WEEK 604800
+
+/** Dump is over when no UBX-MGA-DBD message came for this long (ms) */
+#define GNSS_ASSISTANCE_IDLE_MS 1000
+/** Time given to the receiver to answer the poll (ms) */
+#define GNSS_ASSISTANCE_ANSWER_MS 2000
+/** Delay between two restored messages, not to overflow the receiver (us) */
+#define GNSS_ASSISTANCE_SEND_DELAY_US 2000
+/** Accuracy announced for the time aiding */
+#define GNSS_ASSISTANCE_TIME_ACC_NS 100000000
+
+#define UBX_MGA_INI_TIME_GNSS_TYPE 0x11
+#define UBX_MGA_INI_TIME_GNSS_SIZE 24
+#define UBX_GNSSID_GPS 0
+
+struct gnss_assistance {
+	char *path;
+	int period_s;
+	/** Messages of the dump in progress */
+	uint8_t *db;
+	size_t db_size;
+	size_t db_capacity;
+	int nb_msgs;
+	bool polling;
+	/** CLOCK_MONOTONIC deadlines in ns */
+	int64_t poll_deadline;
+	int64_t next_dump;
+};
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * NS_IN_SECOND + ts.tv_nsec;
+}
+
+static void put_u16(uint8_t *buf, uint16_t val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = val >> 8;
+}
+
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+	put_u16(buf, val & 0xffff);
+	put_u16(buf + 2, val >> 16);
+}
+
+/**
+ * @brief Create assistance handler
+ *
+ * @param path database file
+ * @param period_s period of the database dumps, 0 to only dump on exit
+ * @return struct gnss_assistance*, NULL on error
+ */
+struct gnss_assistance *gnss_assistance_new(const char *path, int period_s)
+{
+	struct gnss_assistance *assistance = calloc(1, sizeof(*assistance));
+
+	if (assistance == NULL) {
+		log_error("Could not allocate GNSS assistance");
+		return NULL;
+	}
+	assistance->path = strdup(path);
+	if (assistance->path == NULL) {
+		log_error("Could not allocate GNSS assistance");
+		free(assistance);
+		return NULL;
+	}
+	assistance->period_s = period_s;
+	assistance->next_dump = monotonic_ns() + (int64_t) period_s * NS_IN_SECOND;
+	return assistance;
+}
+
+/**
+ * @brief Send time aiding, then the saved navigation database to the receiver
+ *
+ * @param assistance
+ * @param rx
+ * @param gps_time current GPS time, NULL if unknown
+ * @return number of database messages sent, -errno on error
+ */
+int gnss_assistance_restore(struct gnss_assistance *assistance, RX_t *rx, const struct timespec *gps_time)
+{
+	uint8_t msg[UBX_FRAME_SIZE + UINT16_MAX];
+	int nb_msgs = 0;
+	FILE *f;
+
+	if (gps_time != NULL) {
+		uint8_t payload[UBX_MGA_INI_TIME_GNSS_SIZE] = {
+			[0] = UBX_MGA_INI_TIME_GNSS_TYPE,
+			[3] = UBX_GNSSID_GPS,
+		};
+		int size;
+
+		put_u16(&payload[6], gps_time->tv_sec / SEC_IN_WEEK);
+		put_u32(&payload[8], gps_time->tv_sec % SEC_IN_WEEK);
+		put_u32(&payload[12], gps_time->tv_nsec);
+		put_u32(&payload[20], GNSS_ASSISTANCE_TIME_ACC_NS);
+		size = ubxMakeMessage(UBX_MGA_CLSID, UBX_MGA_INI_MSGID, payload, sizeof(payload), msg);
+		if (!rxSend(rx, msg, size))
+			log_warn("Could not send GNSS time aiding");
+		else
+			log_info("GNSS time aiding sent");
+	}
+
+	f = fopen(assistance->path, "rb");
+	if (f == NULL) {
+		if (errno != ENOENT)
+			log_warn("Could not open GNSS assistance file %s: %s", assistance->path, strerror(errno));
+		return -errno;
+	}
+
+	/* File is a sequence of complete UBX-MGA-DBD frames */
+	while (fread(msg, UBX_HEAD_SIZE, 1, f) == 1) {
+		size_t size = UBX_FRAME_SIZE + (msg[4] | (msg[5] << 8));
+
+		if (msg[0] != UBX_SYNC_1 || msg[1] != UBX_SYNC_2 ||
+		    fread(msg + UBX_HEAD_SIZE, size - UBX_HEAD_SIZE, 1, f) != 1) {
+			log_warn("Corrupted GNSS assistance file %s", assistance->path);
+			break;
+		}
+		if (!rxSend(rx, msg, size)) {
+			log_warn("Could not send GNSS assistance");
+			break;
+		}
+		nb_msgs++;
+		usleep(GNSS_ASSISTANCE_SEND_DELAY_US);
+	}
+	fclose(f);
+
+	log_info("GNSS navigation database restored (%d messages)", nb_msgs);
+	return nb_msgs;
+}
+
+/**
+ * @brief Start a dump of the navigation database
+ */
+static void gnss_assistance_poll(struct gnss_assistance *assistance, RX_t *rx)
+{
+	uint8_t msg[UBX_FRAME_SIZE];
+	int size = ubxMakeMessage(UBX_MGA_CLSID, UBX_MGA_DBD_MSGID, NULL, 0, msg);
+
+	assistance->db_size = 0;
+	assistance->nb_msgs = 0;
+	if (!rxSend(rx, msg, size)) {
+		log_warn("Could not poll GNSS navigation database");
+		return;
+	}
+	assistance->polling = true;
+	assistance->poll_deadline = monotonic_ns() + GNSS_ASSISTANCE_ANSWER_MS * 1000000LL;
+}
+
+/**
+ * @brief Write collected database, replacing previous file atomically
+ */
+static int gnss_assistance_save(struct gnss_assistance *assistance)
+{
+	char tmp_path[PATH_MAX];
+	FILE *f;
+	int ret = 0;
+
+	assistance->polling = false;
+	if (assistance->nb_msgs == 0) {
+		log_warn("GNSS receiver did not send its navigation database");
+		return -ENODATA;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", assistance->path);
+	f = fopen(tmp_path, "wb");
+	if (f == NULL) {
+		log_warn("Could not create %s: %s", tmp_path, strerror(errno));
+		return -errno;
+	}
+	if (fwrite(assistance->db, assistance->db_size, 1, f) != 1)
+		ret = -EIO;
+	if (fclose(f) != 0 && ret == 0)
+		ret = -errno;
+	if (ret == 0 && rename(tmp_path, assistance->path) != 0)
+		ret = -errno;
+	if (ret != 0) {
+		log_warn("Could not save GNSS navigation database to %s: %s", assistance->path, strerror(-ret));
+		unlink(tmp_path);
+		return ret;
+	}
+
+	log_info("GNSS navigation database saved (%d messages)", assistance->nb_msgs);
+	return 0;
+}
+
+/**
+ * @brief Collect UBX-MGA-DBD messages of a dump in progress
+ *
+ * @param assistance
+ * @param msg message received from the receiver
+ * @return true if message was part of the database
+ */
+bool gnss_assistance_handle_msg(struct gnss_assistance *assistance, const PARSER_MSG_t *msg)
+{
+	if (!assistance->polling || msg->type != PARSER_MSGTYPE_UBX ||
+	    UBX_CLSID(msg->data) != UBX_MGA_CLSID || UBX_MSGID(msg->data) != UBX_MGA_DBD_MSGID)
+		return false;
+
+	if (assistance->db_size + msg->size > assistance->db_capacity) {
+		size_t capacity = assistance->db_capacity ? assistance->db_capacity * 2 : 16384;
+		uint8_t *db;
+
+		while (capacity < assistance->db_size + msg->size)
+			capacity *= 2;
+		db = realloc(assistance->db, capacity);
+		if (db == NULL) {
+			log_warn("Could not allocate GNSS navigation database");
+			return true;
+		}
+		assistance->db = db;
+		assistance->db_capacity = capacity;
+	}
+	memcpy(assistance->db + assistance->db_size, msg->data, msg->size);
+	assistance->db_size += msg->size;
+	assistance->nb_msgs++;
+	assistance->poll_deadline = monotonic_ns() + GNSS_ASSISTANCE_IDLE_MS * 1000000LL;
+	return true;
+}
+
+/**
+ * @brief Start periodic dumps and save them once complete, never blocks
+ *
+ * @param assistance
+ * @param rx
+ */
+void gnss_assistance_update(struct gnss_assistance *assistance, RX_t *rx)
+{
+	int64_t now = monotonic_ns();
+
+	if (assistance->polling) {
+		if (now >= assistance->poll_deadline)
+			gnss_assistance_save(assistance);
+	} else if (assistance->period_s > 0 && now >= assistance->next_dump) {
+		assistance->next_dump = now + (int64_t) assistance->period_s * NS_IN_SECOND;
+		gnss_assistance_poll(assistance, rx);
+	}
+}
+
+/**
+ * @brief Dump navigation database synchronously, used on exit
+ *
+ * @param assistance
+ * @param rx
+ * @return 0 on success, -errno on error
+ */
+int gnss_assistance_dump(struct gnss_assistance *assistance, RX_t *rx)
+{
+	gnss_assistance_poll(assistance, rx);
+	while (assistance->polling && monotonic_ns() < assistance->poll_deadline) {
+		PARSER_MSG_t *msg = rxGetNextMessageTimeout(rx, GNSS_ASSISTANCE_IDLE_MS);
+
+		if (msg != NULL)
+			gnss_assistance_handle_msg(assistance, msg);
+	}
+	if (!assistance->polling)
+		return -EIO;
+	return gnss_assistance_save(assistance);
+}
+
+void gnss_assistance_destroy(struct gnss_assistance *assistance)
+{
+	if (assistance == NULL)
+		return;
+	free(assistance->db);
+	free(assistance->path);
+	free(assistance);
+}
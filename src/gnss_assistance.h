@@ -0,0 +1,31 @@
+/**
+ * @file gnss_assistance.h
+ * @brief Save and restore of the receiver's navigation database
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * The navigation database is polled with UBX-MGA-DBD and the UBX-MGA-DBD
+ * messages the receiver answers are saved as is to a file. At startup they
+ * are sent back to the receiver, after time aiding, so that it does not have
+ * to download ephemerides and almanacs again.
+ */
+#ifndef OSCILLATORD_GNSS_ASSISTANCE_H
+#define OSCILLATORD_GNSS_ASSISTANCE_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include <ff/ff_parser.h>
+#include <ff/ff_rx.h>
+
+struct gnss_assistance;
+
+struct gnss_assistance *gnss_assistance_new(const char *path, int period_s);
+int gnss_assistance_restore(struct gnss_assistance *assistance, RX_t *rx, const struct timespec *gps_time);
+bool gnss_assistance_handle_msg(struct gnss_assistance *assistance, const PARSER_MSG_t *msg);
+void gnss_assistance_update(struct gnss_assistance *assistance, RX_t *rx);
+int gnss_assistance_dump(struct gnss_assistance *assistance, RX_t *rx);
+void gnss_assistance_destroy(struct gnss_assistance *assistance);
+
+#endif /* OSCILLATORD_GNSS_ASSISTANCE_H */
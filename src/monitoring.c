@@ -16,6 +16,7 @@
 #include <json-c/json.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
@@ -26,9 +27,13 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "clock_servo.h"
 #include "eeprom_config.h"
-#include "monitoring.h"
 #include "log.h"
+#include "monitoring.h"
+#include "phc_sync.h"
+#include "snapshot.h"
+#include "sys_sync.h"
 
 /** The socket will not be polled for more than 2 seconds at a time */
 #define SOCKET_TIMEOUT_MS 2000
@@ -46,17 +51,38 @@
 */
 #define MAXFDS 16 * 1024
 
-/** Number of chars allocated on the stack for each peer */
-#define SENDBUF_SIZE 1024
+/** Number of chars read from a peer socket at a time */
+#define RECVBUF_SIZE 1024
+
+/** Initial size of the send queue of a peer, it grows on demand */
+#define SENDBUF_SIZE 4096
+
+/** Peer is not read anymore while more than this number of bytes wait to be sent */
+#define SENDBUF_HIGH_WATERMARK (256 * 1024)
+
+/** Maximum size of a single request frame */
+#define MAX_FRAME_SIZE (64 * 1024)
 
-typedef enum { INITIAL_ACK, WAIT_FOR_MSG, IN_MSG } ProcessingState;
+/** Maximum number of requests accepted in a single frame */
+#define MAX_REQUESTS_PER_FRAME 64
 
-/** Data stored for each peer. */
+/**
+ * Data stored for each peer.
+ *
+ * Requests are newline delimited JSON objects (NDJSON), parsed incrementally
+ * with the peer's tokener so a frame may be split across several recv calls
+ * and several frames may arrive in a single one. After a parse error, bytes
+ * are discarded up to the next newline, possibly over several recv calls.
+ * Responses are queued in send_buf until the socket accepts them.
+ */
 typedef struct {
-	ProcessingState state;
-	char recv_buf[SENDBUF_SIZE];
-	int buf_end;
-	int buf_ptr;
+	struct json_tokener *tok;
+	size_t frame_len;
+	bool discard_line;
+	char *send_buf;
+	size_t send_size;
+	size_t send_end;
+	size_t send_ptr;
 } peer_state_t;
 
 /**
@@ -181,104 +207,47 @@ static void make_socket_non_blocking(int sockfd) {
 }
 
 /**
- * @brief Initialize receive buffer once peer is connected
+ * @brief Release resources held for a peer
  *
  * @param sockfd socket file descriptor
- * @param peer_addr
- * @param peer_addr_len
- * @return fd_status_t
  */
-static fd_status_t on_peer_connected(int sockfd, const struct sockaddr_in* peer_addr,
-									socklen_t peer_addr_len) {
+static void on_peer_disconnected(int sockfd)
+{
 	assert(sockfd < MAXFDS);
-
-	// Initialize state to send back a '*' to the peer immediately.
 	peer_state_t* peerstate = &global_state[sockfd];
-	peerstate->state = WAIT_FOR_MSG;
-	memset(peerstate->recv_buf, 0, SENDBUF_SIZE);
-	peerstate->buf_ptr = 0;
-	peerstate->buf_end = 0;
 
-	// Signal that this socket is ready for read now.
-	return fd_status_R;
+	if (peerstate->tok != NULL)
+		json_tokener_free(peerstate->tok);
+	free(peerstate->send_buf);
+	memset(peerstate, 0, sizeof(*peerstate));
 }
 
 /**
- * @brief Callback when ready to receive data from client
+ * @brief Initialize peer state once peer is connected
  *
  * @param sockfd socket file descriptor
+ * @param peer_addr
+ * @param peer_addr_len
  * @return fd_status_t
  */
-static fd_status_t on_peer_ready_recv(int sockfd) {
-	struct json_object *json;
+static fd_status_t on_peer_connected(int sockfd, const struct sockaddr_in* peer_addr,
+									socklen_t peer_addr_len) {
+	(void) peer_addr;
+	(void) peer_addr_len;
 	assert(sockfd < MAXFDS);
-	peer_state_t* peerstate = &global_state[sockfd];
 
-	if (peerstate->state == INITIAL_ACK ||
-		peerstate->buf_ptr < peerstate->buf_end) {
-		// Until the initial ACK has been sent to the peer, there's nothing we
-		// want to receive. Also, wait until all data staged for sending is sent to
-		// receive more data.
-		return fd_status_R;
-	}
+	// Remove any trace of a previous peer on the same fd.
+	on_peer_disconnected(sockfd);
 
-	char buf[1024];
-	int nbytes = recv(sockfd, buf, sizeof buf, 0);
-	if (nbytes == 0) {
-		// The peer disconnected.
+	peer_state_t* peerstate = &global_state[sockfd];
+	peerstate->tok = json_tokener_new();
+	if (peerstate->tok == NULL) {
+		log_error("Monitoring: Could not allocate json tokener for socket %d", sockfd);
 		return fd_status_NORW;
-	} else if (nbytes < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK) {
-		// The socket is not *really* ready for recv; wait until it is.
-		return fd_status_R;
-		} else {
-			log_error("recv");
-			return fd_status_NORW;
-		}
 	}
-	bool ready_to_send = false;
 
-	/** Store each byte received and try to parse it as a json
-	 * if we succeed to parse it as a json then we can analyse
-	 * and send the response
-	 */
-	for (int i = 0; i < nbytes; ++i) {
-		switch (peerstate->state) {
-		case INITIAL_ACK:
-			assert(0 && "can't reach here");
-			break;
-		case WAIT_FOR_MSG:
-			if (buf[i] == '{') {
-				peerstate->state = IN_MSG;
-				peerstate->recv_buf[0] = buf[i];
-				peerstate->buf_end++;
-			}
-			break;
-		case IN_MSG:
-			json = json_tokener_parse(peerstate->recv_buf);
-			if (json) {
-				json_object_put(json);
-				peerstate->state = WAIT_FOR_MSG;
-				ready_to_send = true;
-			} else {
-				assert(peerstate->buf_end < SENDBUF_SIZE);
-				peerstate->recv_buf[peerstate->buf_end++] = buf[i];
-			}
-			break;
-		}
-	}
-
-	json = json_tokener_parse(peerstate->recv_buf);
-	if (json) {
-		json_object_put(json);
-		peerstate->state = WAIT_FOR_MSG;
-		ready_to_send = true;
-	}
-
-	// Report reading readiness iff there's nothing to analyse from the peer as a
-	// result of the latest recv.
-	return (fd_status_t){.want_read = !ready_to_send,
-						.want_write = ready_to_send};
+	// Signal that this socket is ready for read now.
+	return fd_status_R;
 }
 
 static void json_add_float_array(struct json_object *json, char * array_name, float * array, int length) {
@@ -410,46 +379,48 @@ static void json_add_disciplining_disciplining_parameters(struct json_object *re
 }
 
 /**
- * @brief Handle request received by setting monitoring request
+ * @brief Handle request received by queuing it for the main loop
  * and add action request in json response
  *
+ * @param monitoring
  * @param request_type
- * @param mon_request
  * @param resp
  */
-static void json_handle_request(struct monitoring *monitoring, int request_type, enum monitoring_request *mon_request, struct json_object *resp)
+static void json_handle_request(struct monitoring *monitoring, int request_type, struct json_object *resp)
 {
+	enum monitoring_request action = REQUEST_NONE;
+
 	switch (request_type)
 	{
 	case REQUEST_CALIBRATION:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("calibration"));
-		*mon_request = REQUEST_CALIBRATION;
+		action = REQUEST_CALIBRATION;
 		break;
 	case REQUEST_GNSS_START:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("GNSS start"));
-		*mon_request = REQUEST_GNSS_START;
+		action = REQUEST_GNSS_START;
 		break;
 	case REQUEST_GNSS_STOP:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("GNSS stop"));
-		*mon_request = REQUEST_GNSS_STOP;
+		action = REQUEST_GNSS_STOP;
 		break;
 	case REQUEST_GNSS_SOFT:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("GNSS soft"));
-		*mon_request = REQUEST_GNSS_SOFT;
+		action = REQUEST_GNSS_SOFT;
 		break;
 	case REQUEST_GNSS_HARD:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("GNSS hard"));
-		*mon_request = REQUEST_GNSS_HARD;
+		action = REQUEST_GNSS_HARD;
 		break;
 	case REQUEST_GNSS_COLD:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("GNSS cold"));
-		*mon_request = REQUEST_GNSS_COLD;
+		action = REQUEST_GNSS_COLD;
 		break;
 	case REQUEST_READ_EEPROM:
 	{
@@ -468,32 +439,32 @@ static void json_handle_request(struct monitoring *monitoring, int request_type,
 	case REQUEST_SAVE_EEPROM:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("Save EEPROM"));
-		*mon_request = REQUEST_SAVE_EEPROM;
+		action = REQUEST_SAVE_EEPROM;
 		break;
 	case REQUEST_FAKE_HOLDOVER_START:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("Start fake holdover"));
-		*mon_request = REQUEST_FAKE_HOLDOVER_START;
+		action = REQUEST_FAKE_HOLDOVER_START;
 		break;
 	case REQUEST_FAKE_HOLDOVER_STOP:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("Stop fake holdover"));
-		*mon_request = REQUEST_FAKE_HOLDOVER_STOP;
+		action = REQUEST_FAKE_HOLDOVER_STOP;
 		break;
 	case REQUEST_MRO_COARSE_INC:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("MRO coarse inc"));
-		*mon_request = REQUEST_MRO_COARSE_INC;
+		action = REQUEST_MRO_COARSE_INC;
 		break;
 	case REQUEST_MRO_COARSE_DEC:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("MRO coarse dec"));
-		*mon_request = REQUEST_MRO_COARSE_DEC;
+		action = REQUEST_MRO_COARSE_DEC;
 		break;
 	case REQUEST_RESET_UBLOX_SERIAL:
 		json_object_object_add(resp, "Action requested",
 			json_object_new_string("Ublox Serial reset"));
-		*mon_request = REQUEST_RESET_UBLOX_SERIAL;
+		action = REQUEST_RESET_UBLOX_SERIAL;
 		break;
 	case REQUEST_NONE:
 	default:
@@ -501,16 +472,23 @@ static void json_handle_request(struct monitoring *monitoring, int request_type,
 			json_object_new_string("None"));
 		break;
 	}
+
+	/* Notify main loop about the request */
+	if (action != REQUEST_NONE && !mpsc_queue_push(&monitoring->requests, action)) {
+		log_warn("Monitoring: Request queue full, dropping request %d", action);
+		json_object_object_add(resp, "error",
+			json_object_new_string("Request queue full"));
+	}
 }
 
-static void json_add_clock_data(struct json_object *resp, struct monitoring *monitoring)
+static void json_add_clock_data(struct json_object *resp, const struct monitoring_state *state)
 {
 	struct json_object *clock = json_object_new_object();
 	json_object_object_add(clock, "class",
-		json_object_new_string(cstring_from_clock_class(monitoring->disciplining.clock_class))
+		json_object_new_string(cstring_from_clock_class(state->disciplining.clock_class))
 	);
 	json_object_object_add(clock, "offset",
-		json_object_new_int(monitoring->osc_attributes.phase_error));
+		json_object_new_int(state->osc_attributes.phase_error));
 
 	json_object_object_add(resp, "clock", clock);
 
@@ -520,29 +498,29 @@ static void json_add_clock_data(struct json_object *resp, struct monitoring *mon
  * @brief Add disciplining data to json response
  *
  * @param resp
- * @param monitoring
+ * @param state
  */
-static void json_add_disciplining_data(struct json_object *resp, struct monitoring *monitoring)
+static void json_add_disciplining_data(struct json_object *resp, const struct monitoring_state *state)
 {
 	char fix_sized[64];
-	snprintf(fix_sized, sizeof(fix_sized), "%.2f", monitoring->disciplining.convergence_progress);
+	snprintf(fix_sized, sizeof(fix_sized), "%.2f", state->disciplining.convergence_progress);
 
 	struct json_object* disciplining = json_object_new_object();
 	json_object_object_add(disciplining,
 	                       "status",
-	                       json_object_new_string(cstring_from_disciplining_state(monitoring->disciplining.status)));
+	                       json_object_new_string(cstring_from_disciplining_state(state->disciplining.status)));
 	json_object_object_add(disciplining,
 	                       "current_phase_convergence_count",
-	                       json_object_new_int(monitoring->disciplining.current_phase_convergence_count));
+	                       json_object_new_int(state->disciplining.current_phase_convergence_count));
 	json_object_object_add(disciplining,
 	                       "valid_phase_convergence_threshold",
-	                       json_object_new_int(monitoring->disciplining.valid_phase_convergence_threshold));
+	                       json_object_new_int(state->disciplining.valid_phase_convergence_threshold));
 	json_object_object_add(disciplining,
 	                       "convergence_progress",
-	                       json_object_new_double_s(monitoring->disciplining.convergence_progress, fix_sized));
+	                       json_object_new_double_s(state->disciplining.convergence_progress, fix_sized));
 	json_object_object_add(disciplining,
 	                       "ready_for_holdover",
-	                       json_object_new_boolean(monitoring->disciplining.ready_for_holdover));
+	                       json_object_new_boolean(state->disciplining.ready_for_holdover));
 	json_object_object_add(resp, "disciplining", disciplining);
 }
 
@@ -550,129 +528,492 @@ static void json_add_disciplining_data(struct json_object *resp, struct monitori
  * @brief Add oscillator data to json response
  *
  * @param resp
- * @param monitoring
+ * @param model
+ * @param state
  */
-static void json_add_oscillator_data(struct json_object *resp, struct monitoring *monitoring)
+static void json_add_oscillator_data(struct json_object *resp, const char *model, const struct monitoring_state *state)
 {
 	char fix_sized[64];
-	snprintf(fix_sized, sizeof(fix_sized), "%.2f", monitoring->osc_attributes.temperature);
+	snprintf(fix_sized, sizeof(fix_sized), "%.2f", state->osc_attributes.temperature);
 
 	struct json_object* oscillator = json_object_new_object();
-	json_object_object_add(oscillator, "model", json_object_new_string(monitoring->oscillator_model));
-	json_object_object_add(oscillator, "fine_ctrl", json_object_new_int(monitoring->ctrl_values.fine_ctrl));
-	json_object_object_add(oscillator, "coarse_ctrl", json_object_new_int(monitoring->ctrl_values.coarse_ctrl));
-	json_object_object_add(oscillator, "lock", json_object_new_boolean(monitoring->osc_attributes.locked));
-	json_object_object_add(oscillator, "temperature", json_object_new_double_s(monitoring->osc_attributes.temperature, fix_sized));
+	json_object_object_add(oscillator, "model", json_object_new_string(model));
+	json_object_object_add(oscillator, "fine_ctrl", json_object_new_int(state->ctrl_values.fine_ctrl));
+	json_object_object_add(oscillator, "coarse_ctrl", json_object_new_int(state->ctrl_values.coarse_ctrl));
+	json_object_object_add(oscillator, "lock", json_object_new_boolean(state->osc_attributes.locked));
+	json_object_object_add(oscillator, "temperature", json_object_new_double_s(state->osc_attributes.temperature, fix_sized));
 
 	json_object_object_add(resp, "oscillator", oscillator);
 }
 
 /**
- * @brief Add GNSS data to json response. Must be called under gnss_info.lock locked
+ * @brief Build json object of RTCM server statistics
+ *
+ * @param stats
+ * @return json object with the counters of the server and of each client
+ */
+static struct json_object *json_rtcm_stats(const struct rtcm_stats *stats)
+{
+	struct json_object *rtcm = json_object_new_object();
+	struct json_object *clients = json_object_new_array();
+
+	json_object_object_add(rtcm, "frames_received",
+		json_object_new_int64(stats->frames_received));
+	json_object_object_add(rtcm, "bytes_received",
+		json_object_new_int64(stats->bytes_received));
+	for (int i = 0; i < stats->nb_clients; i++) {
+		const struct rtcm_client_stats *client_stats = &stats->clients[i];
+		struct json_object *client = json_object_new_object();
+
+		json_object_object_add(client, "id",
+			json_object_new_int(client_stats->id));
+		json_object_object_add(client, "frames_queued",
+			json_object_new_int64(client_stats->frames_queued));
+		json_object_object_add(client, "frames_dropped",
+			json_object_new_int64(client_stats->frames_dropped));
+		json_object_object_add(client, "bytes_sent",
+			json_object_new_int64(client_stats->bytes_sent));
+		json_object_object_add(client, "queued_bytes",
+			json_object_new_int64(client_stats->queued));
+		json_object_array_add(clients, client);
+	}
+	json_object_object_add(rtcm, "clients", clients);
+
+	return rtcm;
+}
+
+/**
+ * @brief Add GNSS data to json response
  *
  * @param resp
- * @param monitoring
+ * @param gnss_info
  */
-static void json_add_gnss_data(struct json_object *resp, struct monitoring *monitoring)
+static void json_add_gnss_data(struct json_object *resp, const struct gnss_state *gnss_info)
 {
 	struct json_object *gnss = json_object_new_object();
 	json_object_object_add(gnss, "fix",
-		json_object_new_int(monitoring->gnss_info.fix));
+		json_object_new_int(gnss_info->fix));
 	json_object_object_add(gnss, "fixOk",
-		json_object_new_boolean(monitoring->gnss_info.fixOk));
+		json_object_new_boolean(gnss_info->fixOk));
 	json_object_object_add(gnss, "antenna_power",
-		json_object_new_int(monitoring->gnss_info.antenna_power));
+		json_object_new_int(gnss_info->antenna_power));
 	json_object_object_add(gnss, "antenna_status",
-		json_object_new_int(monitoring->gnss_info.antenna_status));
+		json_object_new_int(gnss_info->antenna_status));
 	json_object_object_add(gnss, "lsChange",
-		json_object_new_int(monitoring->gnss_info.lsChange));
+		json_object_new_int(gnss_info->lsChange));
 	json_object_object_add(gnss, "leap_seconds",
-		json_object_new_int(monitoring->gnss_info.leap_seconds));
+		json_object_new_int(gnss_info->leap_seconds));
 	json_object_object_add(gnss, "satellites_count",
-		json_object_new_int(monitoring->gnss_info.satellites_count));
+		json_object_new_int(gnss_info->satellites_count));
 	json_object_object_add(gnss, "survey_in_position_error",
-		json_object_new_int(monitoring->gnss_info.survey_in_position_error));
+		json_object_new_int(gnss_info->survey_in_position_error));
 	json_object_object_add(gnss, "time_accuracy",
-		json_object_new_int(monitoring->gnss_info.time_accuracy));
+		json_object_new_int(gnss_info->time_accuracy));
+	json_object_object_add(gnss, "baudrate",
+		json_object_new_int(gnss_info->baudrate));
+	json_object_object_add(gnss, "tim_tp_latency_us",
+		json_object_new_int(gnss_info->tim_tp_latency_us));
+	json_object_object_add(gnss, "nav_pvt_latency_us",
+		json_object_new_int(gnss_info->nav_pvt_latency_us));
+	if (gnss_info->rtcm.enabled)
+		json_object_object_add(gnss, "rtcm", json_rtcm_stats(&gnss_info->rtcm));
 
 	json_object_object_add(resp, "gnss", gnss);
 }
 
 /**
- * @brief Analyse request and send response
+ * @brief Add system clock synchronization data to json response, if enabled
+ *
+ * @param resp
+ * @param sys_sync_info
+ */
+static void json_add_sys_sync_data(struct json_object *resp, const struct sys_sync_state *sys_sync_info)
+{
+	struct json_object *system_clock;
+
+	if (!sys_sync_info->enabled)
+		return;
+
+	system_clock = json_object_new_object();
+	json_object_object_add(system_clock, "locked",
+		json_object_new_boolean(sys_sync_info->state == CLOCK_SERVO_LOCKED));
+	json_object_object_add(system_clock, "offset",
+		json_object_new_int64(sys_sync_info->offset));
+	json_object_object_add(system_clock, "delay",
+		json_object_new_int64(sys_sync_info->delay));
+	json_object_object_add(system_clock, "freq",
+		json_object_new_double(sys_sync_info->freq));
+	json_object_object_add(system_clock, "offset_rms",
+		json_object_new_int64(sys_sync_info->offset_rms));
+	json_object_object_add(system_clock, "delay_max",
+		json_object_new_int64(sys_sync_info->delay_max));
+	json_object_object_add(system_clock, "hardware_cross_timestamps",
+		json_object_new_boolean(sys_sync_info->precise));
+
+	json_object_object_add(resp, "system_clock", system_clock);
+}
+
+/**
+ * @brief Add secondary PHCs synchronization data to json response, if any
+ *
+ * @param resp
+ * @param phc_sync_info
+ */
+static void json_add_phc_sync_data(struct json_object *resp, const struct phc_sync_state *phc_sync_info)
+{
+	struct json_object *targets;
+
+	if (phc_sync_info->nb_targets == 0)
+		return;
+
+	targets = json_object_new_array();
+	for (int i = 0; i < phc_sync_info->nb_targets; i++) {
+		const struct phc_target_state *target_info = &phc_sync_info->targets[i];
+		struct json_object *target = json_object_new_object();
+
+		json_object_object_add(target, "device",
+			json_object_new_string(target_info->path));
+		json_object_object_add(target, "locked",
+			json_object_new_boolean(target_info->state == CLOCK_SERVO_LOCKED));
+		json_object_object_add(target, "offset",
+			json_object_new_int64(target_info->offset));
+		json_object_object_add(target, "freq",
+			json_object_new_double(target_info->freq));
+		json_object_object_add(target, "offset_rms",
+			json_object_new_int64(target_info->offset_rms));
+		json_object_array_add(targets, target);
+	}
+
+	json_object_object_add(resp, "phc_targets", targets);
+}
+
+/**
+ * @brief Queue a response in the peer's send buffer, terminated by a newline
+ *
+ * @param peerstate peer state
+ * @param json_resp response to serialize
+ * @return 0 on success, -ENOMEM if the send buffer could not grow
+ */
+static int peer_queue_response(peer_state_t *peerstate, struct json_object *json_resp)
+{
+	const char *resp = json_object_to_json_string(json_resp);
+	size_t len = strlen(resp);
+	size_t pending = peerstate->send_end - peerstate->send_ptr;
+
+	if (peerstate->send_end + len + 1 > peerstate->send_size) {
+		// Move data not sent yet to the beginning of the buffer first
+		memmove(peerstate->send_buf, peerstate->send_buf + peerstate->send_ptr, pending);
+		peerstate->send_ptr = 0;
+		peerstate->send_end = pending;
+	}
+
+	if (pending + len + 1 > peerstate->send_size) {
+		size_t new_size = peerstate->send_size > 0 ? peerstate->send_size : SENDBUF_SIZE;
+		char *new_buf;
+
+		while (new_size < pending + len + 1)
+			new_size *= 2;
+		new_buf = realloc(peerstate->send_buf, new_size);
+		if (new_buf == NULL) {
+			log_error("Monitoring: Could not grow send buffer to %zu bytes", new_size);
+			return -ENOMEM;
+		}
+		peerstate->send_buf = new_buf;
+		peerstate->send_size = new_size;
+	}
+
+	memcpy(peerstate->send_buf + peerstate->send_end, resp, len);
+	peerstate->send_end += len;
+	peerstate->send_buf[peerstate->send_end++] = '\n';
+	return 0;
+}
+
+/**
+ * @brief Handle a single request and queue its response
+ *
+ * The "id" member of the request, if any, is echoed back untouched in the
+ * response so clients can match responses with the requests they sent.
  *
- * @param sockfd socket file descriptor
  * @param monitoring monitoring struct pointer
- * @return fd_status_t
+ * @param peerstate peer state
+ * @param json_req request object
+ * @return 0 on success, negative error code otherwise
  */
-static fd_status_t on_peer_ready_send(int sockfd, struct monitoring * monitoring) {
+static int monitoring_handle_request(struct monitoring *monitoring, peer_state_t *peerstate, struct json_object *json_req)
+{
 	enum monitoring_request request_type = REQUEST_NONE;
-	struct json_object *json_req;
+	struct monitoring_state state;
+	struct gnss_state gnss_info;
+	struct sys_sync_state sys_sync_info;
+	struct phc_sync_state phc_sync_info;
+	struct json_object *json_request_type;
+	struct json_object *json_id;
 	struct json_object *json_resp;
 	int ret;
 
-	assert(sockfd < MAXFDS);
-	peer_state_t* peerstate = &global_state[sockfd];
-
-	// json_tokener_parse will() return NULL if the JSON is invalid. Otherwise, it will call
-	// json_object_new_object() and put the reference count of the object to 1. The object
-	// must be freed by json_object_put() manually.
-	struct json_object *obj = json_tokener_parse(peerstate->recv_buf);
-	memset(peerstate->recv_buf, 0, SENDBUF_SIZE);
-	if (!obj) {
-		log_error("Monitoring: Error parsing request");
-		return fd_status_W;
-	}
-
-	json_object_object_get_ex(obj, "request", &json_req);
 	// According to the doc "No reference counts will be changed.
 	// There is no need to manually adjust reference counts through the json_object_put/json_object_get methods"
-
-	request_type = (enum monitoring_request) json_object_get_int(json_req);
-	// json request object is not used after this point, so we can free it
-	json_object_put(obj);
+	if (json_object_object_get_ex(json_req, "request", &json_request_type))
+		request_type = (enum monitoring_request) json_object_get_int(json_request_type);
 
 	json_resp = json_object_new_object();
+	if (json_object_object_get_ex(json_req, "id", &json_id))
+		json_object_object_add(json_resp, "id", json_object_get(json_id));
 
-	/* Notify main loop about the request */
-	pthread_mutex_lock(&monitoring->mutex);
+	json_handle_request(monitoring, request_type, json_resp);
 
-	json_handle_request(monitoring, request_type, &monitoring->request, json_resp);
+	snapshot_read(&monitoring->state, &state);
+	snapshot_read(&monitoring->gnss_info, &gnss_info);
+	snapshot_read(&monitoring->sys_sync_info, &sys_sync_info);
+	snapshot_read(&monitoring->phc_sync_info, &phc_sync_info);
 
 	if (monitoring->disciplining_mode || monitoring->phase_error_supported)
-		json_add_disciplining_data(json_resp, monitoring);
+		json_add_disciplining_data(json_resp, &state);
 
-	json_add_clock_data(json_resp, monitoring);
-	json_add_oscillator_data(json_resp, monitoring);
+	json_add_clock_data(json_resp, &state);
+	json_add_oscillator_data(json_resp, monitoring->oscillator_model, &state);
+	json_add_gnss_data(json_resp, &gnss_info);
+	json_add_sys_sync_data(json_resp, &sys_sync_info);
+	json_add_phc_sync_data(json_resp, &phc_sync_info);
 
-	pthread_mutex_unlock(&monitoring->mutex);
+	ret = peer_queue_response(peerstate, json_resp);
+	// json_resp and all embedded objects are freed here because of transfer
+	// of ownership to the outer object with json_object_object_add().
+	json_object_put(json_resp);
+	return ret;
+}
 
-	pthread_mutex_lock(&monitoring->gnss_info.lock);
-	json_add_gnss_data(json_resp, monitoring);
-	pthread_mutex_unlock(&monitoring->gnss_info.lock);
+/**
+ * @brief Queue an error response for a frame that could not be handled
+ *
+ * @param peerstate peer state
+ * @param error error description
+ * @return 0 on success, negative error code otherwise
+ */
+static int monitoring_queue_error(peer_state_t *peerstate, const char *error)
+{
+	struct json_object *json_resp = json_object_new_object();
+	int ret;
 
-	const char *resp = json_object_to_json_string(json_resp);
-	ret = send(sockfd, resp, strlen(resp), 0);
-	// json_resp and it's string representation are not used after this point
-	// so we can free them. All embedded objects are also freed because of transfer
-	// of ownership to the outer object with json_object_object_add().
+	json_object_object_add(json_resp, "error", json_object_new_string(error));
+	ret = peer_queue_response(peerstate, json_resp);
 	json_object_put(json_resp);
-	if (ret == -1) {
-		log_error("Monitoring: Error sending response: %d", ret);
-		return fd_status_W;
-
-	} else {
-		// Everything was sent successfully; reset the send queue.
-		peerstate->buf_ptr = 0;
-		peerstate->buf_end = 0;
-
-		// Special-case state transition in if we were in INITIAL_ACK until now.
-		if (peerstate->state == INITIAL_ACK) {
-			peerstate->state = WAIT_FOR_MSG;
+	return ret;
+}
+
+/**
+ * @brief Handle a request frame
+ *
+ * A frame is either a single request object:
+ * {"id": 1, "request": 0}
+ * or a batch of requests, answered with one response per request:
+ * {"requests": [{"id": 1, "request": 0}, {"id": 2, "request": 7}]}
+ *
+ * @param monitoring monitoring struct pointer
+ * @param peerstate peer state
+ * @param frame parsed frame
+ * @return 0 on success, negative error code otherwise
+ */
+static int monitoring_handle_frame(struct monitoring *monitoring, peer_state_t *peerstate, struct json_object *frame)
+{
+	struct json_object *requests;
+	size_t nb_requests;
+	int ret;
+
+	if (!json_object_is_type(frame, json_type_object)) {
+		log_error("Monitoring: Request frame is not a JSON object");
+		return monitoring_queue_error(peerstate, "Request frame is not a JSON object");
+	}
+
+	if (!json_object_object_get_ex(frame, "requests", &requests))
+		return monitoring_handle_request(monitoring, peerstate, frame);
+
+	if (!json_object_is_type(requests, json_type_array)) {
+		log_error("Monitoring: \"requests\" is not an array");
+		return monitoring_queue_error(peerstate, "\"requests\" is not an array");
+	}
+
+	nb_requests = json_object_array_length(requests);
+	if (nb_requests > MAX_REQUESTS_PER_FRAME) {
+		log_error("Monitoring: Too many requests in frame (%zu > %d)", nb_requests, MAX_REQUESTS_PER_FRAME);
+		return monitoring_queue_error(peerstate, "Too many requests in frame");
+	}
+
+	for (size_t i = 0; i < nb_requests; i++) {
+		struct json_object *json_req = json_object_array_get_idx(requests, i);
+
+		if (json_object_is_type(json_req, json_type_object))
+			ret = monitoring_handle_request(monitoring, peerstate, json_req);
+		else
+			ret = monitoring_queue_error(peerstate, "Request is not a JSON object");
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * @brief Compute which events to wait for depending on the data queued for the peer
+ *
+ * @param peerstate peer state
+ * @return fd_status_t
+ */
+static fd_status_t peer_status(const peer_state_t *peerstate)
+{
+	size_t pending = peerstate->send_end - peerstate->send_ptr;
+
+	// Stop reading from a peer that does not read its responses
+	return (fd_status_t){.want_read = pending < SENDBUF_HIGH_WATERMARK,
+						.want_write = pending > 0};
+}
+
+/**
+ * @brief Callback when ready to receive data from client
+ *
+ * Every complete frame received is handled right away and its responses are
+ * queued, partial frames are kept in the peer's tokener until more data comes.
+ * A frame that can't be parsed gets an error response, and parsing resumes
+ * after the next newline.
+ *
+ * @param sockfd socket file descriptor
+ * @param monitoring monitoring struct pointer
+ * @return fd_status_t
+ */
+static fd_status_t on_peer_ready_recv(int sockfd, struct monitoring *monitoring) {
+	struct json_object *frame;
+	enum json_tokener_error jerr;
+	char buf[RECVBUF_SIZE];
+	int offset = 0;
+
+	assert(sockfd < MAXFDS);
+	peer_state_t* peerstate = &global_state[sockfd];
+
+	int nbytes = recv(sockfd, buf, sizeof buf, 0);
+	if (nbytes == 0) {
+		// The peer disconnected.
+		return fd_status_NORW;
+	} else if (nbytes < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			// The socket is not *really* ready for recv; wait until it is.
+			return peer_status(peerstate);
+		} else {
+			log_error("recv");
+			return fd_status_NORW;
+		}
+	}
+
+	while (offset < nbytes) {
+		if (peerstate->discard_line) {
+			char *eol = memchr(buf + offset, '\n', nbytes - offset);
+
+			if (eol == NULL)
+				break;
+			offset = eol - buf + 1;
+			peerstate->discard_line = false;
+			continue;
 		}
 
-		return fd_status_R;
+		frame = json_tokener_parse_ex(peerstate->tok, buf + offset, nbytes - offset);
+		jerr = json_tokener_get_error(peerstate->tok);
+
+		if (frame == NULL && jerr == json_tokener_continue) {
+			// Whole chunk consumed, frame is not complete yet
+			peerstate->frame_len += nbytes - offset;
+			if (peerstate->frame_len > MAX_FRAME_SIZE) {
+				log_error("Monitoring: Request frame exceeds %d bytes", MAX_FRAME_SIZE);
+				json_tokener_reset(peerstate->tok);
+				peerstate->frame_len = 0;
+				peerstate->discard_line = true;
+				if (monitoring_queue_error(peerstate, "Request frame too large") < 0)
+					return fd_status_NORW;
+			}
+			break;
+		} else if (frame == NULL) {
+			// Resynchronize after the next newline, starting from the offending char
+			log_error("Monitoring: Error parsing request: %s", json_tokener_error_desc(jerr));
+			offset += json_tokener_get_parse_end(peerstate->tok);
+			json_tokener_reset(peerstate->tok);
+			peerstate->frame_len = 0;
+			peerstate->discard_line = true;
+			if (monitoring_queue_error(peerstate, json_tokener_error_desc(jerr)) < 0)
+				return fd_status_NORW;
+			continue;
+		}
+
+		offset += json_tokener_get_parse_end(peerstate->tok);
+		peerstate->frame_len = 0;
+
+		int ret = monitoring_handle_frame(monitoring, peerstate, frame);
+		// json_tokener_parse_ex() gives us a reference on the frame we must release
+		json_object_put(frame);
+		if (ret < 0)
+			return fd_status_NORW;
+	}
+
+	return peer_status(peerstate);
+}
+
+/**
+ * @brief Send as much of the queued responses as the socket accepts
+ *
+ * @param sockfd socket file descriptor
+ * @return fd_status_t
+ */
+static fd_status_t on_peer_ready_send(int sockfd) {
+	assert(sockfd < MAXFDS);
+	peer_state_t* peerstate = &global_state[sockfd];
+
+	while (peerstate->send_ptr < peerstate->send_end) {
+		ssize_t ret = send(sockfd, peerstate->send_buf + peerstate->send_ptr,
+			peerstate->send_end - peerstate->send_ptr, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return peer_status(peerstate);
+			log_error("Monitoring: Error sending response: %s", strerror(errno));
+			return fd_status_NORW;
+		}
+		peerstate->send_ptr += ret;
+	}
+
+	// Everything was sent successfully; reset the send queue.
+	peerstate->send_ptr = 0;
+	peerstate->send_end = 0;
+	return fd_status_R;
+}
+
+/**
+ * @brief Update events monitored for a peer, closing it when none are left
+ *
+ * @param epollfd epoll file descriptor
+ * @param fd peer socket file descriptor
+ * @param status events wanted for the peer
+ * @return 0 on success, -1 if epoll could not be updated
+ */
+static int update_peer_events(int epollfd, int fd, fd_status_t status)
+{
+	struct epoll_event event = {0};
+
+	event.data.fd = fd;
+	if (status.want_read) {
+		event.events |= EPOLLIN;
 	}
+	if (status.want_write) {
+		event.events |= EPOLLOUT;
+	}
+
+	if (event.events == 0) {
+		log_trace("socket %d closing", fd);
+		if (epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+			log_error("epoll_ctl EPOLL_CTL_DEL");
+			return -1;
+		}
+		on_peer_disconnected(fd);
+		close(fd);
+	} else if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0) {
+		log_error("epoll_ctl EPOLL_CTL_MOD");
+		return -1;
+	}
+	return 0;
 }
 
 /**
@@ -725,28 +1066,71 @@ struct monitoring* monitoring_init(const struct config *config, struct devices_p
 	monitoring->phase_error_supported = false;
 	memcpy(&monitoring->devices_path, devices_path, sizeof(struct devices_path));
 
-	monitoring->disciplining.clock_class = CLOCK_CLASS_UNCALIBRATED;
-	monitoring->disciplining.status = WARMUP;
-	monitoring->disciplining.current_phase_convergence_count = -1;
-	monitoring->disciplining.valid_phase_convergence_threshold = -1;
-	monitoring->disciplining.convergence_progress = 0.00;
-	monitoring->disciplining.ready_for_holdover = false;
-	monitoring->ctrl_values.fine_ctrl = -1;
-	monitoring->ctrl_values.coarse_ctrl = -1;
-	monitoring->osc_attributes.locked = false;
-	monitoring->osc_attributes.temperature = -400.0;
-	monitoring->osc_attributes.phase_error = 0;
-
-	monitoring->gnss_info.antenna_power = -1;
-	monitoring->gnss_info.antenna_status = -1;
-	monitoring->gnss_info.leap_seconds = -1;
-	monitoring->gnss_info.fix = -1;
-	monitoring->gnss_info.fixOk = false;
-	monitoring->gnss_info.lsChange = -10;
-	monitoring->gnss_info.satellites_count = -1;
-	monitoring->gnss_info.survey_in_position_error = -1.0;
-	monitoring->gnss_info.time_accuracy = -1;
-	pthread_mutex_init(&monitoring->gnss_info.lock, NULL);
+	struct monitoring_state state = {
+		.disciplining = {
+			.clock_class = CLOCK_CLASS_UNCALIBRATED,
+			.status = WARMUP,
+			.current_phase_convergence_count = -1,
+			.valid_phase_convergence_threshold = -1,
+			.convergence_progress = 0.00,
+			.ready_for_holdover = false,
+		},
+		.ctrl_values = {
+			.fine_ctrl = -1,
+			.coarse_ctrl = -1,
+		},
+		.osc_attributes = {
+			.locked = false,
+			.temperature = -400.0,
+			.phase_error = 0,
+		},
+	};
+	struct gnss_state gnss_info = {
+		.antenna_power = -1,
+		.antenna_status = -1,
+		.leap_seconds = -1,
+		.fix = -1,
+		.fixOk = false,
+		.lsChange = -10,
+		.satellites_count = -1,
+		.survey_in_position_error = -1.0,
+		.time_accuracy = -1,
+	};
+	struct sys_sync_state sys_sync_info = {
+		.enabled = false,
+		.offset_rms = -1,
+		.delay_max = -1,
+	};
+	struct phc_sync_state phc_sync_info = {
+		.nb_targets = 0,
+	};
+	if (snapshot_init(&monitoring->state, sizeof(state), &state) != 0) {
+		log_error("Monitoring: Could not allocate memory for monitoring state");
+		free(monitoring);
+		return NULL;
+	}
+	if (snapshot_init(&monitoring->gnss_info, sizeof(gnss_info), &gnss_info) != 0) {
+		log_error("Monitoring: Could not allocate memory for gnss state");
+		snapshot_destroy(&monitoring->state);
+		free(monitoring);
+		return NULL;
+	}
+	if (snapshot_init(&monitoring->sys_sync_info, sizeof(sys_sync_info), &sys_sync_info) != 0) {
+		log_error("Monitoring: Could not allocate memory for system clock state");
+		snapshot_destroy(&monitoring->state);
+		snapshot_destroy(&monitoring->gnss_info);
+		free(monitoring);
+		return NULL;
+	}
+	if (snapshot_init(&monitoring->phc_sync_info, sizeof(phc_sync_info), &phc_sync_info) != 0) {
+		log_error("Monitoring: Could not allocate memory for PHC targets state");
+		snapshot_destroy(&monitoring->state);
+		snapshot_destroy(&monitoring->gnss_info);
+		snapshot_destroy(&monitoring->sys_sync_info);
+		free(monitoring);
+		return NULL;
+	}
+	mpsc_queue_init(&monitoring->requests);
 
 	pthread_mutex_init(&monitoring->mutex, NULL);
 	pthread_cond_init(&monitoring->cond, NULL);
@@ -755,6 +1139,10 @@ struct monitoring* monitoring_init(const struct config *config, struct devices_p
 	if (monitoring->sockfd == -1)
 	{
 		log_error("Monitoring: Error creating monitoring socket");
+		snapshot_destroy(&monitoring->state);
+		snapshot_destroy(&monitoring->gnss_info);
+		snapshot_destroy(&monitoring->sys_sync_info);
+		snapshot_destroy(&monitoring->phc_sync_info);
 		free(monitoring);
 		return NULL;
 	}
@@ -772,12 +1160,44 @@ struct monitoring* monitoring_init(const struct config *config, struct devices_p
 	{
 		log_error("Monitoring: Error creating monitoring thread: %d", ret);
 		close(monitoring->sockfd);
+		snapshot_destroy(&monitoring->state);
+		snapshot_destroy(&monitoring->gnss_info);
+		snapshot_destroy(&monitoring->sys_sync_info);
+		snapshot_destroy(&monitoring->phc_sync_info);
 		free(monitoring);
 		return NULL;
 	}
 	return monitoring;
 }
 
+/**
+ * @brief Publish state of the main loop for monitoring clients. Never blocks
+ *
+ * @param monitoring
+ * @param state
+ */
+void monitoring_publish_state(struct monitoring *monitoring, const struct monitoring_state *state)
+{
+	snapshot_publish(&monitoring->state, state);
+}
+
+/**
+ * @brief Get next request sent by monitoring clients. Never blocks
+ *
+ * Must only be called from the main loop.
+ *
+ * @param monitoring
+ * @return oldest request not handled yet, REQUEST_NONE if there is none
+ */
+enum monitoring_request monitoring_get_request(struct monitoring *monitoring)
+{
+	int request;
+
+	if (!mpsc_queue_pop(&monitoring->requests, &request))
+		return REQUEST_NONE;
+	return (enum monitoring_request) request;
+}
+
 /**
  * @brief Stop monitoring thread
  *
@@ -793,6 +1213,10 @@ void monitoring_stop(struct monitoring *monitoring)
 	pthread_mutex_unlock(&monitoring->mutex);
 	pthread_join(monitoring->thread, NULL);
 	close(monitoring->sockfd);
+	snapshot_destroy(&monitoring->state);
+	snapshot_destroy(&monitoring->gnss_info);
+	snapshot_destroy(&monitoring->sys_sync_info);
+	snapshot_destroy(&monitoring->phc_sync_info);
 	free(monitoring);
 	return;
 }
@@ -842,6 +1266,7 @@ static void *monitoring_thread(void * p_data)
 					log_error("epoll_ctl EPOLL_CTL_DEL");
 					return NULL;
 				}
+				on_peer_disconnected(events[i].data.fd);
 				close(events[i].data.fd);
 				continue;
 			}
@@ -872,6 +1297,10 @@ static void *monitoring_thread(void * p_data)
 
 					fd_status_t status =
 						on_peer_connected(newsockfd, &peer_addr, peer_addr_len);
+					if (!status.want_read && !status.want_write) {
+						close(newsockfd);
+						continue;
+					}
 					struct epoll_event event = {0};
 					event.data.fd = newsockfd;
 					if (status.want_read) {
@@ -888,54 +1317,20 @@ static void *monitoring_thread(void * p_data)
 				}
 			} else {
 				// A peer socket is ready.
+				int fd = events[i].data.fd;
+				fd_status_t status = fd_status_W;
+
 				if (events[i].events & EPOLLIN) {
 					// Ready for reading.
-					int fd = events[i].data.fd;
-					fd_status_t status = on_peer_ready_recv(fd);
-					struct epoll_event event = {0};
-					event.data.fd = fd;
-					if (status.want_read) {
-						event.events |= EPOLLIN;
-					}
-					if (status.want_write) {
-						event.events |= EPOLLOUT;
-					}
-					if (event.events == 0) {
-						log_trace("socket %d closing", fd);
-						if (epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
-							log_error("epoll_ctl EPOLL_CTL_DEL");
-							return NULL;
-						}
-						close(fd);
-					} else if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0) {
-						log_error("epoll_ctl EPOLL_CTL_MOD");
-						return NULL;
-					}
-				} else if (events[i].events & EPOLLOUT) {
-					// Ready for writing.
-					int fd = events[i].data.fd;
-					fd_status_t status = on_peer_ready_send(fd, monitoring);
-					struct epoll_event event = {0};
-					event.data.fd = fd;
-
-					if (status.want_read) {
-						event.events |= EPOLLIN;
-					}
-					if (status.want_write) {
-						event.events |= EPOLLOUT;
-					}
-					if (event.events == 0) {
-						log_trace("socket %d closing", fd);
-						if (epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
-							log_error("epoll_ctl EPOLL_CTL_DEL");
-							return NULL;
-						}
-						close(fd);
-					} else if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0) {
-						log_error("epoll_ctl EPOLL_CTL_MOD");
-						return NULL;
-					}
+					status = on_peer_ready_recv(fd, monitoring);
 				}
+				if (status.want_write) {
+					// Responses were just queued or are waiting for the
+					// socket to be writable, try sending them right away.
+					status = on_peer_ready_send(fd);
+				}
+				if (update_peer_events(epollfd, fd, status) < 0)
+					return NULL;
 			}
 		}
 		pthread_mutex_lock(&monitoring->mutex);
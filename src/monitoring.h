@@ -14,7 +14,9 @@
 #include <pthread.h>
 #include <oscillator-disciplining/oscillator-disciplining.h>
 #include "config.h"
+#include "mpsc_queue.h"
 #include "oscillator.h"
+#include "snapshot.h"
 
 enum monitoring_request {
 	REQUEST_NONE,
@@ -33,18 +35,36 @@ enum monitoring_request {
 	REQUEST_RESET_UBLOX_SERIAL
 };
 
+/**
+ * @brief State published by the main loop for the monitoring thread
+ */
+struct monitoring_state {
+	struct od_monitoring disciplining;
+	struct oscillator_ctrl ctrl_values;
+	struct oscillator_attributes osc_attributes;
+};
+
 /**
  * @brief General structure for monitoring thread
+ *
+ * Data are exchanged with the other threads without locks, so building a
+ * response can never delay them: states are read from snapshots and requests
+ * are pushed to a queue consumed by the main loop.
  */
 struct monitoring {
 	pthread_t thread;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
-	enum monitoring_request request;
-	struct od_monitoring disciplining;
-	struct oscillator_ctrl ctrl_values;
-	struct oscillator_attributes osc_attributes;
-	struct gnss_state gnss_info;
+	/** Requests for the main loop, of type enum monitoring_request */
+	struct mpsc_queue requests;
+	/** struct monitoring_state published by the main loop */
+	struct snapshot state;
+	/** struct gnss_state published by the gnss thread */
+	struct snapshot gnss_info;
+	/** struct sys_sync_state published by the system clock sync thread */
+	struct snapshot sys_sync_info;
+	/** struct phc_sync_state published by the PHC targets sync thread */
+	struct snapshot phc_sync_info;
 	const char *oscillator_model;
 	struct devices_path devices_path;
 	int sockfd;
@@ -55,4 +75,6 @@ struct monitoring {
 
 struct monitoring* monitoring_init(const struct config *config, struct devices_path *devices_path);
 void monitoring_stop(struct monitoring *monitoring);
+void monitoring_publish_state(struct monitoring *monitoring, const struct monitoring_state *state);
+enum monitoring_request monitoring_get_request(struct monitoring *monitoring);
 #endif // MONITORING_H
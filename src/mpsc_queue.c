@@ -0,0 +1,80 @@
+/**
+ * @file mpsc_queue.c
+ * @brief Bounded lock-free queue of integers, many producers and one consumer
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include "mpsc_queue.h"
+
+/**
+ * @brief Initialize an empty queue
+ *
+ * @param queue
+ */
+void mpsc_queue_init(struct mpsc_queue *queue)
+{
+	for (size_t i = 0; i < MPSC_QUEUE_SIZE; i++) {
+		atomic_init(&queue->cells[i].seq, i);
+		queue->cells[i].value = 0;
+	}
+	atomic_init(&queue->enqueue_pos, 0);
+	queue->dequeue_pos = 0;
+}
+
+/**
+ * @brief Push a value in the queue. Can be called from any thread
+ *
+ * @param queue
+ * @param value
+ * @return true on success, false if queue is full
+ */
+bool mpsc_queue_push(struct mpsc_queue *queue, int value)
+{
+	struct mpsc_queue_cell *cell;
+	size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+	for (;;) {
+		cell = &queue->cells[pos & (MPSC_QUEUE_SIZE - 1)];
+		size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		long diff = (long) seq - (long) pos;
+
+		if (diff == 0) {
+			/* Cell is free, try to own it */
+			if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			/* Consumer did not free this cell yet */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	cell->value = value;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * @brief Pop oldest value of the queue. Must only be called from the consumer thread
+ *
+ * @param queue
+ * @param value set to the value popped
+ * @return true if a value was popped, false if queue is empty
+ */
+bool mpsc_queue_pop(struct mpsc_queue *queue, int *value)
+{
+	size_t pos = queue->dequeue_pos;
+	struct mpsc_queue_cell *cell = &queue->cells[pos & (MPSC_QUEUE_SIZE - 1)];
+	size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+	if ((long) seq - (long) (pos + 1) < 0)
+		return false;
+
+	*value = cell->value;
+	atomic_store_explicit(&cell->seq, pos + MPSC_QUEUE_SIZE, memory_order_release);
+	queue->dequeue_pos = pos + 1;
+	return true;
+}
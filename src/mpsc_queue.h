@@ -0,0 +1,41 @@
+/**
+ * @file mpsc_queue.h
+ * @brief Bounded lock-free queue of integers, many producers and one consumer
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Each cell carries a sequence number telling whether it is free for the
+ * producer owning the current enqueue position or filled for the consumer,
+ * so neither side ever takes a lock.
+ */
+#ifndef OSCILLATORD_MPSC_QUEUE_H
+#define OSCILLATORD_MPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Number of cells of the queue, must be a power of 2 */
+#define MPSC_QUEUE_SIZE 64
+
+struct mpsc_queue_cell {
+	atomic_size_t seq;
+	int value;
+};
+
+/**
+ * @struct mpsc_queue
+ * @brief Bounded multiple producers single consumer queue
+ */
+struct mpsc_queue {
+	struct mpsc_queue_cell cells[MPSC_QUEUE_SIZE];
+	atomic_size_t enqueue_pos;
+	size_t dequeue_pos;
+};
+
+void mpsc_queue_init(struct mpsc_queue *queue);
+bool mpsc_queue_push(struct mpsc_queue *queue, int value);
+bool mpsc_queue_pop(struct mpsc_queue *queue, int *value);
+
+#endif /* OSCILLATORD_MPSC_QUEUE_H */
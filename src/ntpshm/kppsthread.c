@@ -0,0 +1,291 @@
+/**
+ * @file kppsthread.c
+ * @brief Lean PPS capture thread for RFC2783 /dev/ppsN devices
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Oscillatord's PPS always comes from the timecard's /dev/ppsN, so the
+ * serial line heuristics of gpsd_ppsmonitor() are not needed: the thread
+ * sleeps in time_pps_fetch() until the next assert edge, checks the cycle
+ * and hands the pulse to the report hook. Fix time comes in and PPS time
+ * goes out through lock-free slots. Latency and jitter of the pulses are
+ * logged periodically, loss and recovery of the PPS once each.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timepps.h>
+
+#include "log.h"
+#include "ppsthread.h"
+#include "timespec.h"
+
+/* time_pps_fetch() timeout, PPS is lost after that */
+#define KPPS_TIMEOUT_S 2
+/* Maximum deviation of a cycle from an integer number of seconds */
+#define KPPS_MAX_CYCLE_ERROR_NS 100000000LL
+/* Number of pulses between two statistics reports */
+#define KPPS_STATS_PERIOD 60
+
+struct kpps_context_t {
+    volatile struct pps_thread_t *pps_thread;
+    pps_handle_t handle;
+    int fd;
+    pthread_t thread;
+};
+
+struct kpps_stats_t {
+    int count;
+    /* delay from kernel timestamp to thread wake up */
+    int64_t latency_sum_ns;
+    int64_t latency_max_ns;
+    /* deviation of the cycle from an integer number of seconds */
+    int64_t jitter_sum_ns;
+    int64_t jitter_max_ns;
+};
+
+static int64_t ts_to_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * NS_IN_SEC + ts->tv_nsec;
+}
+
+static void kpps_stats_update(volatile struct pps_thread_t *thread_context,
+                              struct kpps_stats_t *stats,
+                              int64_t latency, int64_t jitter)
+{
+    stats->latency_sum_ns += latency;
+    if (latency > stats->latency_max_ns)
+        stats->latency_max_ns = latency;
+    stats->jitter_sum_ns += jitter;
+    if (jitter > stats->jitter_max_ns)
+        stats->jitter_max_ns = jitter;
+    if (++stats->count < KPPS_STATS_PERIOD)
+        return;
+
+    thread_context->log_hook(thread_context, THREAD_INF,
+        "KPPS:%s latency mean %lld ns max %lld ns, jitter mean %lld ns max %lld ns",
+        thread_context->devicename,
+        (long long)(stats->latency_sum_ns / stats->count),
+        (long long)stats->latency_max_ns,
+        (long long)(stats->jitter_sum_ns / stats->count),
+        (long long)stats->jitter_max_ns);
+    memset(stats, 0, sizeof(*stats));
+}
+
+/* the core loop of the KPPS thread, one wake up per pulse */
+static void *kpps_monitor(void *arg)
+{
+    struct kpps_context_t *context = arg;
+    volatile struct pps_thread_t *thread_context = context->pps_thread;
+    const struct timespec timeout = {KPPS_TIMEOUT_S, 0};
+    struct kpps_stats_t stats = {0};
+    struct timespec prev_clock = {0, 0};
+    pps_seq_t last_sequence = 0;
+    time_t last_second_used = 0;
+    bool pps_lost = false;
+
+    for (;;) {
+        char ts_str1[TIMESPEC_LEN], ts_str2[TIMESPEC_LEN];
+        /* cleared by pps_thread_deactivate() from another thread */
+        char *(*report_hook)(volatile struct pps_thread_t *,
+                             struct timedelta_t *) = thread_context->report_hook;
+        struct timedelta_t last_fixtime;
+        struct timedelta_t ppstimes;
+        struct timespec now;
+        struct timespec delay;
+        pps_info_t pi;
+        int64_t cycle;
+        int64_t jitter;
+        char *log1;
+
+        if (report_hook == NULL)
+            break;
+        memset(&pi, 0, sizeof(pi));
+        if (0 > time_pps_fetch(context->handle, PPS_TSFMT_TSPEC, &pi,
+                               &timeout)) {
+            if (ETIMEDOUT == errno) {
+                thread_context->log_hook(thread_context,
+                    pps_lost ? THREAD_PROG : THREAD_WARN,
+                    "KPPS:%s kernel PPS timeout", thread_context->devicename);
+                pps_lost = true;
+                /* cycle check restarts with next pulse */
+                prev_clock.tv_sec = 0;
+            } else if (EINTR == errno) {
+                prev_clock.tv_sec = 0;
+            } else {
+                thread_context->log_hook(thread_context, THREAD_WARN,
+                    "KPPS:%s kernel PPS failed %s",
+                    thread_context->devicename, strerror(errno));
+                (void)nanosleep(&timeout, NULL);
+            }
+            continue;
+        }
+        (void)clock_gettime(CLOCK_REALTIME, &now);
+        if (pi.assert_sequence == last_sequence)
+            continue;
+        last_sequence = pi.assert_sequence;
+        if (pps_lost) {
+            thread_context->log_hook(thread_context, THREAD_INF,
+                "KPPS:%s kernel PPS back", thread_context->devicename);
+            pps_lost = false;
+        }
+
+        /* quick, grab a copy of last fixtime before it changes */
+        (void)timedelta_slot_read(&thread_context->fix_in, &last_fixtime);
+
+        /* first pulse after start or a timeout only gives a reference */
+        if (prev_clock.tv_sec == 0) {
+            prev_clock = pi.assert_timestamp;
+            continue;
+        }
+        cycle = ts_to_ns(&pi.assert_timestamp) - ts_to_ns(&prev_clock);
+        prev_clock = pi.assert_timestamp;
+        jitter = cycle % NS_IN_SEC;
+        if (jitter > NS_IN_SEC / 2)
+            jitter = NS_IN_SEC - jitter;
+        if (cycle < NS_IN_SEC / 2 || jitter > KPPS_MAX_CYCLE_ERROR_NS) {
+            thread_context->log_hook(thread_context, THREAD_WARN,
+                "KPPS:%s ignored, bad cycle %lld ns",
+                thread_context->devicename, (long long)cycle);
+            continue;
+        }
+        kpps_stats_update(thread_context, &stats,
+                          ts_to_ns(&now) - ts_to_ns(&pi.assert_timestamp),
+                          jitter);
+
+        if (last_fixtime.real.tv_sec == 0) {
+            thread_context->log_hook(thread_context, THREAD_PROG,
+                "KPPS:%s ignored, missing last_fixtime",
+                thread_context->devicename);
+            continue;
+        }
+        if (last_second_used >= last_fixtime.real.tv_sec) {
+            thread_context->log_hook(thread_context, THREAD_PROG,
+                "KPPS:%s ignored, this second already handled",
+                thread_context->devicename);
+            continue;
+        }
+
+        /* pulse is the one following the last fix */
+        ppstimes.real.tv_sec = last_fixtime.real.tv_sec + 1;
+        ppstimes.real.tv_nsec = 0;
+        ppstimes.clock = pi.assert_timestamp;
+        TS_SUB(&delay, &ppstimes.clock, &last_fixtime.clock);
+
+        if (0 > delay.tv_sec || 0 > delay.tv_nsec) {
+            log1 = "system clock went backwards";
+        } else if ((2 < delay.tv_sec)
+          || (1 == delay.tv_sec && 100000000 < delay.tv_nsec)) {
+            /* system clock could be slewing so allow up to 1.1 sec delay */
+            log1 = "timestamp out of range";
+        } else {
+            last_second_used = last_fixtime.real.tv_sec;
+            log1 = report_hook(thread_context, &ppstimes);
+            timedelta_slot_write(&thread_context->pps_out, &ppstimes);
+        }
+        thread_context->log_hook(thread_context, THREAD_RAW,
+            "KPPS:%s clock: %s real: %s: %.30s",
+            thread_context->devicename,
+            timespec_str(&ppstimes.clock, ts_str1, sizeof(ts_str1)),
+            timespec_str(&ppstimes.real, ts_str2, sizeof(ts_str2)),
+            log1);
+    }
+
+    thread_context->log_hook(thread_context, THREAD_PROG,
+        "KPPS:%s kpps_monitor exited.", thread_context->devicename);
+    return NULL;
+}
+
+/* open the RFC2783 device, it must be able to wait for assert edges */
+static int kpps_init(struct kpps_context_t *context)
+{
+    volatile struct pps_thread_t *pps_thread = context->pps_thread;
+    pps_params_t pp;
+    int caps;
+
+    context->fd = open(pps_thread->devicename, O_RDWR | O_CLOEXEC);
+    if (context->fd < 0)
+        return -errno;
+    if (0 > time_pps_create(context->fd, &context->handle))
+        goto err_close;
+    if (0 > time_pps_getcap(context->handle, &caps))
+        goto err_destroy;
+    if ((caps & (PPS_TSFMT_TSPEC | PPS_CANWAIT | PPS_CAPTUREASSERT)) !=
+        (PPS_TSFMT_TSPEC | PPS_CANWAIT | PPS_CAPTUREASSERT)) {
+        pps_thread->log_hook(pps_thread, THREAD_INF,
+            "KPPS:%s pps_caps 0x%02X, cannot wait for assert edges",
+            pps_thread->devicename, caps);
+        errno = ENOTSUP;
+        goto err_destroy;
+    }
+
+    memset(&pp, 0, sizeof(pp));
+    pp.api_version = PPS_API_VERS_1;
+    pp.mode = PPS_TSFMT_TSPEC | PPS_CAPTUREASSERT;
+    if (0 > time_pps_setparams(context->handle, &pp))
+        goto err_destroy;
+    return 0;
+
+err_destroy:
+    (void)time_pps_destroy(context->handle);
+err_close:
+    (void)close(context->fd);
+    return -errno;
+}
+
+/* start the lean capture thread, false if device needs gpsd_ppsmonitor() */
+bool kpps_thread_activate(volatile struct pps_thread_t *pps_thread)
+{
+    struct kpps_context_t *context;
+    int ret;
+
+    if (strncmp(pps_thread->devicename, "/dev/pps", 8) != 0)
+        return false;
+
+    context = calloc(1, sizeof(*context));
+    if (context == NULL)
+        return false;
+    context->pps_thread = pps_thread;
+    ret = kpps_init(context);
+    if (ret != 0) {
+        pps_thread->log_hook(pps_thread, THREAD_WARN,
+            "KPPS:%s lean capture unavailable: %s",
+            pps_thread->devicename, strerror(-ret));
+        free(context);
+        return false;
+    }
+
+    ret = pthread_create(&context->thread, NULL, kpps_monitor, context);
+    if (ret != 0) {
+        (void)time_pps_destroy(context->handle);
+        (void)close(context->fd);
+        free(context);
+        return false;
+    }
+    pps_thread->kpps_context = context;
+    pps_thread->log_hook(pps_thread, THREAD_INF,
+        "KPPS:%s lean capture thread launched", pps_thread->devicename);
+    return true;
+}
+
+/*
+ * wait for the lean capture thread, if any, and release its device.
+ * report_hook must already be NULL, the thread notices it within
+ * KPPS_TIMEOUT_S.
+ */
+void kpps_thread_deactivate(volatile struct pps_thread_t *pps_thread)
+{
+    struct kpps_context_t *context = pps_thread->kpps_context;
+
+    if (context == NULL)
+        return;
+    (void)pthread_join(context->thread, NULL);
+    (void)time_pps_destroy(context->handle);
+    (void)close(context->fd);
+    free(context);
+    pps_thread->kpps_context = NULL;
+}
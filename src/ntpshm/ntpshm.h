@@ -86,6 +86,7 @@ void ntp_write(volatile struct shmTime *, struct timedelta_t *, int, int);
 
 void ntpshm_context_init(struct gps_context_t *);
 void ntpshm_session_init(struct gps_device_t *);
+void ntpshm_chrony_init(struct gps_device_t *, const char *);
 int ntpshm_put(struct gps_device_t *, volatile struct shmTime *, struct timedelta_t *);
 void ntpshm_link_deactivate(struct gps_device_t *);
 void ntpshm_link_activate(struct gps_device_t *);
@@ -506,9 +506,7 @@ static int get_edge_tiocmiwait( volatile struct pps_thread_t *thread_context,
 
     /* duplicate copy in get_edge_rfc2783 */
     /* quick, grab a copy of last_fixtime before it changes */
-    thread_lock(thread_context);
-    *last_fixtime = thread_context->fix_in;
-    thread_unlock(thread_context);
+    (void)timedelta_slot_read(&thread_context->fix_in, last_fixtime);
     /* end duplicate copy in get_edge_rfc2783 */
     /* get the time after we just woke up */
     if ( 0 > clock_gettime(CLOCK_REALTIME, clock_ts) ) {
@@ -617,9 +615,7 @@ static int get_edge_rfc2783(struct inner_context_t *inner_context,
         /* get_edge_tiocmiwait() got this if !pps_canwait */
 
         /* quick, grab a copy of last fixtime before it changes */
-        thread_lock(thread_context);
-        *last_fixtime = thread_context->fix_in;
-        thread_unlock(thread_context);
+        (void)timedelta_slot_read(&thread_context->fix_in, last_fixtime);
     }
 
 
@@ -1208,10 +1204,7 @@ static void *gpsd_ppsmonitor(void *arg)
                 log1 = thread_context->report_hook(thread_context, &ppstimes);
             else
                 log1 = "no report hook";
-            thread_lock(thread_context);
-            thread_context->pps_out = ppstimes;
-            thread_context->ppsout_count++;
-            thread_unlock(thread_context);
+            timedelta_slot_write(&thread_context->pps_out, &ppstimes);
             thread_context->log_hook(thread_context, THREAD_RAW,
                 "PPS:%s %.10s hooks called clock: %s real: %s: %.20s",
                 thread_context->devicename,
@@ -1263,6 +1256,10 @@ void pps_thread_activate(volatile struct pps_thread_t *pps_thread)
      */
     static struct inner_context_t       inner_context;
 
+    /* oscillatord only uses /dev/ppsN, lean path if the driver can wait */
+    if (kpps_thread_activate(pps_thread))
+        return;
+
     inner_context.pps_thread = pps_thread;
 #if defined(HAVE_SYS_TIMEPPS_H)
     /* some operations in init_kernel_pps() require root privs */
@@ -1300,15 +1297,16 @@ void pps_thread_deactivate(volatile struct pps_thread_t *pps_thread)
 /* cleanly terminate PPS thread */
 {
     pps_thread->report_hook = NULL;
+    kpps_thread_deactivate(pps_thread);
 }
 
-/* thread-safe update of last fix time - only way we pass data in */
+/* lock-free update of last fix time - only way we pass data in */
 void pps_thread_fixin(volatile struct pps_thread_t *pps_thread,
                       volatile struct timedelta_t *fix_in)
 {
-    thread_lock(pps_thread);
-    pps_thread->fix_in = *fix_in;
-    thread_unlock(pps_thread);
+    struct timedelta_t td = *fix_in;
+
+    timedelta_slot_write(&pps_thread->fix_in, &td);
 }
 
 /* thread-safe update of qErr and qErr_time - only way we pass data in */
@@ -1325,14 +1323,7 @@ void pps_thread_qErrin(volatile struct pps_thread_t *pps_thread,
 int pps_thread_ppsout(volatile struct pps_thread_t *pps_thread,
                       volatile struct timedelta_t *td)
 {
-    volatile int ret;
-
-    thread_lock(pps_thread);
-    *td = pps_thread->pps_out;
-    ret = pps_thread->ppsout_count;
-    thread_unlock(pps_thread);
-
-    return ret;
+    return timedelta_slot_read(&pps_thread->pps_out, td);
 }
 
 /* end */
@@ -8,6 +8,9 @@
 #ifndef PPSTHREAD_H
 #define PPSTHREAD_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #ifndef TIMEDELTA_DEFINED
@@ -19,6 +22,45 @@ struct timedelta_t {
 #endif /* TIMEDELTA_DEFINED */
 
 
+/*
+ * Slot with a single writer and lock-free readers (seqlock).
+ * seq is odd while the writer updates td, readers retry until they
+ * copied td with the same even seq before and after.
+ */
+struct timedelta_slot {
+    atomic_uint seq;
+    struct timedelta_t td;
+    int count;                  /* number of writes */
+};
+
+static inline void timedelta_slot_write(volatile struct timedelta_slot *slot,
+                                        const struct timedelta_t *td)
+{
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->td = *td;
+    slot->count++;
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+static inline int timedelta_slot_read(volatile struct timedelta_slot *slot,
+                                      volatile struct timedelta_t *td)
+{
+    unsigned seq;
+    int count;
+
+    do {
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        *td = slot->td;
+        count = slot->count;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) ||
+             seq != atomic_load_explicit(&slot->seq, memory_order_relaxed));
+    return count;
+}
+
 /*
  * Set context, devicefd, and devicename at initialization time, before
  * you call pps_thread_activate().  The context pointer can be used to
@@ -39,13 +81,14 @@ struct pps_thread_t {
                          struct timedelta_t *);
     void (*log_hook)(volatile struct pps_thread_t *,
                      int errlevel, const char *fmt, ...);
-    struct timedelta_t fix_in;  // real & clock time when in-band fix received
-    struct timedelta_t pps_out; /* real & clock time of last PPS event */
-    int ppsout_count;
+    struct timedelta_slot fix_in;  // real & clock time when in-band fix received
+    struct timedelta_slot pps_out; /* real & clock time of last PPS event */
     /* quantization error adjustment to PPS. aka "sawtooth" correction */
     long qErr;                  /* offset in picoseconds (ps) */
     /* time of PPS pulse that qErr applies to */
     struct timespec qErr_time;
+    /* lean capture thread, joined by pps_thread_deactivate() */
+    void *kpps_context;
 };
 
 #define THREAD_ERROR    4
@@ -55,6 +98,8 @@ struct pps_thread_t {
 #define THREAD_RAW      0
 
 extern void pps_thread_activate(volatile struct pps_thread_t *);
+extern bool kpps_thread_activate(volatile struct pps_thread_t *);
+extern void kpps_thread_deactivate(volatile struct pps_thread_t *);
 extern void pps_thread_deactivate(volatile struct pps_thread_t *);
 extern void pps_thread_fixin(volatile struct pps_thread_t *,
                              volatile struct timedelta_t *);
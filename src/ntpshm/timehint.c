@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <time.h>        /* for timespec */
 #include <unistd.h>
@@ -30,6 +31,13 @@
 #include "gnss.h"
 #include "ppsthread.h"
 
+/* precision of PPS samples until jitter is known, 1 micro sec */
+#define PPS_DEFAULT_PRECISION -20
+/* weight of the exponential average of PPS jitter */
+#define PPS_JITTER_WEIGHT 16
+/* samples needed before precision follows jitter */
+#define PPS_JITTER_MIN_SAMPLES 8
+
 /* Note: you can start gpsd as non-root, and have it work with ntpd.
  * However, it will then only use the ntpshm segments 2 3, and higher.
  *
@@ -213,6 +221,48 @@ void ntpshm_session_init(struct gps_device_t *session)
     /* mark NTPD shared memory segments as unused */
     session->shm_clock = NULL;
     session->shm_pps = NULL;
+    session->shm_enabled = true;
+    /* no chrony socket until ntpshm_chrony_init() */
+    session->chrony_path[0] = '\0';
+    session->chronyfd = -1;
+    session->pps_precision = PPS_DEFAULT_PRECISION;
+    session->pps_jitter = 0;
+    session->pps_samples = 0;
+}
+
+/* connect to chrony SOCK refclock, chronyd creates the socket */
+static int chrony_connect(struct gps_device_t *session)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    (void)strncpy(addr.sun_path, session->chrony_path,
+                  sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        (void)close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* send PPS samples to chrony SOCK refclock at path, alongside SHM or not */
+void ntpshm_chrony_init(struct gps_device_t *session, const char *path)
+{
+    if (strlen(path) >= sizeof(((struct sockaddr_un *)NULL)->sun_path)) {
+        log_error("PPS: chrony socket path %s is too long", path);
+        return;
+    }
+    (void)snprintf(session->chrony_path, sizeof(session->chrony_path),
+                   "%s", path);
+    session->chronyfd = chrony_connect(session);
+    if (session->chronyfd < 0)
+        log_warn("PPS: could not connect to chrony socket %s: %s, will retry",
+                 path, strerror(errno));
+    else
+        log_info("PPS: using chrony socket %s", path);
 }
 
 /* put a received fix time into shared memory for NTP */
@@ -223,24 +273,16 @@ int ntpshm_put(struct gps_device_t *session, volatile struct shmTime *shmseg,
     char clock_str[TIMESPEC_LEN];
 
     /* Any NMEA will be about -1 or -2. Garmin GPS-18/USB is around -6 or -7. */
-    int precision = -20; /* default precision, 1 micro sec */
+    int precision = PPS_DEFAULT_PRECISION;
 
     if (shmseg == NULL) {
         log_trace("NTP:PPS: missing shm");
         return 0;
     }
 
-    // FIXME: make NMEA precision -1
-    // if (shmseg == session->shm_pps) {
-    //     /* precision is a floor so do not make it tight */
-    //     if ( source_usb == session->sourcetype ) {
-    //         /* if PPS over USB, then precision = -10, 1 milli sec  */
-    //         precision = -10;
-    //     } else {
-    //         /* likely PPS over serial, precision = -20, 1 micro sec */
-    //         precision = -20;
-    //     }
-    // }
+    /* PPS precision follows the measured jitter */
+    if (shmseg == session->shm_pps)
+        precision = session->pps_precision;
 
     ntp_write(shmseg, td, precision, session->context->leap_notify);
 
@@ -262,6 +304,74 @@ struct sock_sample {
     int magic;      /* must be SOCK_MAGIC */
 };
 
+/* ship the time of a PPS event to chrony SOCK refclock */
+static void chrony_send(struct gps_device_t *session, struct timedelta_t *td)
+{
+    char real_str[TIMESPEC_LEN];
+    char clock_str[TIMESPEC_LEN];
+    struct timespec offset;
+    struct sock_sample sample;
+    struct tm tm;
+    int leap_notify = session->context->leap_notify;
+
+    /* chronyd may have been restarted, socket is then created again */
+    if (session->chronyfd < 0) {
+        session->chronyfd = chrony_connect(session);
+        if (session->chronyfd < 0)
+            return;
+        log_info("PPS: connected to chrony socket %s", session->chrony_path);
+    }
+
+    /* same leap second filtering as ntp_write() */
+    (void)gmtime_r(&(td->real.tv_sec), &tm);
+    if (5 != tm.tm_mon && 11 != tm.tm_mon)
+        leap_notify = LEAP_NOWARNING;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.pulse = 0;
+    sample.leap = leap_notify;
+    sample.magic = SOCK_MAGIC;
+    /* chronyd wants a timeval, it is just the top of the second */
+    TSTOTV(&sample.tv, &td->clock);
+    /* calculate the offset as a timespec to not lose precision */
+    TS_SUB(&offset, &td->real, &td->clock);
+    sample.offset = TSTONS(&offset);
+
+    log_trace("PPS: chrony_send %s @ %s Offset: %0.9f",
+              timespec_str(&td->real, real_str, sizeof(real_str)),
+              timespec_str(&td->clock, clock_str, sizeof(clock_str)),
+              sample.offset);
+    /* never block the PPS thread on chronyd */
+    if (send(session->chronyfd, &sample, sizeof(sample), MSG_DONTWAIT) < 0) {
+        log_warn("PPS: chrony send failed: %s", strerror(errno));
+        if (errno != EAGAIN) {
+            (void)close(session->chronyfd);
+            session->chronyfd = -1;
+        }
+    }
+}
+
+/* update jitter of PPS offsets and derive samples precision from it */
+static void update_pps_precision(struct gps_device_t *session,
+                                 struct timedelta_t *td)
+{
+    double offset = TS_SUB_D(&td->real, &td->clock);
+    double delta = fabs(offset - session->pps_last_offset);
+
+    session->pps_last_offset = offset;
+    if (session->pps_samples++ == 0)
+        return;
+    if (session->pps_samples == 2)
+        session->pps_jitter = delta;
+    else
+        session->pps_jitter += (delta - session->pps_jitter) / PPS_JITTER_WEIGHT;
+    if (session->pps_samples <= PPS_JITTER_MIN_SAMPLES)
+        return;
+
+    session->pps_precision = (int)ceil(log2(fmax(session->pps_jitter, 1e-9)));
+    if (session->pps_precision > -1)
+        session->pps_precision = -1;
+}
 
 static char *report_hook(volatile struct pps_thread_t *pps_thread,
                                         struct timedelta_t *td)
@@ -286,10 +396,12 @@ static char *report_hook(volatile struct pps_thread_t *pps_thread,
             return "no fix";
     }
 
-    /* FIXME?  how to log socket AND shm reported? */
     log1 = "accepted";
+    update_pps_precision(session, td);
     if (session->shm_pps != NULL)
         (void)ntpshm_put(session, session->shm_pps, td);
+    if (session->chrony_path[0] != '\0')
+        chrony_send(session, td);
 
     /* session context might have a hook set, too */
     if (session->context->pps_hook != NULL)
@@ -307,11 +419,16 @@ void ntpshm_link_deactivate(struct gps_device_t *session)
         (void)ntpshm_free(session->context, session->shm_clock);
         session->shm_clock = NULL;
     }
-    if (session->shm_pps != NULL) {
+    if (session->shm_pps != NULL || session->chrony_path[0] != '\0')
         pps_thread_deactivate(&session->pps_thread);
+    if (session->shm_pps != NULL) {
         (void)ntpshm_free(session->context, session->shm_pps);
         session->shm_pps = NULL;
     }
+    if (session->chronyfd >= 0) {
+        (void)close(session->chronyfd);
+        session->chronyfd = -1;
+    }
 }
 
 /* set up ntpshm storage for a session */
@@ -321,7 +438,7 @@ void ntpshm_link_activate(struct gps_device_t *session)
     if (session->sourcetype == source_pty)
         return;
 
-    if (session->sourcetype != source_pps ) {
+    if (session->sourcetype != source_pps && session->shm_enabled) {
         /* allocate a shared-memory segment for "NMEA" time data */
         session->shm_clock = ntpshm_alloc(session->context);
 
@@ -338,10 +455,12 @@ void ntpshm_link_activate(struct gps_device_t *session)
          * for the 1pps time data and launch a thread to capture the 1pps
          * transitions
          */
-        session->shm_pps = ntpshm_alloc(session->context);
-        if (NULL == session->shm_pps) {
-            log_warn("PPS: ntpshm_alloc(1) failed");
-        } else {
+        if (session->shm_enabled) {
+            session->shm_pps = ntpshm_alloc(session->context);
+            if (NULL == session->shm_pps)
+                log_warn("PPS: ntpshm_alloc(1) failed");
+        }
+        if (session->shm_pps != NULL || session->chrony_path[0] != '\0') {
             session->pps_thread.report_hook = report_hook;
             pps_thread_activate(&session->pps_thread);
         }
@@ -1,7 +1,12 @@
 #include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "log.h"
 #include "oscillator.h"
+#include "utils.h"
 
 int oscillator_set_dac_min(struct oscillator *oscillator, uint32_t dac_min)
 {
@@ -107,3 +112,443 @@ int oscillator_push_gnss_info(struct oscillator *oscillator, bool fixOk, const s
 		return -ENOSYS;
 	return oscillator->class->push_gnss_info(oscillator, fixOk, last_fix_utc_time);
 }
+
+/* Requests queued beyond this are refused, the oscillator is likely stuck */
+#define OSCILLATOR_IO_MAX_PENDING 8
+/* Time given to the request running when stopping, in s */
+#define OSCILLATOR_IO_STOP_TIMEOUT_S 5
+
+struct oscillator_job {
+	struct oscillator_request request;
+	oscillator_io_cb cb;
+	void *data;
+	/** A caller waits for the result in oscillator_io_call */
+	bool waited;
+	bool done;
+	/** Waiting caller gave up, the I/O thread frees the job without running it */
+	bool abandoned;
+	struct oscillator_job *next;
+};
+
+struct oscillator_io {
+	struct oscillator *oscillator;
+	pthread_t thread;
+	/** Protects every field below */
+	pthread_mutex_t mutex;
+	/** Signaled when a job is queued or stop is set */
+	pthread_cond_t cond_queue;
+	/** Signaled when a job is done */
+	pthread_cond_t cond_done;
+	struct oscillator_job *head;
+	struct oscillator_job *tail;
+	int pending;
+	bool stop;
+	/** Driver does not block, requests run in the caller's thread */
+	bool direct;
+};
+
+/**
+ * @brief Read-modify-write of coarse control, done by a single request so
+ * that no other request changes it in between
+ */
+static int oscillator_adjust_coarse(struct oscillator *oscillator, int32_t delta)
+{
+	struct oscillator_ctrl ctrl;
+	struct od_output output = { .action = ADJUST_COARSE };
+	int ret;
+
+	ret = oscillator_get_ctrl(oscillator, &ctrl);
+	if (ret < 0)
+		return ret;
+	output.setpoint = ctrl.coarse_ctrl + delta;
+	return oscillator_apply_output(oscillator, &output);
+}
+
+static void oscillator_io_run(struct oscillator *oscillator, struct oscillator_request *request)
+{
+	switch (request->op) {
+	case OSCILLATOR_OP_GET_CTRL:
+		request->ret = oscillator_get_ctrl(oscillator, &request->ctrl);
+		break;
+	case OSCILLATOR_OP_PARSE_ATTRIBUTES:
+		request->ret = oscillator_parse_attributes(oscillator, &request->attributes);
+		break;
+	case OSCILLATOR_OP_APPLY_OUTPUT:
+		request->ret = oscillator_apply_output(oscillator, &request->output);
+		break;
+	case OSCILLATOR_OP_CALIBRATE:
+		request->calibration.results = oscillator_calibrate(oscillator,
+			request->calibration.phasemeter, request->calibration.gnss,
+			request->calibration.calib_params, request->calibration.phase_sign);
+		request->ret = request->calibration.results != NULL ? 0 : -EIO;
+		break;
+	case OSCILLATOR_OP_GET_PHASE_ERROR:
+		request->ret = oscillator_get_phase_error(oscillator, &request->phase_error);
+		break;
+	case OSCILLATOR_OP_GET_DISCIPLINING_STATUS:
+		request->ret = oscillator_get_disciplining_status(oscillator, &request->disciplining_status);
+		break;
+	case OSCILLATOR_OP_PUSH_GNSS_INFO:
+		request->ret = oscillator_push_gnss_info(oscillator, request->gnss_info.fixOk,
+			&request->gnss_info.last_fix_utc_time);
+		break;
+	case OSCILLATOR_OP_ADJUST_COARSE:
+		request->ret = oscillator_adjust_coarse(oscillator, request->coarse_delta);
+		break;
+	default:
+		request->ret = -EINVAL;
+		break;
+	}
+}
+
+static void *oscillator_io_thread(void *p_data)
+{
+	struct oscillator_io *io = p_data;
+	struct oscillator_job *job;
+
+	pthread_mutex_lock(&io->mutex);
+	for (;;) {
+		while (io->head == NULL && !io->stop)
+			pthread_cond_wait(&io->cond_queue, &io->mutex);
+		/* Queued requests are discarded by oscillator_io_stop */
+		if (io->head == NULL)
+			break;
+		job = io->head;
+		io->head = job->next;
+		if (io->head == NULL)
+			io->tail = NULL;
+		/* Running it late could override a newer request of the caller */
+		if (job->abandoned) {
+			io->pending--;
+			free(job);
+			continue;
+		}
+		pthread_mutex_unlock(&io->mutex);
+
+		oscillator_io_run(io->oscillator, &job->request);
+		if (job->cb != NULL)
+			job->cb(&job->request, job->data);
+
+		pthread_mutex_lock(&io->mutex);
+		io->pending--;
+		job->done = true;
+		if (!job->waited || job->abandoned)
+			free(job);
+		else
+			pthread_cond_broadcast(&io->cond_done);
+	}
+	pthread_mutex_unlock(&io->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Start the I/O thread of an oscillator
+ *
+ * Once started, the oscillator must only be accessed through the
+ * oscillator_io_* functions until oscillator_io_stop is called. No thread is
+ * started for drivers with OSCILLATOR_CAP_ASYNC_IO.
+ *
+ * @param oscillator
+ * @return struct oscillator_io*, NULL on error
+ */
+struct oscillator_io *oscillator_io_start(struct oscillator *oscillator)
+{
+	struct oscillator_io *io;
+	pthread_condattr_t attr;
+	int ret;
+
+	if (oscillator == NULL)
+		return NULL;
+	io = calloc(1, sizeof(*io));
+	if (io == NULL)
+		return NULL;
+	io->oscillator = oscillator;
+	pthread_mutex_init(&io->mutex, NULL);
+	pthread_cond_init(&io->cond_queue, NULL);
+	/* Deadlines are not affected by system clock steps */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&io->cond_done, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (oscillator->class->capabilities & OSCILLATOR_CAP_ASYNC_IO) {
+		io->direct = true;
+		return io;
+	}
+	ret = pthread_create(&io->thread, NULL, oscillator_io_thread, io);
+	if (ret != 0) {
+		log_error("Could not create oscillator I/O thread: %s", strerror(ret));
+		pthread_cond_destroy(&io->cond_done);
+		pthread_cond_destroy(&io->cond_queue);
+		pthread_mutex_destroy(&io->mutex);
+		free(io);
+		return NULL;
+	}
+	return io;
+}
+
+/**
+ * @brief Discard the queued requests and stop the I/O thread
+ *
+ * Callbacks of discarded requests are not called. The request being run is
+ * waited for OSCILLATOR_IO_STOP_TIMEOUT_S at most.
+ *
+ * @param io
+ * @return 0 on success, -ETIMEDOUT if the I/O thread is stuck in a request:
+ * it is then left running and the oscillator must not be destroyed
+ */
+int oscillator_io_stop(struct oscillator_io *io)
+{
+	struct oscillator_job *job;
+	struct timespec deadline;
+	int ret;
+
+	if (io == NULL)
+		return 0;
+	pthread_mutex_lock(&io->mutex);
+	io->stop = true;
+	while ((job = io->head) != NULL) {
+		io->head = job->next;
+		io->pending--;
+		if (job->waited && !job->abandoned) {
+			/* Waiting caller frees it */
+			job->request.ret = -ECANCELED;
+			job->done = true;
+		} else {
+			free(job);
+		}
+	}
+	io->tail = NULL;
+	pthread_cond_broadcast(&io->cond_done);
+	pthread_cond_signal(&io->cond_queue);
+	pthread_mutex_unlock(&io->mutex);
+
+	if (!io->direct) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += OSCILLATOR_IO_STOP_TIMEOUT_S;
+		ret = pthread_timedjoin_np(io->thread, NULL, &deadline);
+		if (ret != 0) {
+			log_error("Oscillator I/O thread did not stop: %s", strerror(ret));
+			pthread_detach(io->thread);
+			return -ETIMEDOUT;
+		}
+	}
+	pthread_cond_destroy(&io->cond_done);
+	pthread_cond_destroy(&io->cond_queue);
+	pthread_mutex_destroy(&io->mutex);
+	free(io);
+	return 0;
+}
+
+static struct oscillator_job *oscillator_io_queue(struct oscillator_io *io,
+	const struct oscillator_request *request, oscillator_io_cb cb, void *data, bool waited)
+{
+	struct oscillator_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return NULL;
+	job->request = *request;
+	job->cb = cb;
+	job->data = data;
+	job->waited = waited;
+
+	if (io->stop || io->pending >= OSCILLATOR_IO_MAX_PENDING) {
+		free(job);
+		errno = EBUSY;
+		return NULL;
+	}
+	if (io->tail != NULL)
+		io->tail->next = job;
+	else
+		io->head = job;
+	io->tail = job;
+	io->pending++;
+	pthread_cond_signal(&io->cond_queue);
+	return job;
+}
+
+/**
+ * @brief Queue a request without waiting for it
+ *
+ * @param io
+ * @param request
+ * @param cb called by the I/O thread with the results, can be NULL
+ * @param data passed to cb
+ * @return 0 on success, -EBUSY if too many requests are pending
+ */
+int oscillator_io_submit(struct oscillator_io *io, const struct oscillator_request *request,
+	oscillator_io_cb cb, void *data)
+{
+	struct oscillator_request result;
+	struct oscillator_job *job;
+
+	if (io == NULL || request == NULL)
+		return -EINVAL;
+	if (io->direct) {
+		result = *request;
+		oscillator_io_run(io->oscillator, &result);
+		if (cb != NULL)
+			cb(&result, data);
+		return 0;
+	}
+	pthread_mutex_lock(&io->mutex);
+	job = oscillator_io_queue(io, request, cb, data, false);
+	pthread_mutex_unlock(&io->mutex);
+	return job != NULL ? 0 : -EBUSY;
+}
+
+/**
+ * @brief Queue a request and wait for its results
+ *
+ * @param io
+ * @param request arguments, filled with the results on success
+ * @param timeout_ms deadline, 0 to wait without limit
+ * @return 0 on success, request->ret holding the driver's return value,
+ * -ETIMEDOUT if the deadline expired, -EBUSY if too many requests are pending
+ */
+int oscillator_io_call(struct oscillator_io *io, struct oscillator_request *request,
+	unsigned int timeout_ms)
+{
+	struct oscillator_job *job;
+	struct timespec deadline;
+	int ret = 0;
+
+	if (io == NULL || request == NULL)
+		return -EINVAL;
+	if (io->direct) {
+		oscillator_io_run(io->oscillator, request);
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= NS_IN_SECOND) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= NS_IN_SECOND;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	job = oscillator_io_queue(io, request, NULL, NULL, true);
+	if (job == NULL) {
+		pthread_mutex_unlock(&io->mutex);
+		return -EBUSY;
+	}
+	while (!job->done && ret == 0) {
+		if (timeout_ms == 0)
+			pthread_cond_wait(&io->cond_done, &io->mutex);
+		else
+			ret = pthread_cond_timedwait(&io->cond_done, &io->mutex, &deadline);
+	}
+	if (job->done) {
+		*request = job->request;
+		free(job);
+		ret = 0;
+	} else {
+		/* Request is skipped, or its results dropped, by the I/O thread */
+		job->abandoned = true;
+		ret = -ETIMEDOUT;
+	}
+	pthread_mutex_unlock(&io->mutex);
+	return ret;
+}
+
+int oscillator_io_get_ctrl(struct oscillator_io *io, struct oscillator_ctrl *ctrl,
+	unsigned int timeout_ms)
+{
+	struct oscillator_request request = { .op = OSCILLATOR_OP_GET_CTRL };
+	int ret = oscillator_io_call(io, &request, timeout_ms);
+
+	if (ret != 0)
+		return ret;
+	*ctrl = request.ctrl;
+	return request.ret;
+}
+
+int oscillator_io_parse_attributes(struct oscillator_io *io,
+	struct oscillator_attributes *attributes, unsigned int timeout_ms)
+{
+	struct oscillator_request request = { .op = OSCILLATOR_OP_PARSE_ATTRIBUTES };
+	int ret;
+
+	request.attributes = *attributes;
+	ret = oscillator_io_call(io, &request, timeout_ms);
+	if (ret != 0)
+		return ret;
+	*attributes = request.attributes;
+	return request.ret;
+}
+
+int oscillator_io_apply_output(struct oscillator_io *io, const struct od_output *output,
+	unsigned int timeout_ms)
+{
+	struct oscillator_request request = { .op = OSCILLATOR_OP_APPLY_OUTPUT };
+	int ret;
+
+	request.output = *output;
+	ret = oscillator_io_call(io, &request, timeout_ms);
+	return ret != 0 ? ret : request.ret;
+}
+
+int oscillator_io_get_phase_error(struct oscillator_io *io, int64_t *phase_error,
+	unsigned int timeout_ms)
+{
+	struct oscillator_request request = { .op = OSCILLATOR_OP_GET_PHASE_ERROR };
+	int ret = oscillator_io_call(io, &request, timeout_ms);
+
+	if (ret != 0)
+		return ret;
+	*phase_error = request.phase_error;
+	return request.ret;
+}
+
+int oscillator_io_get_disciplining_status(struct oscillator_io *io,
+	struct od_monitoring *status, unsigned int timeout_ms)
+{
+	struct oscillator_request request = { .op = OSCILLATOR_OP_GET_DISCIPLINING_STATUS };
+	int ret;
+
+	request.disciplining_status = *status;
+	ret = oscillator_io_call(io, &request, timeout_ms);
+	if (ret != 0)
+		return ret;
+	*status = request.disciplining_status;
+	return request.ret;
+}
+
+int oscillator_io_push_gnss_info(struct oscillator_io *io, bool fixOk,
+	const struct timespec *last_fix_utc_time)
+{
+	struct oscillator_request request = {
+		.op = OSCILLATOR_OP_PUSH_GNSS_INFO,
+		.gnss_info.fixOk = fixOk,
+	};
+
+	if (last_fix_utc_time != NULL)
+		request.gnss_info.last_fix_utc_time = *last_fix_utc_time;
+	return oscillator_io_submit(io, &request, NULL, NULL);
+}
+
+/**
+ * @brief Run a calibration in the I/O thread, without deadline
+ *
+ * @return struct calibration_results*, NULL on error
+ */
+struct calibration_results *oscillator_io_calibrate(struct oscillator_io *io,
+	struct phasemeter *phasemeter, struct gnss *gnss,
+	struct calibration_parameters *calib_params, int phase_sign)
+{
+	struct oscillator_request request = {
+		.op = OSCILLATOR_OP_CALIBRATE,
+		.calibration = {
+			.phasemeter = phasemeter,
+			.gnss = gnss,
+			.calib_params = calib_params,
+			.phase_sign = phase_sign,
+		},
+	};
+
+	if (oscillator_io_call(io, &request, 0) != 0)
+		return NULL;
+	return request.calibration.results;
+}
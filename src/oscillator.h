@@ -24,7 +24,8 @@ struct oscillator;
 struct oscillator_ctrl;
 struct oscillator_attributes;
 
-typedef struct oscillator *(*oscillator_new_cb)(struct devices_path *devices_path);
+typedef struct oscillator *(*oscillator_new_cb)(const struct config *config,
+		struct devices_path *devices_path);
 typedef int (*oscillator_get_ctrl_cb)(struct oscillator *oscillator,
 		struct oscillator_ctrl *ctrl);
 typedef int (*oscillator_save_cb)(struct oscillator *oscillator);
@@ -51,11 +52,18 @@ struct oscillator_class {
 	oscillator_get_phase_error_cb get_phase_error;
 	oscillator_get_disciplining_status_cb get_disciplining_status;
 	oscillator_push_gnss_info_cb push_gnss_info;
+	/* OSCILLATOR_CAP_* flags */
+	unsigned int capabilities;
 	/* default values use if per-instance ones haven't been set */
 	uint32_t dac_max;
 	uint32_t dac_min;
 };
 
+/* Driver does not block on I/O, requests need no I/O thread */
+#define OSCILLATOR_CAP_ASYNC_IO (1 << 0)
+/* Oscillator measures its own phase error to the 1PPS reference */
+#define OSCILLATOR_CAP_PHASEMETER (1 << 1)
+
 struct oscillator {
 	char name[OSCILLATOR_NAME_LENGTH];
 	const struct oscillator_class *class;
@@ -96,4 +104,76 @@ struct calibration_results * oscillator_calibrate(
 	struct calibration_parameters * calib_params,
 	int phase_sign);
 
+/*
+ * Asynchronous access to an oscillator: a thread owns the oscillator and runs
+ * the requests of a queue one at a time, through the synchronous functions
+ * above, so drivers do not need to be aware of it. Callers either wait for
+ * the result up to a deadline or get it in a callback, run by the I/O thread.
+ */
+enum oscillator_op {
+	OSCILLATOR_OP_GET_CTRL,
+	OSCILLATOR_OP_PARSE_ATTRIBUTES,
+	OSCILLATOR_OP_APPLY_OUTPUT,
+	OSCILLATOR_OP_CALIBRATE,
+	OSCILLATOR_OP_GET_PHASE_ERROR,
+	OSCILLATOR_OP_GET_DISCIPLINING_STATUS,
+	OSCILLATOR_OP_PUSH_GNSS_INFO,
+	/* Move coarse control by a delta from its current value */
+	OSCILLATOR_OP_ADJUST_COARSE,
+};
+
+/**
+ * @struct oscillator_request
+ * @brief Arguments and results of an asynchronous oscillator request
+ */
+struct oscillator_request {
+	enum oscillator_op op;
+	union {
+		struct oscillator_ctrl ctrl;
+		struct oscillator_attributes attributes;
+		struct od_output output;
+		int64_t phase_error;
+		int32_t coarse_delta;
+		struct od_monitoring disciplining_status;
+		struct {
+			bool fixOk;
+			struct timespec last_fix_utc_time;
+		} gnss_info;
+		struct {
+			struct phasemeter *phasemeter;
+			struct gnss *gnss;
+			struct calibration_parameters *calib_params;
+			int phase_sign;
+			struct calibration_results *results;
+		} calibration;
+	};
+	/** Return value of the synchronous function */
+	int ret;
+};
+
+struct oscillator_io;
+typedef void (*oscillator_io_cb)(const struct oscillator_request *request, void *data);
+
+struct oscillator_io *oscillator_io_start(struct oscillator *oscillator);
+int oscillator_io_stop(struct oscillator_io *io);
+int oscillator_io_submit(struct oscillator_io *io, const struct oscillator_request *request,
+	oscillator_io_cb cb, void *data);
+int oscillator_io_call(struct oscillator_io *io, struct oscillator_request *request,
+	unsigned int timeout_ms);
+int oscillator_io_get_ctrl(struct oscillator_io *io, struct oscillator_ctrl *ctrl,
+	unsigned int timeout_ms);
+int oscillator_io_parse_attributes(struct oscillator_io *io,
+	struct oscillator_attributes *attributes, unsigned int timeout_ms);
+int oscillator_io_apply_output(struct oscillator_io *io, const struct od_output *output,
+	unsigned int timeout_ms);
+int oscillator_io_get_phase_error(struct oscillator_io *io, int64_t *phase_error,
+	unsigned int timeout_ms);
+int oscillator_io_get_disciplining_status(struct oscillator_io *io,
+	struct od_monitoring *status, unsigned int timeout_ms);
+int oscillator_io_push_gnss_info(struct oscillator_io *io, bool fixOk,
+	const struct timespec *last_fix_utc_time);
+struct calibration_results *oscillator_io_calibrate(struct oscillator_io *io,
+	struct phasemeter *phasemeter, struct gnss *gnss,
+	struct calibration_parameters *calib_params, int phase_sign);
+
 #endif /* SRC_OSCILLATOR_H_ */
@@ -2,14 +2,18 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
 
 #include "oscillator_factory.h"
 #include "config.h"
 #include "log.h"
 
 #ifndef MAX_OSCILLATOR_FACTORIES
-#define MAX_OSCILLATOR_FACTORIES 5
+#define MAX_OSCILLATOR_FACTORIES 16
 #endif
 
 static const struct oscillator_factory *factories[MAX_OSCILLATOR_FACTORIES];
@@ -33,6 +37,7 @@ struct oscillator *oscillator_factory_new(struct config *config, struct devices_
 {
 	int ret;
 	const char *name;
+	const char *dir_path;
 	const struct oscillator_factory *factory;
 
 	name = config_get(config, "oscillator");
@@ -44,6 +49,10 @@ struct oscillator *oscillator_factory_new(struct config *config, struct devices_
 		return NULL;
 	}
 
+	dir_path = config_get(config, "oscillator-plugins-dir");
+	if (dir_path != NULL && *dir_path != '\0')
+		oscillator_factory_load_plugins(dir_path);
+
 	factory = oscillator_factory_get_by_name(name);
 	if (factory == NULL) {
 		ret = errno;
@@ -53,7 +62,7 @@ struct oscillator *oscillator_factory_new(struct config *config, struct devices_
 		return NULL;
 	}
 
-	return factory->new(devices_path);
+	return factory->new(config, devices_path);
 }
 
 static bool oscillator_factory_is_valid
@@ -90,12 +99,104 @@ int oscillator_factory_register(const struct oscillator_factory *factory)
 				"MAX_OSCILLATOR_FACTORIES");
 		return -ENOMEM;
 	}
+	if (oscillator_factory_get_by_name(factory->class.name) != NULL) {
+		log_error("oscillator factory %s already registered",
+				factory->class.name);
+		return -EEXIST;
+	}
 	factories[factories_nb] = factory;
 	factories_nb++;
 
 	return 0;
 }
 
+static int oscillator_factory_load_plugin(const char *path)
+{
+	const struct oscillator_driver *driver;
+	/* Factories registered from here on live in the plugin */
+	unsigned int first_factory = factories_nb;
+	void *handle;
+	int ret;
+
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		log_error("Could not load oscillator plugin %s: %s", path, dlerror());
+		return -ENOEXEC;
+	}
+	driver = dlsym(handle, OSCILLATOR_DRIVER_SYMBOL);
+	if (driver == NULL) {
+		log_error("%s does not export " OSCILLATOR_DRIVER_SYMBOL, path);
+		ret = -ENOEXEC;
+		goto err;
+	}
+	if (driver->abi_version != OSCILLATOR_DRIVER_ABI_VERSION) {
+		log_error("%s: driver ABI version %u, expected %u", path,
+				driver->abi_version, OSCILLATOR_DRIVER_ABI_VERSION);
+		ret = -EPROTO;
+		goto err;
+	}
+	/* Plugin may have registered itself from a constructor, as built-in drivers do */
+	if (oscillator_factory_get_by_name(driver->factory->class.name) != driver->factory) {
+		ret = oscillator_factory_register(driver->factory);
+		if (ret < 0) {
+			log_error("%s: could not register oscillator factory", path);
+			goto err;
+		}
+	}
+	/* Handle is never closed, registered factory lives in the plugin */
+	log_info("Loaded oscillator driver %s from %s, capabilities 0x%x",
+			driver->factory->class.name, path,
+			driver->factory->class.capabilities);
+	return 0;
+
+err:
+	/* Forget factories registered by the plugin's constructors before unmapping them */
+	factories_nb = first_factory;
+	dlclose(handle);
+	return ret;
+}
+
+/**
+ * @brief Load oscillator driver plugins of a directory
+ *
+ * Each shared object (.so) of the directory must export a struct
+ * oscillator_driver, see OSCILLATOR_DRIVER. Plugins failing to load are
+ * skipped.
+ *
+ * @param dir_path
+ * @return number of drivers loaded, -errno if directory can't be opened
+ */
+int oscillator_factory_load_plugins(const char *dir_path)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	size_t len;
+	DIR *dir;
+	int ret;
+	int nb = 0;
+
+	dir = opendir(dir_path);
+	if (dir == NULL) {
+		ret = -errno;
+		log_error("Could not open oscillator plugins directory %s: %s",
+				dir_path, strerror(-ret));
+		return ret;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		len = strlen(entry->d_name);
+		if (len <= 3 || strcmp(entry->d_name + len - 3, ".so") != 0)
+			continue;
+		ret = snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+		if (ret < 0 || (size_t) ret >= sizeof(path))
+			continue;
+		if (oscillator_factory_load_plugin(path) == 0)
+			nb++;
+	}
+	closedir(dir);
+
+	return nb;
+}
+
 void oscillator_factory_destroy(struct oscillator **oscillator)
 {
 	const struct oscillator_factory *factory;
@@ -9,20 +9,51 @@
  */
 #ifndef SRC_OSCILLATOR_FACTORY_H_
 #define SRC_OSCILLATOR_FACTORY_H_
+#include <stdint.h>
+
 #include "oscillator.h"
 #include "config.h"
 
+/*
+ * Version of the layouts of struct oscillator_driver, oscillator_factory,
+ * oscillator_class and oscillator, and of the callbacks prototypes. Must be
+ * incremented on any change of them, plugins built against another version
+ * are refused.
+ */
+#define OSCILLATOR_DRIVER_ABI_VERSION 1
+/* Name of the struct oscillator_driver exported by plugins */
+#define OSCILLATOR_DRIVER_SYMBOL "oscillator_driver"
+
 struct oscillator_factory {
 	oscillator_new_cb new;
 	oscillator_destroy_cb destroy;
 	struct oscillator_class class;
 };
 
+/**
+ * @struct oscillator_driver
+ * @brief Entry point of an oscillator driver plugin
+ *
+ * A plugin is a shared object exporting a struct oscillator_driver named
+ * oscillator_driver, declared with OSCILLATOR_DRIVER.
+ */
+struct oscillator_driver {
+	uint32_t abi_version;
+	const struct oscillator_factory *factory;
+};
+
+#define OSCILLATOR_DRIVER(_factory) \
+	const struct oscillator_driver oscillator_driver = { \
+		.abi_version = OSCILLATOR_DRIVER_ABI_VERSION, \
+		.factory = &(_factory), \
+	}
+
 struct oscillator *oscillator_factory_new(struct config *config, struct devices_path *devices_path);
 __attribute__((__format__(printf, 3, 4)))
 void oscillator_factory_init(const char *factory_name,
 		struct oscillator *oscillator, const char *fmt, ...);
 int oscillator_factory_register(const struct oscillator_factory *factory);
+int oscillator_factory_load_plugins(const char *dir_path);
 void oscillator_factory_destroy(struct oscillator **oscillator);
 
 #endif /* SRC_OSCILLATOR_FACTORY_H_ */
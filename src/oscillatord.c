@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <math.h>
 
 #include <error.h>
@@ -43,15 +44,28 @@
 #include "oscillator.h"
 #include "oscillator_factory.h"
 #include "phasemeter.h"
+#include "phc_sync.h"
+#include "sys_sync.h"
 #include "utils.h"
 
 #define UPDATE_DISCIPLINING_PARAMETERS_SEC 3600
+/* Phase error samples averaged for the initial phase jump */
+#define INITIAL_ALIGNMENT_DEFAULT_SAMPLES 8
+#define INITIAL_ALIGNMENT_MAX_SAMPLES 64
+#define INITIAL_ALIGNMENT_DEFAULT_TIMEOUT_S 20
+/* Samples further than this from the median are always kept (ns) */
+#define INITIAL_ALIGNMENT_MIN_OUTLIER_NS 20
+/* Deadline of oscillator requests from the main loop */
+#define OSCILLATOR_IO_TIMEOUT_MS 2000
 
 static struct gps_context_t context;
 struct od *od = NULL;
 struct oscillator *oscillator = NULL;
+struct oscillator_io *oscillator_io = NULL;
 struct devices_path devices_path = { 0 };
 pthread_t save_dsc_params_thread;
+static bool save_dsc_params_started = false;
+static atomic_bool save_dsc_params_running = false;
 
 /**
  * @brief Signal Handler to kill program gracefully
@@ -92,9 +106,39 @@ static void save_disciplining_parameters(struct od *od) {
 static void * save_disciplining_parameters_thread(void *p_data) {
 	struct od *od = (struct od*) p_data;
 	save_disciplining_parameters(od);
+	atomic_store(&save_dsc_params_running, false);
 	return NULL;
 }
 
+/**
+ * @brief Save disciplining parameters in background, unless a save is
+ * already running
+ *
+ * @param od
+ */
+static void start_save_disciplining_parameters(struct od *od)
+{
+	if (atomic_load(&save_dsc_params_running)) {
+		log_warn("Disciplining parameters are already being saved, skipping");
+		return;
+	}
+	/* Previous save is over, release its thread */
+	if (save_dsc_params_started)
+		pthread_join(save_dsc_params_thread, NULL);
+
+	atomic_store(&save_dsc_params_running, true);
+	save_dsc_params_started = pthread_create(
+		&save_dsc_params_thread,
+		NULL,
+		save_disciplining_parameters_thread,
+		od
+	) == 0;
+	if (!save_dsc_params_started) {
+		atomic_store(&save_dsc_params_running, false);
+		log_error("Could not start saving disciplining parameters");
+	}
+}
+
 /**
  * @brief Phase jump: Apply a phase offset to the PHC
  *
@@ -127,6 +171,95 @@ static int apply_phase_offset(int fd_clock, const char *device_name,
 	return ret;
 }
 
+static int compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Estimate phase error of the PHC against GNSS over several pulses
+ *
+ * Each sample is corrected with the quantization error of the GNSS pulse
+ * it was measured on. Samples further than 3 standard deviations from the
+ * median, estimated with the median absolute deviation, are rejected and the
+ * remaining ones are averaged.
+ *
+ * @param phasemeter
+ * @param gnss
+ * @param sign sign applied to phasemeter's phase error
+ * @param nb_samples number of samples to get
+ * @param timeout_s maximum time spent getting samples
+ * @param phase_error Output estimated phase error in ns, PHC minus GNSS
+ * @param std_error Output standard error of the mean of kept samples in ns,
+ *        not the phase error remaining after the jump
+ * @return int number of samples kept, 0 if none could be measured
+ */
+static int estimate_phase_error(struct phasemeter *phasemeter, struct gnss *gnss,
+	int sign, int nb_samples, int timeout_s, int64_t *phase_error, double *std_error)
+{
+	int64_t samples[INITIAL_ALIGNMENT_MAX_SAMPLES];
+	int64_t deviations[INITIAL_ALIGNMENT_MAX_SAMPLES];
+	struct timespec now;
+	time_t deadline;
+	int64_t median;
+	int64_t threshold;
+	int64_t sum = 0;
+	double variance = 0;
+	int count = 0;
+	int kept = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline = now.tv_sec + timeout_s;
+	while (loop && count < nb_samples && now.tv_sec < deadline) {
+		int64_t raw;
+		int32_t qErr;
+		int status = get_phase_error(phasemeter, &raw);
+
+		if (gnss_get_epoch_data(gnss, NULL, NULL, &qErr) != 0)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (status != PHASEMETER_BOTH_TIMESTAMPS)
+			continue;
+		/* qErr is the offset of the GNSS pulse from the top of the second, in ps */
+		samples[count] = raw * sign + qErr / 1000;
+		log_debug("Initial phase error sample %d: %" PRIi64 " ns (qErr %d ps)",
+			count, samples[count], qErr);
+		count++;
+	}
+	if (count == 0)
+		return 0;
+
+	qsort(samples, count, sizeof(samples[0]), compare_int64);
+	median = samples[count / 2];
+	for (i = 0; i < count; i++)
+		deviations[i] = llabs(samples[i] - median);
+	qsort(deviations, count, sizeof(deviations[0]), compare_int64);
+	/* 1.4826 * MAD estimates standard deviation of gaussian noise */
+	threshold = (int64_t) (3 * 1.4826 * deviations[count / 2]);
+	if (threshold < INITIAL_ALIGNMENT_MIN_OUTLIER_NS)
+		threshold = INITIAL_ALIGNMENT_MIN_OUTLIER_NS;
+
+	for (i = 0; i < count; i++) {
+		if (llabs(samples[i] - median) > threshold) {
+			log_debug("Initial phase error sample %" PRIi64 " ns rejected", samples[i]);
+			continue;
+		}
+		samples[kept++] = samples[i];
+		sum += samples[i];
+	}
+	*phase_error = sum / kept;
+	for (i = 0; i < kept; i++)
+		variance += pow(samples[i] - *phase_error, 2);
+	*std_error = kept > 1 ? sqrt(variance / (kept - 1) / kept) : NAN;
+	if (kept < count)
+		log_info("Rejected %d outliers out of %d phase error samples", count - kept, count);
+	return kept;
+}
+
 /**
  * @brief Enable/disable PPS output of PHC
  *
@@ -143,6 +276,18 @@ static int enable_pps(int fd, bool enable)
 	return 0;
 }
 
+/**
+ * @brief Log failure of an output applied asynchronously on the oscillator
+ *
+ * @param request completed request
+ * @param data unused
+ */
+static void log_apply_output_error(const struct oscillator_request *request, void *data)
+{
+	if (request->ret < 0)
+		log_error("Could not apply output on oscillator !");
+}
+
 static void prepare_minipod_config(struct minipod_config* minipod_config, struct config * config)
 {
 	minipod_config->calibrate_first = config_get_bool_default(config, "calibrate_first", false);
@@ -196,6 +341,8 @@ int main(int argc, char *argv[])
 	bool fake_holdover_activated = false;
 	__attribute__((cleanup(fd_cleanup))) int fd_clock = -1;
 	volatile struct pps_thread_t * pps_thread = NULL;
+	struct sys_sync *sys_sync = NULL;
+	struct phc_sync *phc_sync = NULL;
 	time_t start_save_epprom_parameters, end_save_eeprom_parameters;
 
 	signal(SIGINT, signal_handler);
@@ -252,10 +399,16 @@ int main(int argc, char *argv[])
 		return -EINVAL;
 	}
 	log_info("oscillator model %s", oscillator->class->name);
+	oscillator_io = oscillator_io_start(oscillator);
+	if (oscillator_io == NULL) {
+		error(EXIT_FAILURE, ENOMEM, "oscillator_io_start");
+		return -EINVAL;
+	}
 
 	/* Handle phase error */
 	if (monitoring_mode) {
-		phase_error_supported = (oscillator_get_phase_error(oscillator, &phase_error) != -ENOSYS);
+		phase_error_supported = (oscillator->class->capabilities & OSCILLATOR_CAP_PHASEMETER) ||
+			(oscillator_io_get_phase_error(oscillator_io, &phase_error, OSCILLATOR_IO_TIMEOUT_MS) != -ENOSYS);
 		if (phase_error_supported)
 			sign = 1;
 		pthread_mutex_lock(&monitoring->mutex);
@@ -279,10 +432,8 @@ int main(int argc, char *argv[])
 	pps_thread = &(session.pps_thread);
 	pps_thread->context = &session;
 
-	/* Start GNSS Thread */
-	char flip_flip_path[5000];
-	snprintf(flip_flip_path, sizeof(flip_flip_path) - 1, "%s@115200", devices_path.gnss_path);
-	gnss = gnss_init(&config, flip_flip_path, &session, fd_clock);
+	/* Start GNSS Thread, receiver's baudrate is detected */
+	gnss = gnss_init(&config, devices_path.gnss_path, &session, fd_clock);
 	if (gnss == NULL) {
 		error(EXIT_FAILURE, errno, "Failed to listen to the receiver");
 		return -EINVAL;
@@ -322,14 +473,11 @@ int main(int argc, char *argv[])
 		if (phasemeter == NULL) {
 			return -EINVAL;
 		}
-		/* Wait for all thread to get at least one piece of data */
-		sleep(2);
-
 		/* Check that program should still be running before setting PTP time */
 		if (loop) {
-			/* Init PTP clock time */
+			/* Init PTP clock time, seconds and nanoseconds, from GNSS PPS */
 			log_info("Initialize time of ptp clock %s", devices_path.ptp_path);
-			ret = gnss_set_ptp_clock_time(gnss);
+			ret = gnss_set_ptp_clock_time(gnss, phasemeter);
 			if (ret != 0) {
 				log_error("Could not set ptp clock time: err %d", ret);
 				return -EINVAL;
@@ -339,27 +487,33 @@ int main(int argc, char *argv[])
 
 		/* Check if program is still supposed to be running or has been requested to terminate */
 		if(loop) {
-			/* Apply initial phase jump before setting PTP clock time */
-			do {
-				phasemeter_status = get_phase_error(phasemeter, &phase_error);
-			} while (phasemeter_status != PHASEMETER_BOTH_TIMESTAMPS);
-			log_debug("Initial phase error to apply is %" PRIi64, phase_error);
-			log_info("Applying initial phase jump before setting PTP clock time");
-			ret = apply_phase_offset(
-				fd_clock,
-				devices_path.ptp_path,
-				-phase_error * sign
-			);
-			if (ret < 0)
-				error(EXIT_FAILURE, -ret, "apply_phase_offset");
-			sleep(SETTLING_TIME);
-
-			/* Check PTP Clock time is properly set */
-			log_info("Reset PTP Clock time after rough alignment to GNSS");
-			ret = gnss_set_ptp_clock_time(gnss);
-			if (ret != 0) {
-				log_error("Could not set ptp clock time");
-				return -EINVAL;
+			/* Align internal PPS on GNSS PPS, PHC is already within a few microseconds */
+			long nb_samples = config_get_unsigned_number(&config, "initial-alignment-samples");
+			long timeout = config_get_unsigned_number(&config, "initial-alignment-timeout");
+			double std_error;
+
+			if (nb_samples <= 0)
+				nb_samples = INITIAL_ALIGNMENT_DEFAULT_SAMPLES;
+			else if (nb_samples > INITIAL_ALIGNMENT_MAX_SAMPLES)
+				nb_samples = INITIAL_ALIGNMENT_MAX_SAMPLES;
+			if (timeout <= 0)
+				timeout = INITIAL_ALIGNMENT_DEFAULT_TIMEOUT_S;
+
+			ret = estimate_phase_error(phasemeter, gnss, sign, nb_samples, timeout,
+				&phase_error, &std_error);
+			if (ret > 0) {
+				log_info("Applying initial phase jump of %" PRIi64 " ns averaged over %d samples, standard error of the mean %.1f ns",
+					-phase_error, ret, std_error);
+				ret = apply_phase_offset(
+					fd_clock,
+					devices_path.ptp_path,
+					-phase_error
+				);
+				if (ret < 0)
+					error(EXIT_FAILURE, -ret, "apply_phase_offset");
+				sleep(SETTLING_TIME);
+			} else {
+				log_warn("No phase error measured in %ld s, skipping initial phase jump", timeout);
 			}
 		}
 	}
@@ -376,10 +530,21 @@ int main(int argc, char *argv[])
 			pps_thread->log_hook = ppsthread_log;
 			log_info("Init NTP SHM session");
 			ntpshm_session_init(&session);
+			session.shm_enabled = config_get_bool_default(&config, "ntp-shm", true);
+			if (config_get(&config, "chrony-sock") != NULL)
+				ntpshm_chrony_init(&session, config_get(&config, "chrony-sock"));
 			ntpshm_link_activate(&session);
 		} else {
 			log_warn("No pps-device found in sysfs, NTPSHM will no be filled");
 		}
+
+		/* Steer system clock to the PHC if requested */
+		sys_sync = sys_sync_new(&config, fd_clock, disciplining_mode, gnss,
+			monitoring_mode ? &monitoring->sys_sync_info : NULL);
+
+		/* Make PHCs of other network cards follow the timecard's one */
+		phc_sync = phc_sync_new(&config, fd_clock,
+			monitoring_mode ? &monitoring->phc_sync_info : NULL);
 	}
 
 	/* Main Loop */
@@ -398,7 +563,7 @@ int main(int argc, char *argv[])
 			/* Oscillator control values and temperature are needed for
 			* the disciplining algorithm and monitoring, get both of them
 			*/
-			ret = oscillator_parse_attributes(oscillator, &osc_attr);
+			ret = oscillator_io_parse_attributes(oscillator_io, &osc_attr, OSCILLATOR_IO_TIMEOUT_MS);
 			if (ret == -ENOSYS) {
 				osc_attr.temperature = 0.0;
 				osc_attr.locked = false;
@@ -407,7 +572,7 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
-			ret = oscillator_get_ctrl(oscillator, &ctrl_values);
+			ret = oscillator_io_get_ctrl(oscillator_io, &ctrl_values, OSCILLATOR_IO_TIMEOUT_MS);
 			if (ret != 0) {
 				log_warn("Could not get control values of oscillator");
 				continue;
@@ -480,15 +645,17 @@ int main(int argc, char *argv[])
 			} else if (output.action == CALIBRATE) {
 				log_info("Calibration requested");
 				if (monitoring_mode) {
-					pthread_mutex_lock(&monitoring->mutex);
-					od_get_monitoring_data(od, &monitoring->disciplining);
-					pthread_mutex_unlock(&monitoring->mutex);
+					/* Main loop is the only writer of the state, update its latest version */
+					struct monitoring_state state;
+					snapshot_read(&monitoring->state, &state);
+					od_get_monitoring_data(od, &state.disciplining);
+					monitoring_publish_state(monitoring, &state);
 				}
 				struct calibration_parameters * calib_params = od_get_calibration_parameters(od);
 				if (calib_params == NULL)
 					error(EXIT_FAILURE, -ENOMEM, "od_get_calibration_parameters");
 
-				struct calibration_results *results = oscillator_calibrate(oscillator, phasemeter, gnss, calib_params, sign);
+				struct calibration_results *results = oscillator_io_calibrate(oscillator_io, phasemeter, gnss, calib_params, sign);
 				if (results != NULL)
 					od_calibrate(od, calib_params, results);
 				else {
@@ -522,7 +689,7 @@ int main(int argc, char *argv[])
 						log_warn("If you restart oscillatord calibration will be done again !");
 					}
 			} else if (output.action != NO_OP) {
-				ret = oscillator_apply_output(oscillator, &output);
+				ret = oscillator_io_apply_output(oscillator_io, &output, OSCILLATOR_IO_TIMEOUT_MS);
 				if (ret < 0) {
 					log_error("Could not apply output on oscillator !");
 				}
@@ -531,12 +698,7 @@ int main(int argc, char *argv[])
 			time(&end_save_eeprom_parameters);
 			if (difftime(end_save_eeprom_parameters, start_save_epprom_parameters) >= (double) UPDATE_DISCIPLINING_PARAMETERS_SEC) {
 				log_info("Periodically saving EEPROM data");
-				pthread_create(
-					&save_dsc_params_thread,
-					NULL,
-					save_disciplining_parameters_thread,
-					od
-				);
+				start_save_disciplining_parameters(od);
 				/* Reset time to save eeprom data*/
 				time(&start_save_epprom_parameters);
 			}
@@ -548,7 +710,7 @@ int main(int argc, char *argv[])
 			 * sleep for a second.
 			 */
 			usleep(1000);
-			ret = oscillator_parse_attributes(oscillator, &osc_attr);
+			ret = oscillator_io_parse_attributes(oscillator_io, &osc_attr, OSCILLATOR_IO_TIMEOUT_MS);
 			if (ret == -ENOSYS) {
 				osc_attr.temperature = 0.0;
 				osc_attr.locked = false;
@@ -558,9 +720,9 @@ int main(int argc, char *argv[])
 				bool fixOk = false;
 				struct timespec lastFix = {};
 				gnss_get_fix_info(gnss, &fixOk, &lastFix);
-				oscillator_push_gnss_info(oscillator, fixOk, &lastFix);
+				oscillator_io_push_gnss_info(oscillator_io, fixOk, &lastFix);
 			}
-			ret = oscillator_get_ctrl(oscillator, &ctrl_values);
+			ret = oscillator_io_get_ctrl(oscillator_io, &ctrl_values, OSCILLATOR_IO_TIMEOUT_MS);
 			if (ret != 0) {
 				log_warn("Could not get control values of oscillator");
 				continue;
@@ -569,6 +731,7 @@ int main(int argc, char *argv[])
 		if (monitoring_mode) {
 			/* Check for monitoring requests */
 			enum monitoring_request request;
+			int coarse_delta = 0;
 			struct od_monitoring disciplining = {
 				.clock_class = CLOCK_CLASS_UNCALIBRATED,
 				.status = WARMUP,
@@ -591,89 +754,88 @@ int main(int argc, char *argv[])
 				/* this actually means that oscillator has it's own hardware disciplining
 				 * algorithm and we are able to monitor it
 				 */
-				oscillator_get_phase_error(oscillator, &osc_attr.phase_error);
-				oscillator_get_disciplining_status(oscillator, &disciplining);
+				oscillator_io_get_phase_error(oscillator_io, &osc_attr.phase_error, OSCILLATOR_IO_TIMEOUT_MS);
+				oscillator_io_get_disciplining_status(oscillator_io, &disciplining, OSCILLATOR_IO_TIMEOUT_MS);
 			}
 
-			pthread_mutex_lock(&monitoring->mutex);
-			monitoring->osc_attributes = osc_attr;
-			monitoring->ctrl_values = ctrl_values;
-			monitoring->disciplining = disciplining;
-			request = monitoring->request;
-			monitoring->request = REQUEST_NONE;
-			pthread_mutex_unlock(&monitoring->mutex);
-
-			switch(request) {
-			case REQUEST_CALIBRATION:
-				log_info("Monitoring: Calibration requested");
-				input.calibration_requested = true;
-				break;
-			case REQUEST_GNSS_START:
-				log_info("Monitoring: GNSS Start requested");
-				gnss_set_action(gnss, GNSS_ACTION_START);
-				break;
-			case REQUEST_GNSS_STOP:
-				log_info("Monitoring: GNSS Stop requested");
-				gnss_set_action(gnss, GNSS_ACTION_STOP);
-				break;
-			case REQUEST_GNSS_SOFT:
-				log_info("Monitoring: GNSS Soft requested");
-				gnss_set_action(gnss, GNSS_ACTION_SOFT);
-				break;
-			case REQUEST_GNSS_HARD:
-				log_info("Monitoring: GNSS Hard requested");
-				gnss_set_action(gnss, GNSS_ACTION_HARD);
-				break;
-			case REQUEST_GNSS_COLD:
-				log_info("Monitoring: GNSS Cold requested");
-				gnss_set_action(gnss, GNSS_ACTION_COLD);
-				break;
-			case REQUEST_SAVE_EEPROM:
-				log_info("Monitoring: Saving EEPROM data");
-				pthread_create(
-					&save_dsc_params_thread,
-					NULL,
-					save_disciplining_parameters_thread,
-					od
-				);
-				break;
-			case REQUEST_FAKE_HOLDOVER_START:
-				fake_holdover_activated = true;
-				break;
-			case REQUEST_FAKE_HOLDOVER_STOP:
-				fake_holdover_activated = false;
-				break;
-			case REQUEST_RESET_UBLOX_SERIAL:
-				log_info("Monitoring: Ublox serial reset requested");
-				gnss_set_action(gnss, GNSS_ACTION_RESET_SERIAL);
-				break;
-			case REQUEST_READ_EEPROM:
-				log_warn("Read EEPROM: not implemented");
-				break;
-			case REQUEST_MRO_COARSE_INC:
-				log_info("Monitoring: MRO INC requested");
-				struct od_output adj_coarse_inc_output = { .action = ADJUST_COARSE, .setpoint = ctrl_values.coarse_ctrl + 1, };
-				ret = oscillator_apply_output(oscillator, &adj_coarse_inc_output);
-				if (ret < 0) {
-					log_error("Could not apply output on oscillator !");
-				}
-				break;
-			case REQUEST_MRO_COARSE_DEC:
-				log_info("Monitoring: MRO DEC requested");
-				struct od_output adj_coarse_dec_output = { .action = ADJUST_COARSE, .setpoint = ctrl_values.coarse_ctrl - 1, };
-				ret = oscillator_apply_output(oscillator, &adj_coarse_dec_output);
-				if (ret < 0) {
-					log_error("Could not apply output on oscillator !");
+			struct monitoring_state state = {
+				.osc_attributes = osc_attr,
+				.ctrl_values = ctrl_values,
+				.disciplining = disciplining,
+			};
+			monitoring_publish_state(monitoring, &state);
+
+			while ((request = monitoring_get_request(monitoring)) != REQUEST_NONE) {
+				switch(request) {
+				case REQUEST_CALIBRATION:
+					log_info("Monitoring: Calibration requested");
+					input.calibration_requested = true;
+					break;
+				case REQUEST_GNSS_START:
+					log_info("Monitoring: GNSS Start requested");
+					gnss_set_action(gnss, GNSS_ACTION_START);
+					break;
+				case REQUEST_GNSS_STOP:
+					log_info("Monitoring: GNSS Stop requested");
+					gnss_set_action(gnss, GNSS_ACTION_STOP);
+					break;
+				case REQUEST_GNSS_SOFT:
+					log_info("Monitoring: GNSS Soft requested");
+					gnss_set_action(gnss, GNSS_ACTION_SOFT);
+					break;
+				case REQUEST_GNSS_HARD:
+					log_info("Monitoring: GNSS Hard requested");
+					gnss_set_action(gnss, GNSS_ACTION_HARD);
+					break;
+				case REQUEST_GNSS_COLD:
+					log_info("Monitoring: GNSS Cold requested");
+					gnss_set_action(gnss, GNSS_ACTION_COLD);
+					break;
+				case REQUEST_SAVE_EEPROM:
+					log_info("Monitoring: Saving EEPROM data");
+					start_save_disciplining_parameters(od);
+					break;
+				case REQUEST_FAKE_HOLDOVER_START:
+					fake_holdover_activated = true;
+					break;
+				case REQUEST_FAKE_HOLDOVER_STOP:
+					fake_holdover_activated = false;
+					break;
+				case REQUEST_RESET_UBLOX_SERIAL:
+					log_info("Monitoring: Ublox serial reset requested");
+					gnss_set_action(gnss, GNSS_ACTION_RESET_SERIAL);
+					break;
+				case REQUEST_READ_EEPROM:
+					log_warn("Read EEPROM: not implemented");
+					break;
+				case REQUEST_MRO_COARSE_INC:
+					log_info("Monitoring: MRO INC requested");
+					coarse_delta++;
+					break;
+				case REQUEST_MRO_COARSE_DEC:
+					log_info("Monitoring: MRO DEC requested");
+					coarse_delta--;
+					break;
+				case REQUEST_NONE:
+				default:
+					break;
 				}
-				break;
-			case REQUEST_NONE:
-			default:
-				break;
 			}
-
+			/* Requests queued together add up, current value is read by the I/O thread */
+			if (coarse_delta != 0) {
+				ret = oscillator_io_submit(oscillator_io,
+					&(struct oscillator_request) {
+						.op = OSCILLATOR_OP_ADJUST_COARSE,
+						.coarse_delta = coarse_delta,
+					}, log_apply_output_error, NULL);
+				if (ret < 0)
+					log_error("Could not queue output on oscillator: %s", strerror(-ret));
+			}
 		}
 	}
 
+	phc_sync_stop(phc_sync);
+	sys_sync_stop(sys_sync);
 	enable_pps(fd_clock, false);
 	if (pps_thread != NULL && pps_thread->devicename != NULL)
 		ntpshm_link_deactivate(&session);
@@ -681,7 +843,8 @@ int main(int argc, char *argv[])
 	gnss_stop(gnss);
 
 	if (disciplining_mode) {
-		pthread_join(save_dsc_params_thread, NULL);
+		if (save_dsc_params_started)
+			pthread_join(save_dsc_params_thread, NULL);
 		phasemeter_stop(phasemeter);
 		ret = od_get_disciplining_parameters(od, &dsc_params);
 		if (ret != 0) {
@@ -705,7 +868,8 @@ int main(int argc, char *argv[])
 		monitoring_stop(monitoring);
 	if (fd_clock != -1)
 		close(fd_clock);
-	if (oscillator != NULL) {
+	/* A stuck I/O thread still uses the oscillator, leave it to exit */
+	if (oscillator_io_stop(oscillator_io) == 0 && oscillator != NULL) {
 		oscillator_factory_destroy(&oscillator);
 	}
 
@@ -13,6 +13,7 @@
 #include <error.h>
 #include <termios.h>
 #include <poll.h>
+#include <time.h>
 
 #include "config.h"
 #include "log.h"
@@ -49,6 +50,30 @@
 
 #define RESET_TIMEOUT 300
 
+// From datasheet we assume answers cannot be larger than 128 characters
+#define MRO50_ANSWER_SIZE 128
+/* Maximum duration of a command, from its write to the end of its answer */
+#define MRO50_CMD_TIMEOUT_MS 500
+#define MRO50_BATCH_MAX_CMDS 4
+
+/* Operations of the mRO50 device that work through ioctls */
+#define MRO50_IOCTL_READ_FINE		(1 << 0)
+#define MRO50_IOCTL_READ_COARSE		(1 << 1)
+#define MRO50_IOCTL_ADJUST_FINE		(1 << 2)
+#define MRO50_IOCTL_ADJUST_COARSE	(1 << 3)
+#define MRO50_IOCTL_READ_CTRL		(MRO50_IOCTL_READ_FINE | MRO50_IOCTL_READ_COARSE)
+
+/*
+ * Default 95% confidence half width of a calibration slope, in ns/s: the one
+ * of 50 measures (default nb_calibration) with 2.5 ns rms of phase noise.
+ * Noisier points take all nb_calibration measures, as before.
+ */
+#define CALIBRATION_DEFAULT_SLOPE_PRECISION 0.05
+/* Fewer measures per control point give meaningless confidence intervals */
+#define CALIBRATION_MIN_MEASURES 10
+/* Settling is first checked after twice this number of measures */
+#define CALIBRATION_SETTLE_WINDOW 4
+
 typedef u_int32_t uint32_t;
 typedef u_int32_t u32;
 
@@ -56,6 +81,43 @@ struct mRo50_oscillator {
 	struct oscillator oscillator;
 	char serial_path[PATH_MAX];
 	int serial_fd;
+	/** mRO50 device, -1 if not available */
+	int mro_fd;
+	/** MRO50_IOCTL_* flags, operations not listed go through the serial port */
+	unsigned int ioctls;
+	/** Answer of the last command, NUL terminated */
+	char answer[MRO50_ANSWER_SIZE + 1];
+	/** Control values read along with the last attributes, not consumed yet */
+	struct oscillator_ctrl ctrl;
+	bool ctrl_cached;
+	/** Calibration stops measuring a point once its slope is this precise, in ns/s */
+	double calib_slope_precision;
+};
+
+/**
+ * @struct linear_fit
+ * @brief Online least squares fit of measures versus time
+ */
+struct linear_fit {
+	int n;
+	double st;
+	double sy;
+	double stt;
+	double sty;
+	double syy;
+};
+
+/**
+ * @struct mRo50_cmd
+ * @brief Command of a batch and its answer
+ */
+struct mRo50_cmd {
+	const char *cmd;
+	int cmd_len;
+	/** Answer, NUL terminated */
+	char answer[MRO50_ANSWER_SIZE + 1];
+	/** Length of the answer, -1 if it is missing or an error */
+	int len;
 };
 
 struct mRo50_attributes {
@@ -63,10 +125,6 @@ struct mRo50_attributes {
 	uint8_t locked:1;		//Locked
 };
 
-// From datasheet we assume answers cannot be larger than 128 characters
-static char answer_str[129] = {0};
-const size_t mro_answer_len = 128;
-
 static unsigned int mRo50_oscillator_index;
 
 
@@ -84,6 +142,8 @@ static void mRo50_oscillator_destroy(struct oscillator **oscillator)
 		close(r->serial_fd);
 		log_info("Closed oscillator's serial port");
 	}
+	if (r->mro_fd >= 0)
+		close(r->mro_fd);
 	memset(o, 0, sizeof(*o));
 	free(o);
 	*oscillator = NULL;
@@ -125,51 +185,139 @@ static int set_serial_attributes(int fd)
 	return 0;
 }
 
-static int mRo50_oscillator_cmd(struct mRo50_oscillator *mRo50, const char *cmd, int cmd_len)
+static int64_t mRo50_monotonic_ms(void)
 {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Check whether an answer is complete
+ *
+ * Answers end with LFLF, errors are a line starting with '?'.
+ *
+ * @param answer
+ * @param len
+ * @return true if no more bytes are expected
+ */
+static bool mRo50_answer_complete(const char *answer, int len)
+{
+	if (len >= 1 && answer[0] == '?')
+		return answer[len - 1] == '\n';
+	return len >= 2 && answer[len - 1] == '\n' && answer[len - 2] == '\n';
+}
+
+/**
+ * @brief Send commands back to back and read their answers
+ *
+ * Answers come in the order of the commands and are split on their
+ * terminators, so reading stops as soon as the last one is received. A
+ * missing or erroneous answer only fails its own command.
+ *
+ * @param mRo50
+ * @param cmds commands, answers are filled in
+ * @param nb_cmds number of commands, at most MRO50_BATCH_MAX_CMDS
+ * @return number of commands successfully answered, -1 on I/O error
+ */
+static int mRo50_oscillator_batch(struct mRo50_oscillator *mRo50, struct mRo50_cmd *cmds, int nb_cmds)
+{
+	char request[MRO50_BATCH_MAX_CMDS * MRO50_ANSWER_SIZE];
+	char buf[MRO50_ANSWER_SIZE];
 	struct pollfd pfd = {};
-	int err, rbytes = 0;
-	if (write(mRo50->serial_fd, cmd, cmd_len) != cmd_len) {
+	int request_len = 0;
+	int64_t deadline;
+	int current = 0;
+	int answered = 0;
+	int err, i;
+
+	for (i = 0; i < nb_cmds; i++) {
+		if (request_len + cmds[i].cmd_len > (int) sizeof(request))
+			return -1;
+		memcpy(request + request_len, cmds[i].cmd, cmds[i].cmd_len);
+		request_len += cmds[i].cmd_len;
+		memset(cmds[i].answer, 0, sizeof(cmds[i].answer));
+		cmds[i].len = 0;
+	}
+
+	/* Drop leftovers of a previous answer that timed out */
+	tcflush(mRo50->serial_fd, TCIFLUSH);
+	if (write(mRo50->serial_fd, request, request_len) != request_len) {
 		log_error("mRo50_oscillator_cmd send command error: %d (%s)", errno, strerror(errno));
 		return -1;
 	}
+	deadline = mRo50_monotonic_ms() + MRO50_CMD_TIMEOUT_MS * nb_cmds;
 	pfd.fd = mRo50->serial_fd;
 	pfd.events = POLLIN;
-	while (1) {
-		err = poll(&pfd, 1, 50);
+	while (current < nb_cmds) {
+		int64_t timeout = deadline - mRo50_monotonic_ms();
+
+		if (timeout <= 0)
+			break;
+		err = poll(&pfd, 1, (int) timeout);
 		if (err == -1) {
+			if (errno == EINTR)
+				continue;
 			log_warn("mRo50_oscillator_cmd poll error: %d (%s)", errno, strerror(errno));
-			memset(answer_str, 0, rbytes);
 			return -1;
 		}
-		// poll call timed out - check the answer
 		if (!err)
 			break;
-		err = read(mRo50->serial_fd, answer_str + rbytes, mro_answer_len - rbytes);
+		err = read(mRo50->serial_fd, buf, sizeof(buf));
 		if (err < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
 			log_error("mRo50_oscillator_cmd rbyteserror: %d (%s)", errno, strerror(errno));
-			memset(answer_str, 0, rbytes);
 			return -1;
 		}
-		rbytes += err;
-	}
-	if (rbytes == 0) {
-		log_warn("mRo50_oscillator_cmd didn't get answer, zero length");
-		return -1;
+
+		/* Demultiplex answers on their terminators */
+		for (i = 0; i < err && current < nb_cmds; i++) {
+			struct mRo50_cmd *cmd = &cmds[current];
+
+			if (cmd->len < MRO50_ANSWER_SIZE)
+				cmd->answer[cmd->len++] = buf[i];
+			if (!mRo50_answer_complete(cmd->answer, cmd->len))
+				continue;
+			// Verify that first caracter of the answer is not equal to '?'
+			if (cmd->answer[0] == '?') {
+				// answer format doesn't fit protocol
+				log_warn("mRo50_oscillator_cmd answer protocol error: %s", cmd->answer);
+				cmd->len = -1;
+			} else {
+				answered++;
+			}
+			current++;
+		}
 	}
-	// Verify that first caracter of the answer is not equal to '?'
-	if (answer_str[0] == '?') {
-		// answer format doesn't fit protocol
-		log_warn("mRo50_oscillator_cmd answer protocol error: %s", answer_str);
-		memset(answer_str, 0, rbytes);
-		return -1;
+
+	for (; current < nb_cmds; current++) {
+		if (cmds[current].len == 0)
+			log_warn("mRo50_oscillator_cmd didn't get answer, zero length");
+		else
+			log_warn("mRo50_oscillator_cmd answer does not contain LFLF: %s", cmds[current].answer);
+		cmds[current].len = -1;
 	}
-	if (rbytes < 2 || answer_str[rbytes -1] != '\n' || answer_str[rbytes - 2] != '\n') {
-		log_warn("mRo50_oscillator_cmd answer does not contain LFLF: %s", answer_str);
-		memset(answer_str, 0, rbytes);
+	return answered;
+}
+
+/**
+ * @brief Send a command and read its answer in mRo50->answer
+ *
+ * @param mRo50
+ * @param cmd
+ * @param cmd_len
+ * @return length of the answer on success, -1 on error
+ */
+static int mRo50_oscillator_cmd(struct mRo50_oscillator *mRo50, const char *cmd, int cmd_len)
+{
+	struct mRo50_cmd batch = { .cmd = cmd, .cmd_len = cmd_len };
+
+	if (mRo50_oscillator_batch(mRo50, &batch, 1) != 1)
 		return -1;
-	}
-	return rbytes;
+	memcpy(mRo50->answer, batch.answer, sizeof(mRo50->answer));
+	return batch.len;
 }
 
 static int mRo50_clean_serial(struct mRo50_oscillator *mRo50)
@@ -189,7 +337,6 @@ static int mRo50_clean_serial(struct mRo50_oscillator *mRo50)
 		return -1;
 
 	mRo50_oscillator_cmd(mRo50, "\r\n", strlen("\r\n"));
-	memset(answer_str, 0, mro_answer_len);
 	log_info("mRo50 serial reset");
 	return 0;
 }
@@ -226,7 +373,7 @@ static bool mRo50_reset(struct mRo50_oscillator *mRo50)
 		}
 		if (!err) // poll timeout
 			continue;
-		err = read(mRo50->serial_fd, answer_str + rbytes, mro_answer_len - rbytes);
+		err = read(mRo50->serial_fd, mRo50->answer + rbytes, MRO50_ANSWER_SIZE - rbytes);
 		if (err < 0) {
 			log_error("mRo50_oscillator_cmd rbyteserror: %d (%s)", errno, strerror(errno));
 			continue;
@@ -234,19 +381,19 @@ static bool mRo50_reset(struct mRo50_oscillator *mRo50)
 		rbytes += err;
 		if (rbytes < 1)
 			continue;
-		answer_str[rbytes] = 0;
-		if (strstr(answer_str, "Start done>") != NULL) {
-			answer_str[rbytes - 1] = '\0';
-			log_debug("%s", answer_str);
+		mRo50->answer[rbytes] = 0;
+		if (strstr(mRo50->answer, "Start done>") != NULL) {
+			mRo50->answer[rbytes - 1] = '\0';
+			log_debug("%s", mRo50->answer);
 			log_info("mRO successfully reset !");
 			mRo_reset = true;
 			break;
 		}
-		if (answer_str[rbytes - 1] == '\n') {
+		if (mRo50->answer[rbytes - 1] == '\n') {
 			if (rbytes > 1) {
-				answer_str[rbytes - 1] = '\0';
-				log_debug("%s", answer_str);
-				if (answer_str[0] == '?') {
+				mRo50->answer[rbytes - 1] = '\0';
+				log_debug("%s", mRo50->answer);
+				if (mRo50->answer[0] == '?') {
 					log_warn("Reset command not understood by mRO50, retrying...");
 					if (write(mRo50->serial_fd, CMD_RESET, strlen(CMD_RESET)) != strlen(CMD_RESET)) {
 						log_error("mRo50_oscillator_cmd send command error: %d (%s)", errno, strerror(errno));
@@ -256,7 +403,7 @@ static bool mRo50_reset(struct mRo50_oscillator *mRo50)
 			}
 			rbytes = 0;
 		}
-		if (rbytes == mro_answer_len) {
+		if (rbytes == MRO50_ANSWER_SIZE) {
 			log_error("Buffer full !");
 			rbytes = 0;
 		}
@@ -272,8 +419,7 @@ static void read_temperature_compensation_parameters(struct mRo50_oscillator *mR
 	log_info("Reading A & B parameters");
 	ret = mRo50_oscillator_cmd(mRo50, CMD_READ_TEMP_PARAM_A, sizeof(CMD_READ_TEMP_PARAM_A) - 1);
 	if (ret > 0) {
-		res = sscanf(answer_str, "%x\r\n", &a);
-		memset(answer_str, 0, ret);
+		res = sscanf(mRo50->answer, "%x\r\n", &a);
 		if (res > 0) {
 
 		} else {
@@ -291,8 +437,7 @@ static void read_temperature_compensation_parameters(struct mRo50_oscillator *mR
 
 	ret = mRo50_oscillator_cmd(mRo50, CMD_READ_TEMP_PARAM_B, sizeof(CMD_READ_TEMP_PARAM_B) - 1);
 	if (ret > 0) {
-		res = sscanf(answer_str, "%x\r\n", &b);
-		memset(answer_str, 0, ret);
+		res = sscanf(mRo50->answer, "%x\r\n", &b);
 		if (res > 0) {
 
 		} else {
@@ -310,9 +455,44 @@ static void read_temperature_compensation_parameters(struct mRo50_oscillator *mR
 	log_info("Internal temperature compensation: A = %f, B = %f", *((float*)&a), *((float*)&b));
 }
 
-static struct oscillator *mRo50_oscillator_new(struct devices_path *devices_path)
+/**
+ * @brief Find which control values operations work through ioctls
+ *
+ * Adjustments are checked by writing back the values just read, so the
+ * oscillator is not disturbed.
+ *
+ * @param mRo50
+ */
+static void mRo50_detect_ioctls(struct mRo50_oscillator *mRo50)
+{
+	u32 fine, coarse;
+
+	mRo50->ioctls = 0;
+	if (mRo50->mro_fd < 0)
+		return;
+
+	if (ioctl(mRo50->mro_fd, MRO50_READ_FINE, &fine) == 0) {
+		mRo50->ioctls |= MRO50_IOCTL_READ_FINE;
+		if (ioctl(mRo50->mro_fd, MRO50_ADJUST_FINE, &fine) == 0)
+			mRo50->ioctls |= MRO50_IOCTL_ADJUST_FINE;
+	}
+	if (ioctl(mRo50->mro_fd, MRO50_READ_COARSE, &coarse) == 0) {
+		mRo50->ioctls |= MRO50_IOCTL_READ_COARSE;
+		if (ioctl(mRo50->mro_fd, MRO50_ADJUST_COARSE, &coarse) == 0)
+			mRo50->ioctls |= MRO50_IOCTL_ADJUST_COARSE;
+	}
+	log_info("mRO50 ioctls: read fine %s, read coarse %s, adjust fine %s, adjust coarse %s",
+		mRo50->ioctls & MRO50_IOCTL_READ_FINE ? "yes" : "no",
+		mRo50->ioctls & MRO50_IOCTL_READ_COARSE ? "yes" : "no",
+		mRo50->ioctls & MRO50_IOCTL_ADJUST_FINE ? "yes" : "no",
+		mRo50->ioctls & MRO50_IOCTL_ADJUST_COARSE ? "yes" : "no");
+}
+
+static struct oscillator *mRo50_oscillator_new(const struct config *config, struct devices_path *devices_path)
 {
 	struct mRo50_oscillator *mRo50;
+	const char *precision;
+	char *end;
 	int fd, ret;
 	int serial_fd;
 	struct oscillator *oscillator;
@@ -321,8 +501,11 @@ static struct oscillator *mRo50_oscillator_new(struct devices_path *devices_path
 	if (mRo50 == NULL)
 		return NULL;
 	oscillator = &mRo50->oscillator;
+	mRo50->mro_fd = -1;
 
 	if (strlen(devices_path->mro_path) && (fd = open(devices_path->mro_path, O_RDWR)) >= 0) {
+		/* Kept open for control values ioctls */
+		mRo50->mro_fd = fd;
 		log_info("mRO50 device exists, trying to activate serial port");
 		/* Activate serial in order to use mro50-serial device */
 		uint32_t serial_activate = 1;
@@ -331,7 +514,6 @@ static struct oscillator *mRo50_oscillator_new(struct devices_path *devices_path
 			log_error("Could not activate mro50 serial");
 			goto error;
 		}
-		close(fd);
 	}
 	strcpy(mRo50->serial_path, devices_path->mac_path);
 
@@ -354,6 +536,19 @@ static struct oscillator *mRo50_oscillator_new(struct devices_path *devices_path
 	log_debug("instantiated " FACTORY_NAME " oscillator");
 
 	read_temperature_compensation_parameters(mRo50);
+	mRo50_detect_ioctls(mRo50);
+
+	precision = config_get(config, "calibration-slope-precision");
+	mRo50->calib_slope_precision = CALIBRATION_DEFAULT_SLOPE_PRECISION;
+	if (precision != NULL) {
+		errno = 0;
+		mRo50->calib_slope_precision = strtod(precision, &end);
+		if (errno != 0 || *end != '\0' || mRo50->calib_slope_precision < 0) {
+			log_warn("Invalid calibration-slope-precision %s, using %g",
+				precision, CALIBRATION_DEFAULT_SLOPE_PRECISION);
+			mRo50->calib_slope_precision = CALIBRATION_DEFAULT_SLOPE_PRECISION;
+		}
+	}
 
 	return oscillator;
 error_openedfd:
@@ -363,91 +558,135 @@ error:
 	return NULL;
 }
 
-static int mRo50_oscillatord_get_attributes(struct oscillator *oscillator, struct mRo50_attributes *a)
+static int mRo50_parse_status(struct mRo50_cmd *cmd, struct mRo50_attributes *a)
 {
-	struct mRo50_oscillator *mRo50;
-	mRo50 = container_of(oscillator, struct mRo50_oscillator, oscillator);
-	char EP_temperature[4];
+	char EP_temperature[STATUS_ANSWER_FIELD_SIZE + 1] = {0};
 	uint32_t read_value;
-	int err;
-
-	err = mRo50_oscillator_cmd(mRo50, CMD_READ_STATUS, sizeof(CMD_READ_STATUS) - 1);
-	if (err == STATUS_ANSWER_SIZE) {
-		answer_str[err - 2] = '\0';
-		log_debug("MONITOR1 from mro50 gives %s", answer_str);
-		/* Parse mRo50 EP temperature */
-		strncpy(EP_temperature, &answer_str[STATUS_EP_TEMPERATURE_INDEX], STATUS_ANSWER_FIELD_SIZE);
-		read_value = strtoul(EP_temperature, NULL, 16);
-		double temperature = compute_temp(read_value);
-		if (temperature == DUMMY_TEMPERATURE_VALUE)
-			return -1;
-		a->EP_temperature = temperature;
 
-		/* Parse mRO50 clock lock flag */
-		uint8_t lock = answer_str[STATUS_CLOCK_LOCKED_INDEX] & (1 << STATUS_CLOCK_LOCKED_BIT);
-		a->locked = lock >> STATUS_CLOCK_LOCKED_BIT;
-		memset(answer_str, 0, STATUS_ANSWER_SIZE);
-	} else {
-		log_warn("Fail reading attributes, err %d, errno %d", err, errno);
-		err = mRo50_clean_serial(mRo50);
-		if (err != 0) {
-			log_error("Could not reset mRo50 serial");
-		}
+	if (cmd->len != STATUS_ANSWER_SIZE) {
+		log_warn("Fail reading attributes, answer length %d", cmd->len);
 		return -1;
 	}
+	cmd->answer[cmd->len - 2] = '\0';
+	log_debug("MONITOR1 from mro50 gives %s", cmd->answer);
+	/* Parse mRo50 EP temperature */
+	strncpy(EP_temperature, &cmd->answer[STATUS_EP_TEMPERATURE_INDEX], STATUS_ANSWER_FIELD_SIZE);
+	read_value = strtoul(EP_temperature, NULL, 16);
+	double temperature = compute_temp(read_value);
+	if (temperature == DUMMY_TEMPERATURE_VALUE)
+		return -1;
+	a->EP_temperature = temperature;
 
+	/* Parse mRO50 clock lock flag */
+	uint8_t lock = cmd->answer[STATUS_CLOCK_LOCKED_INDEX] & (1 << STATUS_CLOCK_LOCKED_BIT);
+	a->locked = lock >> STATUS_CLOCK_LOCKED_BIT;
 	return 0;
 }
 
-static int mRo50_oscillator_get_ctrl(struct oscillator *oscillator, struct oscillator_ctrl *ctrl)
+static int mRo50_parse_ctrl_value(const struct mRo50_cmd *cmd, const char *name, uint32_t *value)
 {
-	struct mRo50_oscillator *mRo50;
-	uint32_t coarse, fine;
-	int ret, res;
+	if (cmd->len <= 0) {
+		log_error("Fail reading %s parameter", name);
+		return -1;
+	}
+	if (sscanf(cmd->answer, "%x\r\n", value) <= 0) {
+		log_error("Could not parse %s parameter", name);
+		return -1;
+	}
+	return 0;
+}
 
-	mRo50 = container_of(oscillator, struct mRo50_oscillator, oscillator);
+static int mRo50_ioctl_read_ctrl(struct mRo50_oscillator *mRo50, struct oscillator_ctrl *ctrl)
+{
+	u32 coarse, fine;
 
-	ret = mRo50_oscillator_cmd(mRo50, CMD_READ_COARSE, sizeof(CMD_READ_COARSE) - 1);
-	if (ret > 0) {
-		res = sscanf(answer_str, "%x\r\n", &coarse);
-		memset(answer_str, 0, ret);
-		if (res > 0) {
-			ctrl->coarse_ctrl = coarse;
-		} else {
-			log_error("Could not parse coarse parameter");
-			return -1;
-		}
-	} else {
-		log_error("Fail reading Coarse Parameters, err %d, errno %d", ret, errno);
-		mRo50_clean_serial(mRo50);
-		if (ret != 0) {
-			log_error("Could not reset mRo50 serial");
-		}
+	if (ioctl(mRo50->mro_fd, MRO50_READ_COARSE, &coarse) != 0) {
+		log_error("Fail reading coarse parameter: %s", strerror(errno));
 		return -1;
 	}
+	if (ioctl(mRo50->mro_fd, MRO50_READ_FINE, &fine) != 0) {
+		log_error("Fail reading fine parameter: %s", strerror(errno));
+		return -1;
+	}
+	ctrl->coarse_ctrl = coarse;
+	ctrl->fine_ctrl = fine;
+	return 0;
+}
 
-
-	ret = mRo50_oscillator_cmd(mRo50, CMD_READ_FINE, sizeof(CMD_READ_FINE) - 1);
-	if (ret > 0) {
-		res = sscanf(answer_str, "%x\r\n", &fine);
-		memset(answer_str, 0, ret);
-		if (res > 0) {
-			ctrl->fine_ctrl = fine;
-		} else {
-			log_error("Could not parse fine parameter");
-			return -1;
-		}
-	} else {
-		log_error("Fail reading Fine Parameters, err %d, errno %d", ret, errno);
-		mRo50_clean_serial(mRo50);
-		if (ret != 0) {
+/**
+ * @brief Read control values and optionally status
+ *
+ * Control values are read through ioctls when the device supports them,
+ * otherwise in the same serial batch as the status. Status is only
+ * available on the serial port, it holds the lock flag.
+ *
+ * @param mRo50
+ * @param ctrl Output control values
+ * @param a Output attributes, status is not read if NULL
+ * @return 0 on success, -1 if status could not be read, -2 if control values
+ * could not be read
+ */
+static int mRo50_read_state(struct mRo50_oscillator *mRo50, struct oscillator_ctrl *ctrl, struct mRo50_attributes *a)
+{
+	struct mRo50_cmd cmds[] = {
+		{ .cmd = CMD_READ_COARSE, .cmd_len = sizeof(CMD_READ_COARSE) - 1 },
+		{ .cmd = CMD_READ_FINE, .cmd_len = sizeof(CMD_READ_FINE) - 1 },
+		{ .cmd = CMD_READ_STATUS, .cmd_len = sizeof(CMD_READ_STATUS) - 1 },
+	};
+	bool ctrl_ioctl = (mRo50->ioctls & MRO50_IOCTL_READ_CTRL) == MRO50_IOCTL_READ_CTRL;
+	int first = ctrl_ioctl ? 2 : 0;
+	int last = a != NULL ? 3 : 2;
+	int ret = 0;
+
+	if (ctrl_ioctl && mRo50_ioctl_read_ctrl(mRo50, ctrl) != 0)
+		ret = -2;
+	if (first == last)
+		return ret;
+
+	/* Reopen serial port only if the mRO50 does not answer at all */
+	if (mRo50_oscillator_batch(mRo50, cmds + first, last - first) <= 0) {
+		log_warn("No answer from mRo50, errno %d", errno);
+		if (mRo50_clean_serial(mRo50) != 0)
 			log_error("Could not reset mRo50 serial");
-		}
-		return -1;
+		if (!ctrl_ioctl)
+			return -2;
+		return ret != 0 ? ret : -1;
 	}
 
+	if (!ctrl_ioctl &&
+	    (mRo50_parse_ctrl_value(&cmds[0], "coarse", &ctrl->coarse_ctrl) != 0 ||
+	     mRo50_parse_ctrl_value(&cmds[1], "fine", &ctrl->fine_ctrl) != 0))
+		ret = -2;
+	if (a != NULL && mRo50_parse_status(&cmds[2], a) != 0 && ret == 0)
+		ret = -1;
+	return ret;
+}
 
-	return 0;
+static int mRo50_oscillatord_get_attributes(struct oscillator *oscillator, struct mRo50_attributes *a)
+{
+	struct mRo50_oscillator *mRo50;
+	int ret;
+
+	mRo50 = container_of(oscillator, struct mRo50_oscillator, oscillator);
+
+	/* Control values are read along, to be returned by the next get_ctrl */
+	ret = mRo50_read_state(mRo50, &mRo50->ctrl, a);
+	mRo50->ctrl_cached = ret != -2;
+	return ret == 0 ? 0 : -1;
+}
+
+static int mRo50_oscillator_get_ctrl(struct oscillator *oscillator, struct oscillator_ctrl *ctrl)
+{
+	struct mRo50_oscillator *mRo50;
+
+	mRo50 = container_of(oscillator, struct mRo50_oscillator, oscillator);
+
+	if (mRo50->ctrl_cached) {
+		mRo50->ctrl_cached = false;
+		*ctrl = mRo50->ctrl;
+		return 0;
+	}
+	return mRo50_read_state(mRo50, ctrl, NULL) == 0 ? 0 : -1;
 }
 
 static int mRO50_oscillator_parse_attributes(struct oscillator *oscillator, struct oscillator_attributes *attributes)
@@ -471,6 +710,27 @@ static int mRo50_oscillator_apply_output(struct oscillator *oscillator, struct o
 
 	memset(command, '\0', 128);
 	mRo50 = container_of(oscillator, struct mRo50_oscillator, oscillator);
+	mRo50->ctrl_cached = false;
+
+	if (output->action == ADJUST_FINE && (mRo50->ioctls & MRO50_IOCTL_ADJUST_FINE)) {
+		u32 setpoint = output->setpoint;
+
+		log_trace("mRo50_oscillator_apply_output: Fine adjustment to value %lu requested", output->setpoint);
+		if (ioctl(mRo50->mro_fd, MRO50_ADJUST_FINE, &setpoint) != 0) {
+			log_error("Could not adjust fine frequency: %s", strerror(errno));
+			return -1;
+		}
+		return 0;
+	} else if (output->action == ADJUST_COARSE && (mRo50->ioctls & MRO50_IOCTL_ADJUST_COARSE)) {
+		u32 setpoint = output->setpoint;
+
+		log_trace("mRo50_oscillator_apply_output: Coarse adjustment to value %lu requested", output->setpoint);
+		if (ioctl(mRo50->mro_fd, MRO50_ADJUST_COARSE, &setpoint) != 0) {
+			log_error("Could not adjust coarse frequency: %s", strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
 
 	if (output->action == ADJUST_FINE) {
 		log_trace("mRo50_oscillator_apply_output: Fine adjustment to value %lu requested", output->setpoint);
@@ -488,17 +748,152 @@ static int mRo50_oscillator_apply_output(struct oscillator *oscillator, struct o
 		log_error("Could not prepare command request to adjust fine frequency, error %d, errno %d", ret, errno);
 		return -1;
 	}
-	memset(answer_str, 0, mro_answer_len);
 	return 0;
 }
 
+static void linear_fit_add(struct linear_fit *fit, double t, double y)
+{
+	fit->n++;
+	fit->st += t;
+	fit->sy += y;
+	fit->stt += t * t;
+	fit->sty += t * y;
+	fit->syy += y * y;
+}
+
+/**
+ * @brief Solve least squares fit
+ *
+ * @param fit
+ * @param slope Output slope
+ * @param intercept Output value at t = 0
+ * @param stderr_slope Output standard error of the slope, needs 3 points
+ * @return 0 on success, -1 if there are not enough points
+ */
+static int linear_fit_solve(const struct linear_fit *fit, double *slope, double *intercept,
+	double *stderr_slope)
+{
+	double stt, sty, syy, ssr;
+
+	if (fit->n < 2)
+		return -1;
+	stt = fit->stt - fit->st * fit->st / fit->n;
+	sty = fit->sty - fit->st * fit->sy / fit->n;
+	syy = fit->syy - fit->sy * fit->sy / fit->n;
+	if (stt <= 0)
+		return -1;
+	*slope = sty / stt;
+	*intercept = (fit->sy - *slope * fit->st) / fit->n;
+	ssr = fmax(syy - *slope * sty, 0);
+	*stderr_slope = fit->n > 2 ? sqrt(ssr / (fit->n - 2) / stt) : INFINITY;
+	return 0;
+}
+
+/* Two-sided 95% quantile of Student's t distribution */
+static double student_t95(int df)
+{
+	static const double table[] = { 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23 };
+
+	if (df < 1)
+		return INFINITY;
+	if (df <= (int) (sizeof(table) / sizeof(table[0])))
+		return table[df - 1];
+	return 1.96 + 2.4 / df;
+}
+
+/**
+ * @brief Get a phase error measure corrected with GNSS quantization error
+ *
+ * @param phasemeter
+ * @param gnss
+ * @param measure Output phase error, in ns
+ * @return 0 on success, -1 on error
+ */
+static int mRo50_calibration_measure(struct phasemeter *phasemeter, struct gnss *gnss, double *measure)
+{
+	int64_t phase_error;
+	int32_t qErr;
+
+	if (get_phase_error(phasemeter, &phase_error) != PHASEMETER_BOTH_TIMESTAMPS) {
+		log_error("Could not get phase error during calibration, aborting");
+		return -1;
+	}
+	/* Get qErr in ps*/
+	if (gnss_get_epoch_data(gnss, NULL, NULL, &qErr) != 0) {
+		log_error("Could not get gnss data");
+		return -1;
+	}
+	*measure = phase_error + (float) qErr / 1000;
+	log_debug("phase error = %" PRIi64 ", qErr = %d, result = %f", phase_error, qErr, *measure);
+	return 0;
+}
+
+/**
+ * @brief Fit a line to measures taken once per second
+ *
+ * @param fit Output fit, t = 0 at first measure
+ * @param measures
+ * @param n number of measures
+ */
+static void linear_fit_measures(struct linear_fit *fit, const double *measures, int n)
+{
+	memset(fit, 0, sizeof(*fit));
+	/* Relative to first measure to keep precision */
+	for (int j = 0; j < n; j++)
+		linear_fit_add(fit, j, measures[j] - measures[0]);
+}
+
+/**
+ * @brief Check that phase slopes of both halves of measures agree
+ *
+ * Slopes are compared against their standard error, so that only a
+ * transient larger than the measurement noise is detected.
+ *
+ * @param measures one per second
+ * @param n number of measures, even
+ */
+static bool mRo50_calibration_halves_agree(const double *measures, int n)
+{
+	struct linear_fit fit;
+	double slope[2], intercept, stderr_slope[2];
+
+	for (int h = 0; h < 2; h++) {
+		linear_fit_measures(&fit, measures + h * n / 2, n / 2);
+		if (linear_fit_solve(&fit, &slope[h], &intercept, &stderr_slope[h]) != 0)
+			return true;
+	}
+	return fabs(slope[1] - slope[0]) <= student_t95(n - 4) *
+		sqrt(stderr_slope[0] * stderr_slope[0] + stderr_slope[1] * stderr_slope[1]);
+}
+
+/**
+ * @brief Measure phase drift at each calibration control point
+ *
+ * Phase is measured every second after a control change. Each time the
+ * number of measures doubles, and before stopping, slopes of their two halves
+ * are compared: while they differ, the oscillator is still settling and the
+ * first half is dropped, for at most SETTLING_TIME seconds. A line is fitted to the
+ * remaining measures, which stop as soon as the 95% confidence interval of
+ * its slope is within calibration-slope-precision, after at least
+ * CALIBRATION_MIN_MEASURES and at most nb_calibration measures.
+ * Disciplining library expects the same number of measures, one per second,
+ * for each point: the lowest number taken is reported, keeping the last
+ * measures of each point, the most settled ones.
+ */
 static struct calibration_results * mRo50_oscillator_calibrate(struct oscillator *oscillator,
 		struct phasemeter *phasemeter, struct gnss *gnss, struct calibration_parameters *calib_params,
 		int phase_sign)
 {
+	struct mRo50_oscillator *mRo50 = container_of(oscillator, struct mRo50_oscillator, oscillator);
 	struct od_output adj_fine = { .action = ADJUST_FINE, .setpoint = 0, };
+	double slope, intercept, stderr_slope, half_width;
+	struct linear_fit fit;
+	double *samples = NULL;
+	int nb, start, count, next_check;
+	int stride, nb_min;
+	int *counts = NULL;
+	bool done;
 	int ret;
-	int64_t phase_error;
 
 	struct calibration_results *results = malloc(sizeof(struct calibration_results));
 	if (results == NULL) {
@@ -507,13 +902,14 @@ static struct calibration_results * mRo50_oscillator_calibrate(struct oscillator
 	}
 
 	results->length = calib_params->length;
-	results->nb_calibration = calib_params->nb_calibration;
-	results->measures = malloc(results->length * results->nb_calibration * sizeof(struct timespec));
-	if (results->measures == NULL) {
+	stride = calib_params->nb_calibration;
+	nb_min = stride;
+	results->measures = malloc(results->length * stride * sizeof(*results->measures));
+	samples = malloc((SETTLING_TIME + stride) * sizeof(*samples));
+	counts = malloc(results->length * sizeof(*counts));
+	if (results->measures == NULL || samples == NULL || counts == NULL) {
 		log_error("Could not allocate memory to create calibration measures");
-		free(results);
-		results = NULL;
-		return NULL;
+		goto clean_calibration;
 	}
 	log_info("Starting measure for calibration");
 	for (int i = 0; i < results->length; i ++) {
@@ -523,14 +919,9 @@ static struct calibration_results * mRo50_oscillator_calibrate(struct oscillator
 		log_info("Applying fine adjustment of %d", adj_fine.setpoint);
 		ret = mRo50_oscillator_apply_output(oscillator, &adj_fine);
 		if (ret < 0) {
-			free(results->measures);
 			log_error("Could not write to mRO50");
-			results->measures = NULL;
-			free(results);
-			results = NULL;
-			return NULL;
+			goto clean_calibration;
 		}
-		sleep(SETTLING_TIME);
 
 		struct oscillator_ctrl ctrl;
 		ret = mRo50_oscillator_get_ctrl(oscillator, &ctrl);
@@ -540,39 +931,66 @@ static struct calibration_results * mRo50_oscillator_calibrate(struct oscillator
 		}
 
 		log_info("Starting phase error measures %d/%d", i+1, results->length);
-		for (int j = 0; j < results->nb_calibration; j++) {
+		start = 0;
+		count = 0;
+		next_check = 2 * CALIBRATION_SETTLE_WINDOW;
+		half_width = INFINITY;
+		for (;;) {
 			if (!loop)
 				goto clean_calibration;
-			int phasemeter_status = get_phase_error(phasemeter, &phase_error);
-			if (phasemeter_status != PHASEMETER_BOTH_TIMESTAMPS) {
-				log_error("Could not get phase error during calibration, aborting");
-				free(results->measures);
-				results->measures = NULL;
-				free(results);
-				results = NULL;
-				return NULL;
-			}
-			/* Get qErr in ps*/
-			int32_t qErr;
-			if (gnss_get_epoch_data(gnss, NULL, NULL, &qErr) != 0) {
-				log_error("Could not get gnss data");
-				free(results->measures);
-				results->measures = NULL;
-				free(results);
-				results = NULL;
-				return NULL;
-			}
-
-			*(results->measures + i * results->nb_calibration + j) = phase_error + (float) qErr / 1000;
-			log_debug("ctrl_point %d measure[%d]: phase error = %lld, qErr = %d, result = %f",
-				adj_fine.setpoint, j, phase_error, qErr, phase_error + (float) qErr / 1000);
+			if (mRo50_calibration_measure(phasemeter, gnss, &samples[count]) != 0)
+				goto clean_calibration;
+			count++;
 			sleep(1);
+
+			nb = count - start;
+			linear_fit_measures(&fit, samples + start, nb);
+			if (linear_fit_solve(&fit, &slope, &intercept, &stderr_slope) == 0)
+				half_width = student_t95(nb - 2) * stderr_slope;
+			done = nb >= stride ||
+				(nb >= CALIBRATION_MIN_MEASURES && half_width <= mRo50->calib_slope_precision);
+			if ((nb == next_check || done) && start + nb / 2 <= SETTLING_TIME &&
+				!mRo50_calibration_halves_agree(samples + start, nb - nb % 2)) {
+				log_debug("ctrl_point %d: still settling after %d s", adj_fine.setpoint, count);
+				start += nb / 2;
+				nb -= nb / 2;
+				next_check = 2 * nb;
+				half_width = INFINITY;
+				continue;
+			}
+			if (nb == next_check)
+				next_check *= 2;
+			if (done)
+				break;
 		}
+		linear_fit_measures(&fit, samples + start, nb);
+		if (linear_fit_solve(&fit, &slope, &intercept, &stderr_slope) != 0)
+			slope = 0;
+
+		for (int j = 0; j < nb; j++)
+			results->measures[i * stride + j] = samples[start + j];
+		counts[i] = nb;
+		if (nb < nb_min)
+			nb_min = nb;
+		log_info("ctrl_point %d: phase slope %.3f ns/s +/- %.3f, settled in %d s, %d measures",
+			adj_fine.setpoint, slope, half_width, start, nb);
 	}
 
+	/* Pack the last nb_min measures of each point, in place as they only move down */
+	for (int i = 0; i < results->length; i++)
+		memmove(&results->measures[i * nb_min],
+			&results->measures[i * stride + counts[i] - nb_min],
+			nb_min * sizeof(*results->measures));
+	results->nb_calibration = nb_min;
+	log_info("Calibration: %d measures per control point", nb_min);
+
+	free(counts);
+	free(samples);
 	return results;
 
 clean_calibration:
+	free(counts);
+	free(samples);
 	free(results->measures);
 	results->measures = NULL;
 	free(results);
@@ -102,7 +102,7 @@ static int set_serial_attributes(int fd)
 	return 0;
 }
 
-static struct oscillator *sa3x_oscillator_new(struct devices_path *devices_path)
+static struct oscillator *sa3x_oscillator_new(const struct config *config, struct devices_path *devices_path)
 {
 	struct sa3x_oscillator *sa3x;
 	int fd;
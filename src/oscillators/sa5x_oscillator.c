@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <poll.h>
 
@@ -83,8 +84,56 @@ struct sa5x_disciplining_status {
 	bool holdover_ready;
 };
 
+/* Telemetry fields read with {get,...} commands, cached for a TTL */
+enum sa5x_field {
+	SA5X_FIELD_ALARMS,
+	SA5X_FIELD_LOCKED,
+	SA5X_FIELD_DISCIPLINE_LOCKED,
+	SA5X_FIELD_PPS_IN_DETECTED,
+	SA5X_FIELD_PHASE,
+	SA5X_FIELD_LAST_CORRECTION,
+	SA5X_FIELD_TEMPERATURE,
+	SA5X_FIELD_DIGITAL_TUNING,
+	SA5X_FIELD_TAU,
+	SA5X_FIELD_DISCIPLINING,
+	SA5X_FIELD_COUNT
+};
+
+struct sa5x_field_info {
+	/** Suffix of the sa5x-cache-ttl- configuration key */
+	const char *name;
+	const char *cmd;
+	/** Default TTL in ms, short enough for a value read once per second */
+	unsigned int ttl_ms;
+	/** Value is a decimal number, rounded to the nearest integer */
+	bool decimal;
+};
+
+static const struct sa5x_field_info sa5x_fields[SA5X_FIELD_COUNT] = {
+	[SA5X_FIELD_ALARMS] = { "alarms", CMD_GET_ALARMS, 500, false },
+	[SA5X_FIELD_LOCKED] = { "locked", CMD_GET_LOCKED, 500, false },
+	[SA5X_FIELD_DISCIPLINE_LOCKED] = { "discipline-locked", CMD_GET_DISCIPLINE_LOCKED, 500, false },
+	[SA5X_FIELD_PPS_IN_DETECTED] = { "pps-in-detected", CMD_GET_GNSS_PPS, 500, false },
+	[SA5X_FIELD_PHASE] = { "phase", CMD_GET_PHASE, 500, true },
+	[SA5X_FIELD_LAST_CORRECTION] = { "last-correction", CMD_GET_LASTCORRECTION, 500, false },
+	[SA5X_FIELD_TEMPERATURE] = { "temperature", CMD_GET_TEMPERATURE, 500, false },
+	[SA5X_FIELD_DIGITAL_TUNING] = { "digital-tuning", CMD_GET_DIGITAL_TUNING, 500, false },
+	[SA5X_FIELD_TAU] = { "tau", CMD_GET_TAU, 60000, false },
+	[SA5X_FIELD_DISCIPLINING] = { "disciplining", CMD_GET_DISCIPLINING, 500, false },
+};
+
+struct sa5x_cached_field {
+	bool valid;
+	int64_t value;
+	/** CLOCK_MONOTONIC time of the read, in ms */
+	int64_t read_ms;
+	unsigned int ttl_ms;
+};
+
 struct sa5x_oscillator {
 	struct oscillator oscillator;
+	/** Last value read for each field, shared by all callers */
+	struct sa5x_cached_field cache[SA5X_FIELD_COUNT];
 	int	osc_fd;
 	int disciplining_phase;
 	struct sa5x_disciplining_status status;
@@ -307,6 +356,74 @@ static int sa5x_oscillator_read_phase(int32_t *val, int size)
 	return res;
 }
 
+static int64_t sa5x_monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sa5x_invalidate_field(struct sa5x_oscillator *sa5x, enum sa5x_field field)
+{
+	sa5x->cache[field].valid = false;
+}
+
+static void sa5x_invalidate_all(struct sa5x_oscillator *sa5x)
+{
+	for (int i = 0; i < SA5X_FIELD_COUNT; i++)
+		sa5x->cache[i].valid = false;
+}
+
+/**
+ * @brief Read a telemetry field, from the cache if it is recent enough
+ *
+ * @param sa5x
+ * @param field
+ * @param value Output value
+ * @return > 0 on success, <= 0 on error as sa5x_oscillator_read_intval
+ */
+static int sa5x_read_field(struct sa5x_oscillator *sa5x, enum sa5x_field field, int64_t *value)
+{
+	const struct sa5x_field_info *info = &sa5x_fields[field];
+	struct sa5x_cached_field *cached = &sa5x->cache[field];
+	int64_t now = sa5x_monotonic_ms();
+	int cmd_len = strlen(info->cmd) + 1;
+	int res;
+
+	if (cached->valid && now - cached->read_ms < cached->ttl_ms) {
+		*value = cached->value;
+		return 1;
+	}
+
+	if (info->decimal) {
+		int32_t val;
+
+		res = sa5x_oscillator_read_phase(&val, sa5x_oscillator_cmd(sa5x, info->cmd, cmd_len));
+		if (res > 0)
+			*value = val;
+	} else {
+		res = sa5x_oscillator_read_int64val(value, sa5x_oscillator_cmd(sa5x, info->cmd, cmd_len));
+	}
+
+	cached->valid = res > 0;
+	if (cached->valid) {
+		cached->value = *value;
+		cached->read_ms = now;
+	}
+	return res;
+}
+
+static int sa5x_read_field_int(struct sa5x_oscillator *sa5x, enum sa5x_field field, int *value)
+{
+	int64_t val;
+	int res = sa5x_read_field(sa5x, field, &val);
+
+	if (res > 0)
+		*value = (int) val;
+	return res;
+}
+
 static int sa5x_oscillator_get_attributes(struct oscillator *oscillator, struct sa5x_attributes *a,
 										  unsigned int attributes_mask)
 {
@@ -355,12 +472,12 @@ static int sa5x_oscillator_get_attributes(struct oscillator *oscillator, struct
 	}
 
 	if (attributes_mask & (ATTR_STATUS_PPS | ATTR_STATUS)) {
-		err = sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_DISCIPLINE_LOCKED, sizeof(CMD_GET_DISCIPLINE_LOCKED)));
+		err = sa5x_read_field_int(sa5x, SA5X_FIELD_DISCIPLINE_LOCKED, &val);
 		if (err > 0) {
 			a->disciplinelocked = val;
 		}
 
-		err = sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_GNSS_PPS, sizeof(CMD_GET_GNSS_PPS)));
+		err = sa5x_read_field_int(sa5x, SA5X_FIELD_PPS_IN_DETECTED, &val);
 		if (err > 0) {
 			a->ppsindetected = val;
 			if (!val)
@@ -373,26 +490,26 @@ static int sa5x_oscillator_get_attributes(struct oscillator *oscillator, struct
 	}
 
 	if (attributes_mask & ATTR_CTRL) {
-		sa5x_oscillator_read_int64val(&a->digitaltuning, sa5x_oscillator_cmd(sa5x, CMD_GET_DIGITAL_TUNING, sizeof(CMD_GET_DIGITAL_TUNING)));
+		sa5x_read_field(sa5x, SA5X_FIELD_DIGITAL_TUNING, &a->digitaltuning);
 
-		err = sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_LOCKED, sizeof(CMD_GET_LOCKED)));
+		err = sa5x_read_field_int(sa5x, SA5X_FIELD_LOCKED, &val);
 		if (err > 0) {
 			a->locked = val;
 		}
 
-		if (sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_TAU, sizeof(CMD_GET_TAU))) > 0) {
+		if (sa5x_read_field_int(sa5x, SA5X_FIELD_TAU, &val) > 0) {
 			a->tau = val;
 		}
-		sa5x_oscillator_read_intval(&a->lastcorrection, sa5x_oscillator_cmd(sa5x, CMD_GET_LASTCORRECTION, sizeof(CMD_GET_LASTCORRECTION)));
+		sa5x_read_field_int(sa5x, SA5X_FIELD_LAST_CORRECTION, &a->lastcorrection);
 	}
 
 	if (attributes_mask & ATTR_STATUS) {
 
-		if(sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_ALARMS, sizeof(CMD_GET_ALARMS)))) {
+		if(sa5x_read_field_int(sa5x, SA5X_FIELD_ALARMS, &val) > 0) {
 			a->alarms = (uint32_t)val;
 		}
 
-		err = sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_DISCIPLINING, sizeof(CMD_GET_DISCIPLINING)));
+		err = sa5x_read_field_int(sa5x, SA5X_FIELD_DISCIPLINING, &val);
 		if (err > 0) {
 			a->disciplining = val;
 			// if disciplining is off check Phase to enable it
@@ -403,12 +520,13 @@ static int sa5x_oscillator_get_attributes(struct oscillator *oscillator, struct
 
 	if (attributes_mask & ATTR_PHASE) {
 
-		sa5x_oscillator_read_phase(&a->phaseoffset, sa5x_oscillator_cmd(sa5x, CMD_GET_PHASE, sizeof(CMD_GET_PHASE)));
+		sa5x_read_field_int(sa5x, SA5X_FIELD_PHASE, &a->phaseoffset);
 
 		if (attributes_mask & ATTR_STATUS && !a->disciplining) {
 			log_warn("SA5x reports disciplining off, phase offset = %d, %s", a->phaseoffset,
 					  a->phaseoffset ? "skip switching while Phase is not 0" : "trying to switch it on");
 			if (!a->phaseoffset) {
+				sa5x_invalidate_field(sa5x, SA5X_FIELD_DISCIPLINING);
 				if (sa5x_oscillator_cmd(sa5x, answer_str, snprintf(answer_str, answer_len, CMD_SET_DISCIPLINING, 1)) == -1) {
 					log_warn("SA5x: couldn't enable disciplining after latch command");
 				}
@@ -418,7 +536,7 @@ static int sa5x_oscillator_get_attributes(struct oscillator *oscillator, struct
 	}
 
 	if (attributes_mask & ATTR_STATUS_TEMPERATURE) {
-		err = sa5x_oscillator_read_intval(&a->temperature,sa5x_oscillator_cmd(sa5x, CMD_GET_TEMPERATURE, sizeof(CMD_GET_TEMPERATURE)));
+		err = sa5x_read_field_int(sa5x, SA5X_FIELD_TEMPERATURE, &a->temperature);
 		if (err <= 0) {
 			// this is the only parameter that we depend on
 			return err;
@@ -428,7 +546,7 @@ static int sa5x_oscillator_get_attributes(struct oscillator *oscillator, struct
 	return 0;
 }
 
-static struct oscillator *sa5x_oscillator_new(struct devices_path *devices_path)
+static struct oscillator *sa5x_oscillator_new(const struct config *config, struct devices_path *devices_path)
 {
 	struct sa5x_oscillator *sa5x;
 	int fd;
@@ -440,6 +558,14 @@ static struct oscillator *sa5x_oscillator_new(struct devices_path *devices_path)
 		return NULL;
 	oscillator = &sa5x->oscillator;
 	sa5x->osc_fd = -1;
+	for (int i = 0; i < SA5X_FIELD_COUNT; i++) {
+		char key[64];
+		long ttl;
+
+		snprintf(key, sizeof(key), "sa5x-cache-ttl-%s", sa5x_fields[i].name);
+		ttl = config_get_unsigned_number(config, key);
+		sa5x->cache[i].ttl_ms = ttl >= 0 ? ttl : sa5x_fields[i].ttl_ms;
+	}
 
 	fd = open(devices_path->mac_path, O_RDWR|O_NONBLOCK);
 	if (fd == -1) {
@@ -489,12 +615,13 @@ static int sa5x_oscillator_latch(struct sa5x_oscillator *sa5x, struct sa5x_attri
 
 	while (retry && a->disciplining) {
 		cmd_len = snprintf(answer_str, answer_len, CMD_SET_DISCIPLINING, 0);
+		sa5x_invalidate_field(sa5x, SA5X_FIELD_DISCIPLINING);
 		if (sa5x_oscillator_cmd(sa5x, answer_str, cmd_len) == -1) {
 			log_warn("SA5x: couldn't disable disciplining for latch command");
 			return 1;
 		}
-		err = sa5x_oscillator_read_intval(&val, sa5x_oscillator_cmd(sa5x, CMD_GET_DISCIPLINING, sizeof(CMD_GET_DISCIPLINING)));
-		if (err == -1) {
+		err = sa5x_read_field_int(sa5x, SA5X_FIELD_DISCIPLINING, &val);
+		if (err <= 0) {
 			log_warn("SA5x: couldn't read disciplining status while in latch procedure");
 			return 1;
 		}
@@ -507,6 +634,8 @@ static int sa5x_oscillator_latch(struct sa5x_oscillator *sa5x, struct sa5x_attri
 		return 1;
 	}
 
+	/* Latch changes tuning and disciplining state */
+	sa5x_invalidate_all(sa5x);
 	if ((err = sa5x_oscillator_cmd(sa5x, CMD_LATCH, sizeof(CMD_LATCH))) == -1) {
 		log_warn("SA5x: error with latch command");
 		return 1;
@@ -619,6 +748,7 @@ static int sa5x_oscillator_get_ctrl(struct oscillator *oscillator, struct oscill
 
 	if (adjust_tau) {
 		cmd_len = snprintf(answer_str, answer_len, CMD_SET_TAU, tau_values[sa5x->disciplining_phase]);
+		sa5x_invalidate_field(sa5x, SA5X_FIELD_TAU);
 		if (sa5x_oscillator_cmd(sa5x, answer_str, cmd_len) == -1) {
 			log_debug("couldn't set TAU to %d", tau_values[sa5x->disciplining_phase]);
 		}
@@ -694,6 +824,7 @@ static const struct oscillator_factory sa5x_oscillator_factory = {
 		.get_disciplining_status = sa5x_oscillator_get_disciplining_status,
 		.parse_attributes = sa5x_oscillator_parse_attributes,
 		.push_gnss_info = sa5x_oscillator_push_gnss_info,
+		.capabilities = OSCILLATOR_CAP_PHASEMETER,
 	},
 	.new = sa5x_oscillator_new,
 	.destroy = sa5x_oscillator_destroy,
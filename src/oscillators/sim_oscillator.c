@@ -4,6 +4,7 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -25,57 +26,63 @@
 #include "../oscillator_factory.h"
 
 #define FACTORY_NAME "sim"
-#define SIM_SETPOINT_MIN 0
-#define SIM_SETPOINT_MAX 1000000
 #define SIM_MAX_PTS_PATH_LEN 0x400
+/* Reported until the simulator has written its first status */
+#define SIM_DEFAULT_TEMPERATURE 40.0
 
 struct sim_oscillator {
 	struct oscillator oscillator;
+	/** Standard output of the simulator process */
 	FILE *simulator_process;
+	pid_t simulator_pid;
 	int control_fifo;
 	char pps_pts[SIM_MAX_PTS_PATH_LEN];
-	uint32_t value;
+	uint32_t fine;
+	uint32_t coarse;
+	double temperature;
 };
 
 static unsigned int sim_oscillator_index;
 
-static int sim_oscillator_set_dac(struct oscillator *oscillator,
-		uint32_t value)
+static int sim_oscillator_set_control(struct oscillator *oscillator,
+		enum sim_control_type type, uint32_t value)
 {
 	struct sim_oscillator *sim;
+	struct sim_control control = { .type = type, .value = value };
 	ssize_t sret;
 
 	sim = container_of(oscillator, struct sim_oscillator, oscillator);
 
-	log_debug("%s(%s, %" PRIu32 ")", __func__, oscillator->name, value);
+	log_debug("%s(%s, %s, %" PRIu32 ")", __func__, oscillator->name,
+		type == SIM_CONTROL_COARSE ? "coarse" : "fine", value);
 
-	sret = write(sim->control_fifo, &value, sizeof(value));
+	sret = write(sim->control_fifo, &control, sizeof(control));
 	if (sret == -1)
 		return -errno;
-	sim->value = value;
+	if (type == SIM_CONTROL_COARSE)
+		sim->coarse = value;
+	else
+		sim->fine = value;
 
 	return 0;
 }
 
-static int sim_oscillator_get_dac(struct oscillator *oscillator,
-		uint32_t *value)
+static int sim_oscillator_get_ctrl(struct oscillator *oscillator,
+		struct oscillator_ctrl *ctrl)
 {
 	struct sim_oscillator *sim;
 
 	sim = container_of(oscillator, struct sim_oscillator, oscillator);
 
-	*value = sim->value;
-	log_debug("%s(%s) = %" PRIu32, __func__, oscillator->name, *value);
+	ctrl->dac = sim->fine;
+	ctrl->fine_ctrl = sim->fine;
+	ctrl->coarse_ctrl = sim->coarse;
+	log_debug("%s(%s) = %" PRIu32 ", %" PRIu32, __func__, oscillator->name,
+		ctrl->fine_ctrl, ctrl->coarse_ctrl);
 
 	return 0;
 }
 
-static int sim_oscillator_get_ctrl(struct oscillator *oscillator,
-		struct oscillator_ctrl *ctrl)
-{
-	return sim_oscillator_get_dac(oscillator, &ctrl->dac);
-}
-
 static int sim_oscillator_save(struct oscillator *oscillator)
 {
 	log_debug("%s(%s)", __func__, oscillator->name);
@@ -85,16 +92,31 @@ static int sim_oscillator_save(struct oscillator *oscillator)
 
 static int sim_oscillator_parse_attributes(struct oscillator *oscillator, struct oscillator_attributes *attributes)
 {
-	attributes->temperature = (rand() % (55 - 10)) + 10;
-	attributes->locked = false;
+	struct sim_oscillator *sim;
+	double temperature;
+	FILE *status;
+
+	sim = container_of(oscillator, struct sim_oscillator, oscillator);
 
-	log_info("%s(%p, %g)", __func__, oscillator, attributes->temperature);
+	/* Simulated temperature, last one is kept if status can't be read */
+	status = fopen(STATUS_FILE_PATH, "re");
+	if (status != NULL) {
+		if (fscanf(status, "%lf", &temperature) == 1)
+			sim->temperature = temperature;
+		fclose(status);
+	}
+	attributes->temperature = sim->temperature;
+	attributes->locked = true;
+
+	log_debug("%s(%s, %g)", __func__, oscillator->name, attributes->temperature);
 
 	return 0;
 }
 
 static int sim_oscillator_apply_output(struct oscillator *oscillator, struct od_output *output) {
-		return sim_oscillator_set_dac(oscillator, output->setpoint);
+	if (output->action == ADJUST_COARSE)
+		return sim_oscillator_set_control(oscillator, SIM_CONTROL_COARSE, output->setpoint);
+	return sim_oscillator_set_control(oscillator, SIM_CONTROL_FINE, output->setpoint);
 }
 
 
@@ -110,42 +132,81 @@ static void sim_oscillator_destroy(struct oscillator **oscillator)
 	s = container_of(o, struct sim_oscillator, oscillator);
 	fd_cleanup(&s->control_fifo);
 	if (s->simulator_process != NULL) {
-		pclose(s->simulator_process);
+		fclose(s->simulator_process);
 		s->simulator_process = NULL;
+		waitpid(s->simulator_pid, NULL, 0);
 	}
 	memset(o, 0, sizeof(*o));
 	free(o);
 	*oscillator = NULL;
 }
 
-static struct oscillator *sim_oscillator_new(struct devices_path *devices_path)
+/**
+ * @brief Start the simulator, without going through a shell
+ *
+ * @param config_path configuration, simulator reads its sim-* parameters in it
+ * @param pid Output pid of the simulator
+ * @return standard output of the simulator, NULL on error with errno set
+ */
+static FILE *sim_oscillator_spawn(const char *config_path, pid_t *pid)
+{
+	char *const argv[] = { "oscillator_sim", (char *) config_path, NULL };
+	FILE *output;
+	int fds[2];
+	int err;
+
+	if (pipe2(fds, O_CLOEXEC) < 0)
+		return NULL;
+	*pid = fork();
+	if (*pid < 0) {
+		err = errno;
+		close(fds[0]);
+		close(fds[1]);
+		errno = err;
+		return NULL;
+	}
+	if (*pid == 0) {
+		if (dup2(fds[1], STDOUT_FILENO) < 0)
+			_exit(127);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	close(fds[1]);
+	output = fdopen(fds[0], "r");
+	if (output == NULL) {
+		err = errno;
+		close(fds[0]);
+		waitpid(*pid, NULL, 0);
+		errno = err;
+	}
+	return output;
+}
+
+static struct oscillator *sim_oscillator_new(const struct config *config, struct devices_path *devices_path)
 {
 	struct sim_oscillator *sim;
 	int ret;
 	struct oscillator *oscillator;
 	const char *cret;
-
-	__attribute__((cleanup(string_cleanup))) char *simulator_command = NULL;
-
-	ret = asprintf(&simulator_command, "oscillator_sim");
-	if (ret < 0) {
-		log_error("asprintf error");
-		errno = ENOMEM;
-		return NULL;
-	}
+	long value;
 
 	sim = calloc(1, sizeof(*sim));
 	if (sim == NULL)
 		return NULL;
 	oscillator = &sim->oscillator;
 	sim->control_fifo = -1;
+	sim->temperature = SIM_DEFAULT_TEMPERATURE;
+	value = config_get_unsigned_number(config, "sim-fine");
+	sim->fine = value >= 0 ? value : (SIM_FINE_MIN + SIM_FINE_MAX) / 2;
+	value = config_get_unsigned_number(config, "sim-coarse");
+	sim->coarse = value >= 0 ? value : (SIM_COARSE_MIN + SIM_COARSE_MAX) / 2;
 
 	log_info("launching the simulator process");
 	unlink(CONTROL_FIFO_PATH);
-	sim->simulator_process = popen(simulator_command, "re");
+	sim->simulator_process = sim_oscillator_spawn(config->path, &sim->simulator_pid);
 	if (sim->simulator_process == NULL) {
 		ret = -errno;
-		log_error("popen: %m");
+		log_error("Could not start oscillator_sim: %m");
 		goto error;
 	}
 	log_info("opening fifo");
@@ -187,8 +248,8 @@ static const struct oscillator_factory sim_oscillator_factory = {
 			.save = sim_oscillator_save,
 			.parse_attributes = sim_oscillator_parse_attributes,
 			.apply_output = sim_oscillator_apply_output,
-			.dac_min = SIM_SETPOINT_MIN,
-			.dac_max = SIM_SETPOINT_MAX,
+			.dac_min = SIM_FINE_MIN,
+			.dac_max = SIM_FINE_MAX,
 	},
 	.new = sim_oscillator_new,
 	.destroy = sim_oscillator_destroy,
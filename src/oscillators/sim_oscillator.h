@@ -1,6 +1,27 @@
 #ifndef SRC_OSCILLATORS_SIM_OSCILLATOR_H_
 #define SRC_OSCILLATORS_SIM_OSCILLATOR_H_
 
+#include <stdint.h>
+
 #define CONTROL_FIFO_PATH "oscillator_sim.control"
+/* Written by the simulator at each step, holds the simulated temperature */
+#define STATUS_FILE_PATH "oscillator_sim.status"
+
+/* Control ranges, as a mRO50 */
+#define SIM_FINE_MIN 0
+#define SIM_FINE_MAX 4800
+#define SIM_COARSE_MIN 0
+#define SIM_COARSE_MAX 4194303
+
+enum sim_control_type {
+	SIM_CONTROL_FINE,
+	SIM_CONTROL_COARSE,
+};
+
+/* Message written by sim oscillator on the control fifo */
+struct sim_control {
+	uint32_t type;
+	uint32_t value;
+};
 
 #endif /* SRC_OSCILLATORS_SIM_OSCILLATOR_H_ */
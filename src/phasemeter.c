@@ -111,6 +111,29 @@ static int disable_extts(int fd, unsigned int extts_index)
 	return 0;
 }
 
+/**
+ * @brief Read next timestamp of one of the PPS, keeping track of the GNSS one
+ *
+ * @param phasemeter
+ * @param ts output timestamp
+ */
+static void phasemeter_read_timestamp(struct phasemeter *phasemeter, struct external_timestamp *ts)
+{
+	do {
+		ts->index = read_extts(phasemeter->fd, &ts->timestamp);
+		if (ts->index < 0) {
+			log_warn("Could not read ptp clock external timestamp for phasemeter");
+		}
+	} while (ts->index != EXTTS_INDEX_ART_INTERNAL_PPS && ts->index != EXTTS_INDEX_GNSS_PPS);
+
+	if (ts->index == EXTTS_INDEX_GNSS_PPS) {
+		pthread_mutex_lock(&phasemeter->mutex);
+		phasemeter->gnss_pps_timestamp = ts->timestamp;
+		phasemeter->gnss_pps_count++;
+		pthread_mutex_unlock(&phasemeter->mutex);
+	}
+}
+
 /**
  * @brief Phasemeter thread routine
  *
@@ -139,21 +162,11 @@ static void* phasemeter_thread(void *p_data)
 	}
 
 	/* Get first timestamp */
-	do {
-		ts1.index = read_extts(phasemeter->fd, &ts1.timestamp);
-		if (ts1.index < 0) {
-			log_warn("Could not read ptp clock external timestamp for phasemeter");
-		}
-	} while (ts1.index != EXTTS_INDEX_ART_INTERNAL_PPS && ts1.index != EXTTS_INDEX_GNSS_PPS);
+	phasemeter_read_timestamp(phasemeter, &ts1);
 
 	while(!stop) {
 		/* Get Second timestamp */
-		do {
-			ts2.index = read_extts(phasemeter->fd, &ts2.timestamp);
-			if (ts2.index < 0) {
-				log_warn("Could not read ptp clock external timestamp for phasemeter");
-			}
-		} while (ts2.index != EXTTS_INDEX_ART_INTERNAL_PPS && ts2.index != EXTTS_INDEX_GNSS_PPS);
+		phasemeter_read_timestamp(phasemeter, &ts2);
 		log_debug("Phasemeter: %s, ts %" PRIi64 , (ts1.index == EXTTS_INDEX_GNSS_PPS)? "GNSS" : "INT ", ts1.timestamp);
 		log_debug("Phasemeter: %s, ts %" PRIi64 , (ts2.index == EXTTS_INDEX_GNSS_PPS)? "GNSS" : "INT ", ts2.timestamp);
 
@@ -208,12 +221,7 @@ static void* phasemeter_thread(void *p_data)
 			pthread_cond_signal(&phasemeter->cond);
 			pthread_mutex_unlock(&phasemeter->mutex);
 			/* Get first timestamp */
-			do {
-				ts1.index = read_extts(phasemeter->fd, &ts1.timestamp);
-				if (ts1.index < 0) {
-					log_warn("Could not read ptp clock external timestamp for phasemeter");
-				}
-			} while (ts1.index != EXTTS_INDEX_ART_INTERNAL_PPS && ts1.index != EXTTS_INDEX_GNSS_PPS);
+			phasemeter_read_timestamp(phasemeter, &ts1);
 		}
 	}
 
@@ -247,6 +255,8 @@ struct phasemeter* phasemeter_init(int fd)
 	phasemeter->fd = fd;
 	phasemeter->stop = false;
 	phasemeter->status = PHASEMETER_INIT;
+	phasemeter->gnss_pps_timestamp = 0;
+	phasemeter->gnss_pps_count = 0;
 
 	if (pthread_mutex_init(&phasemeter->mutex, NULL) != 0) {
 		printf("\n mutex init failed\n");
@@ -310,3 +320,22 @@ int get_phase_error(struct phasemeter *phasemeter, int64_t *phase_error)
 	
 	return status;
 }
+
+/**
+ * @brief Get PHC timestamp of the last GNSS PPS, without waiting
+ *
+ * @param phasemeter thread structure data
+ * @param timestamp pointer where timestamp in ns will be stored
+ * @return uint64_t number of GNSS PPS received so far, 0 if none
+ */
+uint64_t phasemeter_get_gnss_pps(struct phasemeter *phasemeter, int64_t *timestamp)
+{
+	uint64_t count;
+
+	pthread_mutex_lock(&phasemeter->mutex);
+	*timestamp = phasemeter->gnss_pps_timestamp;
+	count = phasemeter->gnss_pps_count;
+	pthread_mutex_unlock(&phasemeter->mutex);
+
+	return count;
+}
@@ -26,6 +26,10 @@ struct phasemeter {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	int32_t phase_error;
+	/** PHC time of the last GNSS PPS, in ns */
+	int64_t gnss_pps_timestamp;
+	/** Number of GNSS PPS received */
+	uint64_t gnss_pps_count;
 	int status;
 	int fd;
 	bool stop;
@@ -34,5 +38,6 @@ struct phasemeter {
 struct phasemeter* phasemeter_init(int fd);
 void phasemeter_stop(struct phasemeter *phasemeter);
 int get_phase_error(struct phasemeter *phasemeter, int64_t *phase_error);
+uint64_t phasemeter_get_gnss_pps(struct phasemeter *phasemeter, int64_t *timestamp);
 
 #endif /* OSCILLATORD_PHASEMETER_H */
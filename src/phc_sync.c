@@ -0,0 +1,339 @@
+/**
+ * @file phc_sync.c
+ * @brief Synchronization of secondary PHCs to the disciplined PHC
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/ptp_clock.h>
+
+#include "clock_servo.h"
+#include "gnss.h"
+#include "log.h"
+#include "phc_sync.h"
+#include "utils.h"
+
+#define PHC_SYNC_DEFAULT_SAMPLES 5
+/* Targets are measured this long after each PHC second, away from the PPS */
+#define PHC_SYNC_PHASE_NS 500000000L
+/* Locked targets further than this are stepped again, in ns */
+#define PHC_SYNC_STEP_THRESHOLD_NS 1000000
+/* Used when the driver does not report its maximum adjustment, in ppb */
+#define PHC_SYNC_DEFAULT_MAX_PPB 500000
+/* Number of samples between two statistics reports */
+#define PHC_SYNC_STATS_PERIOD 16
+
+struct phc_target {
+	int fd;
+	clockid_t clkid;
+	enum phc_offset_method method;
+	struct clock_servo servo;
+	int stats_count;
+	double offset_sum_sq;
+};
+
+struct phc_sync {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	bool stop;
+	int fd_clock;
+	enum phc_offset_method method;
+	int nb_samples;
+	int nb_targets;
+	struct phc_target targets[PHC_SYNC_MAX_TARGETS];
+	/** Published for monitoring, if not NULL */
+	struct snapshot *info;
+	struct phc_sync_state state;
+};
+
+/**
+ * @brief Interpolate offset of timecard's PHC at a given system time
+ *
+ * @param before measure taken before the targets
+ * @param after measure taken after the targets
+ * @param sys_time system time, in ns
+ * @return int64_t PHC minus system time, in ns
+ */
+static int64_t phc_sync_ref_offset(const struct phc_offset *before, const struct phc_offset *after, int64_t sys_time)
+{
+	int64_t span = after->sys_time - before->sys_time;
+
+	if (span <= 0)
+		return before->offset;
+	return before->offset + (int64_t) ((double) (after->offset - before->offset) *
+		(sys_time - before->sys_time) / span);
+}
+
+static void phc_sync_update_stats(struct phc_target *target, struct phc_target_state *state, int64_t offset)
+{
+	target->offset_sum_sq += (double) offset * offset;
+	if (++target->stats_count < PHC_SYNC_STATS_PERIOD)
+		return;
+
+	state->offset_rms = (int64_t) sqrt(target->offset_sum_sq / target->stats_count);
+	log_info("%s: offset rms %" PRIi64 " ns, freq %+.0f ppb",
+		state->path, state->offset_rms, state->freq);
+	target->stats_count = 0;
+	target->offset_sum_sq = 0;
+}
+
+/**
+ * @brief Steer a target from its offset to timecard's PHC
+ *
+ * @param target
+ * @param state
+ * @param offset target minus timecard's PHC, in ns
+ */
+static void phc_sync_steer(struct phc_target *target, struct phc_target_state *state, int64_t offset)
+{
+	enum clock_servo_state servo_state;
+	double ppb;
+	int ret;
+
+	if (target->servo.state == CLOCK_SERVO_LOCKED && llabs(offset) > PHC_SYNC_STEP_THRESHOLD_NS) {
+		log_warn("%s: offset %" PRIi64 " ns, stepping again", state->path, offset);
+		target->servo.state = CLOCK_SERVO_UNLOCKED;
+	}
+
+	ppb = clock_servo_sample(&target->servo, offset, &servo_state);
+	if (servo_state == CLOCK_SERVO_JUMP) {
+		log_info("%s: stepping by %" PRIi64 " ns", state->path, -offset);
+		ret = clock_step(target->clkid, -offset);
+		if (ret != 0)
+			log_error("%s: could not step clock: %s", state->path, strerror(-ret));
+	}
+	ret = clock_set_frequency(target->clkid, ppb);
+	if (ret != 0)
+		log_error("%s: could not adjust frequency: %s", state->path, strerror(-ret));
+	log_debug("%s: offset %" PRIi64 " ns, freq %+.0f ppb", state->path, offset, ppb);
+
+	state->state = servo_state;
+	state->offset = offset;
+	state->freq = ppb;
+	if (servo_state == CLOCK_SERVO_LOCKED)
+		phc_sync_update_stats(target, state, offset);
+}
+
+/**
+ * @brief Measure all targets in one pass and steer them
+ *
+ * Timecard's PHC is read before and after the targets, and its offset to the
+ * system clock is interpolated at each target's read, so the system clock's
+ * own drift cancels out.
+ *
+ * @param phc_sync
+ */
+static void phc_sync_iterate(struct phc_sync *phc_sync)
+{
+	struct phc_offset measures[PHC_SYNC_MAX_TARGETS];
+	struct phc_offset before, after;
+	bool valid[PHC_SYNC_MAX_TARGETS];
+	int ret;
+	int i;
+
+	ret = phc_offset_measure(phc_sync->fd_clock, phc_sync->method, phc_sync->nb_samples, &before);
+	if (ret != 0) {
+		log_warn("Could not measure PHC to system clock offset: %s", strerror(-ret));
+		return;
+	}
+	for (i = 0; i < phc_sync->nb_targets; i++) {
+		struct phc_target *target = &phc_sync->targets[i];
+
+		ret = phc_offset_measure(target->fd, target->method, phc_sync->nb_samples, &measures[i]);
+		valid[i] = ret == 0;
+		if (!valid[i])
+			log_warn("%s: could not measure offset: %s",
+				phc_sync->state.targets[i].path, strerror(-ret));
+	}
+	ret = phc_offset_measure(phc_sync->fd_clock, phc_sync->method, phc_sync->nb_samples, &after);
+	if (ret != 0)
+		after = before;
+
+	for (i = 0; i < phc_sync->nb_targets; i++) {
+		int64_t ref_offset;
+
+		if (!valid[i])
+			continue;
+		ref_offset = phc_sync_ref_offset(&before, &after, measures[i].sys_time);
+		phc_sync_steer(&phc_sync->targets[i], &phc_sync->state.targets[i],
+			measures[i].offset - ref_offset);
+	}
+	if (phc_sync->info != NULL)
+		snapshot_publish(phc_sync->info, &phc_sync->state);
+}
+
+/**
+ * @brief Sleep until PHC_SYNC_PHASE_NS after next second of timecard's PHC
+ *
+ * @param phc_sync
+ */
+static void phc_sync_wait(struct phc_sync *phc_sync)
+{
+	struct timespec now;
+	struct timespec delay;
+	long ns;
+
+	if (clock_gettime(FD_TO_CLOCKID(phc_sync->fd_clock), &now) != 0) {
+		sleep(1);
+		return;
+	}
+	ns = PHC_SYNC_PHASE_NS - now.tv_nsec;
+	if (ns <= 0)
+		ns += NS_IN_SECOND;
+	delay.tv_sec = ns / NS_IN_SECOND;
+	delay.tv_nsec = ns % NS_IN_SECOND;
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, NULL);
+}
+
+static void *phc_sync_thread(void *p_data)
+{
+	struct phc_sync *phc_sync = p_data;
+	bool stop = false;
+
+	while (!stop) {
+		phc_sync_wait(phc_sync);
+
+		pthread_mutex_lock(&phc_sync->mutex);
+		stop = phc_sync->stop;
+		pthread_mutex_unlock(&phc_sync->mutex);
+		if (!stop)
+			phc_sync_iterate(phc_sync);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Open a target PHC and initialize its servo
+ *
+ * @param phc_sync
+ * @param path device path of the target
+ * @return 0 on success, -errno on error
+ */
+static int phc_sync_add_target(struct phc_sync *phc_sync, const char *path)
+{
+	struct phc_target *target = &phc_sync->targets[phc_sync->nb_targets];
+	struct phc_target_state *state = &phc_sync->state.targets[phc_sync->nb_targets];
+	struct ptp_clock_caps caps;
+	double max_ppb = PHC_SYNC_DEFAULT_MAX_PPB;
+	double ppb = 0;
+	int ret;
+
+	if (phc_sync->nb_targets >= PHC_SYNC_MAX_TARGETS) {
+		log_error("Too many PHC targets, %s ignored", path);
+		return -ENOSPC;
+	}
+	target->fd = open(path, O_RDWR);
+	if (target->fd < 0) {
+		ret = -errno;
+		log_error("Could not open PHC target %s: %s", path, strerror(-ret));
+		return ret;
+	}
+	target->clkid = FD_TO_CLOCKID(target->fd);
+	target->method = phc_offset_probe(target->fd);
+	memset(&caps, 0, sizeof(caps));
+	if (ioctl(target->fd, PTP_CLOCK_GETCAPS, &caps) == 0 && caps.max_adj > 0)
+		max_ppb = caps.max_adj;
+	if (clock_get_frequency(target->clkid, &ppb) != 0)
+		ppb = 0;
+	clock_servo_init(&target->servo, ppb, max_ppb);
+
+	snprintf(state->path, sizeof(state->path), "%s", path);
+	state->offset_rms = -1;
+	phc_sync->nb_targets++;
+	phc_sync->state.nb_targets = phc_sync->nb_targets;
+	log_info("%s follows the timecard's PHC", path);
+	return 0;
+}
+
+static void phc_sync_close_targets(struct phc_sync *phc_sync)
+{
+	for (int i = 0; i < phc_sync->nb_targets; i++)
+		close(phc_sync->targets[i].fd);
+}
+
+/**
+ * @brief Start secondary PHCs synchronization if targets are configured
+ *
+ * @param config
+ * @param fd_clock timecard's PHC file descriptor
+ * @param info published state for monitoring, can be NULL
+ * @return struct phc_sync*, NULL if disabled or on error
+ */
+struct phc_sync *phc_sync_new(const struct config *config, int fd_clock, struct snapshot *info)
+{
+	const char *value = config_get(config, "phc-targets");
+	struct phc_sync *phc_sync;
+	char *targets, *path, *saveptr;
+	long nb_samples;
+	int ret;
+
+	if (value == NULL || *value == '\0')
+		return NULL;
+	if (fd_clock < 0) {
+		log_error("phc-targets needs the PTP clock");
+		return NULL;
+	}
+
+	phc_sync = calloc(1, sizeof(*phc_sync));
+	targets = strdup(value);
+	if (phc_sync == NULL || targets == NULL) {
+		log_error("Could not allocate PHC targets synchronization");
+		free(phc_sync);
+		free(targets);
+		return NULL;
+	}
+	for (path = strtok_r(targets, ", ", &saveptr); path != NULL; path = strtok_r(NULL, ", ", &saveptr))
+		phc_sync_add_target(phc_sync, path);
+	free(targets);
+	if (phc_sync->nb_targets == 0) {
+		free(phc_sync);
+		return NULL;
+	}
+
+	nb_samples = config_get_unsigned_number(config, "phc-targets-samples");
+	phc_sync->nb_samples = nb_samples > 0 ? nb_samples : PHC_SYNC_DEFAULT_SAMPLES;
+	phc_sync->fd_clock = fd_clock;
+	phc_sync->method = phc_offset_probe(fd_clock);
+	phc_sync->info = info;
+	pthread_mutex_init(&phc_sync->mutex, NULL);
+
+	ret = pthread_create(&phc_sync->thread, NULL, phc_sync_thread, phc_sync);
+	if (ret != 0) {
+		log_error("Could not create PHC targets synchronization thread");
+		pthread_mutex_destroy(&phc_sync->mutex);
+		phc_sync_close_targets(phc_sync);
+		free(phc_sync);
+		return NULL;
+	}
+	return phc_sync;
+}
+
+/**
+ * @brief Stop secondary PHCs synchronization
+ *
+ * @param phc_sync
+ */
+void phc_sync_stop(struct phc_sync *phc_sync)
+{
+	if (phc_sync == NULL)
+		return;
+	pthread_mutex_lock(&phc_sync->mutex);
+	phc_sync->stop = true;
+	pthread_mutex_unlock(&phc_sync->mutex);
+	pthread_join(phc_sync->thread, NULL);
+	pthread_mutex_destroy(&phc_sync->mutex);
+	phc_sync_close_targets(phc_sync);
+	free(phc_sync);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file phc_sync.h
+ * @brief Synchronization of secondary PHCs to the disciplined PHC
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * PHCs of other network cards follow the timecard's PHC. A single thread,
+ * woken at a fixed point of each PHC second, measures every target against
+ * the system clock in the same pass as the timecard's PHC and steers each
+ * of them with its own PI servo.
+ */
+#ifndef OSCILLATORD_PHC_SYNC_H
+#define OSCILLATORD_PHC_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "snapshot.h"
+
+#define PHC_SYNC_MAX_TARGETS 8
+
+/**
+ * @struct phc_target_state
+ * @brief State of a secondary PHC synchronization, for monitoring
+ */
+struct phc_target_state {
+	/** Device path of the target, truncated */
+	char path[64];
+	/** enum clock_servo_state */
+	int state;
+	/** Last offset of the target to the timecard's PHC, in ns */
+	int64_t offset;
+	/** Frequency adjustment of the target, in ppb */
+	double freq;
+	/** RMS offset of the last period, in ns, -1 if unknown */
+	int64_t offset_rms;
+};
+
+/**
+ * @struct phc_sync_state
+ * @brief State of all secondary PHCs synchronizations, for monitoring
+ */
+struct phc_sync_state {
+	int nb_targets;
+	struct phc_target_state targets[PHC_SYNC_MAX_TARGETS];
+};
+
+struct phc_sync;
+
+struct phc_sync *phc_sync_new(const struct config *config, int fd_clock, struct snapshot *info);
+void phc_sync_stop(struct phc_sync *phc_sync);
+
+#endif /* OSCILLATORD_PHC_SYNC_H */
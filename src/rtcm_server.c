@@ -0,0 +1,448 @@
+/**
+ * @file rtcm_server.c
+ * @brief Distribution of RTCM3 frames to several local subscribers
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Subscribers connect to a Unix domain socket. The server mutex protects the
+ * subscribers' buffers and counters, it is never held while blocking: frames
+ * are only copied by the publisher and sockets are written in non-blocking
+ * mode by the event loop.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "rtcm_server.h"
+
+/** epoll tags of the listening socket and of the wake up event */
+#define RTCM_TAG_LISTEN UINT64_MAX
+#define RTCM_TAG_EVENT (UINT64_MAX - 1)
+
+/** Largest RTCM3 frame: 3 bytes header, 1023 bytes payload, 3 bytes CRC */
+#define RTCM_MAX_FRAME_SIZE 1029
+
+/** Dropped frames are logged once every RTCM_DROP_LOG_PERIOD drops */
+#define RTCM_DROP_LOG_PERIOD 100
+
+struct rtcm_client {
+	/** Socket of the subscriber, -1 if slot is unused */
+	int fd;
+	bool want_write;
+	/** Ring buffer, head and tail are free running byte counters */
+	uint8_t *buf;
+	size_t head;
+	size_t tail;
+	struct rtcm_client_stats stats;
+};
+
+struct rtcm_server {
+	char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+	int listen_fd;
+	int event_fd;
+	int epoll_fd;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	bool stop;
+	int max_clients;
+	size_t buffer_size;
+	int next_id;
+	uint64_t frames_received;
+	uint64_t bytes_received;
+	struct rtcm_client clients[RTCM_MAX_CLIENTS];
+};
+
+static void rtcm_client_close(struct rtcm_server *server, struct rtcm_client *client)
+{
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	client->fd = -1;
+	client->head = 0;
+	client->tail = 0;
+	client->want_write = false;
+}
+
+static void rtcm_client_set_want_write(struct rtcm_server *server, struct rtcm_client *client, bool want_write)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN | EPOLLRDHUP,
+		.data.u64 = client - server->clients,
+	};
+
+	if (client->want_write == want_write)
+		return;
+	if (want_write)
+		event.events |= EPOLLOUT;
+	if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event) < 0)
+		log_warn("RTCM: Could not update events of client %d: %s", client->stats.id, strerror(errno));
+	else
+		client->want_write = want_write;
+}
+
+/**
+ * @brief Write as much buffered data as the subscriber's socket accepts
+ *
+ * Must be called with server mutex locked.
+ */
+static void rtcm_client_flush(struct rtcm_server *server, struct rtcm_client *client)
+{
+	while (client->head != client->tail) {
+		size_t offset = client->tail % server->buffer_size;
+		size_t len = client->head - client->tail;
+		ssize_t ret;
+
+		if (len > server->buffer_size - offset)
+			len = server->buffer_size - offset;
+		ret = send(client->fd, client->buf + offset, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			log_info("RTCM: Client %d disconnected: %s", client->stats.id, strerror(errno));
+			rtcm_client_close(server, client);
+			return;
+		}
+		client->tail += ret;
+		client->stats.bytes_sent += ret;
+	}
+	rtcm_client_set_want_write(server, client, client->head != client->tail);
+}
+
+/**
+ * @brief Accept a new subscriber
+ *
+ * Must be called with server mutex locked.
+ */
+static void rtcm_server_accept(struct rtcm_server *server)
+{
+	struct rtcm_client *client = NULL;
+	struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP };
+	int fd;
+
+	fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			log_warn("RTCM: accept failed: %s", strerror(errno));
+		return;
+	}
+
+	for (int i = 0; i < server->max_clients; i++) {
+		if (server->clients[i].fd < 0) {
+			client = &server->clients[i];
+			break;
+		}
+	}
+	if (client == NULL) {
+		log_warn("RTCM: Already serving %d clients, rejecting connection", server->max_clients);
+		close(fd);
+		return;
+	}
+
+	if (client->buf == NULL) {
+		client->buf = malloc(server->buffer_size);
+		if (client->buf == NULL) {
+			log_error("RTCM: Could not allocate client buffer");
+			close(fd);
+			return;
+		}
+	}
+
+	event.data.u64 = client - server->clients;
+	if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		log_error("RTCM: Could not watch client socket: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+
+	client->fd = fd;
+	client->head = 0;
+	client->tail = 0;
+	client->want_write = false;
+	memset(&client->stats, 0, sizeof(client->stats));
+	client->stats.id = server->next_id++;
+	log_info("RTCM: Client %d connected", client->stats.id);
+}
+
+/**
+ * @brief Handle readability of a subscriber socket, which only means it hung up
+ * or sent data we do not expect and discard
+ *
+ * Must be called with server mutex locked.
+ */
+static void rtcm_client_read(struct rtcm_server *server, struct rtcm_client *client)
+{
+	uint8_t buf[256];
+	ssize_t ret = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		log_info("RTCM: Client %d disconnected", client->stats.id);
+		rtcm_client_close(server, client);
+	}
+}
+
+static void *rtcm_server_thread(void *p_data)
+{
+	struct rtcm_server *server = p_data;
+	struct epoll_event events[RTCM_MAX_CLIENTS + 2];
+
+	for (;;) {
+		int nready = epoll_wait(server->epoll_fd, events, RTCM_MAX_CLIENTS + 2, -1);
+		if (nready < 0) {
+			if (errno == EINTR)
+				continue;
+			log_error("RTCM: epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&server->mutex);
+		if (server->stop) {
+			pthread_mutex_unlock(&server->mutex);
+			break;
+		}
+
+		for (int i = 0; i < nready; i++) {
+			uint64_t tag = events[i].data.u64;
+
+			if (tag == RTCM_TAG_LISTEN) {
+				rtcm_server_accept(server);
+			} else if (tag == RTCM_TAG_EVENT) {
+				uint64_t count;
+
+				if (read(server->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+					log_warn("RTCM: Could not read wake up event: %s", strerror(errno));
+				for (int j = 0; j < server->max_clients; j++) {
+					struct rtcm_client *client = &server->clients[j];
+					if (client->fd >= 0 && client->head != client->tail)
+						rtcm_client_flush(server, client);
+				}
+			} else if (tag < RTCM_MAX_CLIENTS) {
+				struct rtcm_client *client = &server->clients[tag];
+
+				if (client->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+					rtcm_client_read(server, client);
+				if (client->fd >= 0 && (events[i].events & EPOLLOUT))
+					rtcm_client_flush(server, client);
+			}
+		}
+		pthread_mutex_unlock(&server->mutex);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Publish an RTCM3 frame to all subscribers. Never blocks on I/O
+ *
+ * A subscriber whose buffer cannot hold the whole frame does not get it.
+ *
+ * @param server
+ * @param frame
+ * @param size
+ */
+void rtcm_server_publish(struct rtcm_server *server, const uint8_t *frame, size_t size)
+{
+	const uint64_t one = 1;
+	bool wakeup = false;
+
+	pthread_mutex_lock(&server->mutex);
+	server->frames_received++;
+	server->bytes_received += size;
+	for (int i = 0; i < server->max_clients; i++) {
+		struct rtcm_client *client = &server->clients[i];
+		size_t offset;
+		size_t len;
+
+		if (client->fd < 0)
+			continue;
+		if (size > server->buffer_size - (client->head - client->tail)) {
+			if (client->stats.frames_dropped++ % RTCM_DROP_LOG_PERIOD == 0)
+				log_warn("RTCM: Client %d too slow, %" PRIu64 " frames dropped",
+					client->stats.id, client->stats.frames_dropped);
+			continue;
+		}
+
+		offset = client->head % server->buffer_size;
+		len = server->buffer_size - offset;
+		if (len > size)
+			len = size;
+		memcpy(client->buf + offset, frame, len);
+		memcpy(client->buf, frame + len, size - len);
+		client->head += size;
+		client->stats.frames_queued++;
+		wakeup = true;
+	}
+	pthread_mutex_unlock(&server->mutex);
+
+	if (wakeup && write(server->event_fd, &one, sizeof(one)) < 0)
+		log_warn("RTCM: Could not wake up server: %s", strerror(errno));
+}
+
+/**
+ * @brief Get counters of the server and of its subscribers
+ *
+ * @param server
+ * @param stats
+ */
+void rtcm_server_get_stats(struct rtcm_server *server, struct rtcm_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->enabled = true;
+
+	pthread_mutex_lock(&server->mutex);
+	stats->frames_received = server->frames_received;
+	stats->bytes_received = server->bytes_received;
+	for (int i = 0; i < server->max_clients; i++) {
+		struct rtcm_client *client = &server->clients[i];
+
+		if (client->fd < 0)
+			continue;
+		stats->clients[stats->nb_clients] = client->stats;
+		stats->clients[stats->nb_clients].queued = client->head - client->tail;
+		stats->nb_clients++;
+	}
+	pthread_mutex_unlock(&server->mutex);
+}
+
+static int rtcm_server_watch(struct rtcm_server *server, int fd, uint64_t tag)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.u64 = tag,
+	};
+
+	return epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * @brief Create RTCM server listening on a Unix domain socket
+ *
+ * @param path path of the socket
+ * @param max_clients maximum number of subscribers, up to RTCM_MAX_CLIENTS
+ * @param buffer_size size of the buffer of each subscriber
+ * @return struct rtcm_server*, NULL on error
+ */
+struct rtcm_server *rtcm_server_new(const char *path, int max_clients, size_t buffer_size)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct rtcm_server *server;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_error("RTCM: Socket path %s too long", path);
+		return NULL;
+	}
+	if (max_clients < 1 || max_clients > RTCM_MAX_CLIENTS) {
+		log_warn("RTCM: Invalid number of clients %d, using %d", max_clients, RTCM_MAX_CLIENTS);
+		max_clients = RTCM_MAX_CLIENTS;
+	}
+	if (buffer_size < RTCM_MAX_FRAME_SIZE) {
+		log_warn("RTCM: Client buffer size %zu too small, using %d", buffer_size, RTCM_MAX_FRAME_SIZE);
+		buffer_size = RTCM_MAX_FRAME_SIZE;
+	}
+
+	server = calloc(1, sizeof(*server));
+	if (server == NULL) {
+		log_error("RTCM: Could not allocate server");
+		return NULL;
+	}
+	strcpy(server->path, path);
+	strcpy(addr.sun_path, path);
+	server->max_clients = max_clients;
+	server->buffer_size = buffer_size;
+	server->next_id = 1;
+	server->listen_fd = -1;
+	server->event_fd = -1;
+	server->epoll_fd = -1;
+	for (int i = 0; i < RTCM_MAX_CLIENTS; i++)
+		server->clients[i].fd = -1;
+	pthread_mutex_init(&server->mutex, NULL);
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->listen_fd < 0) {
+		log_warn("RTCM: Socket create failed: %s", strerror(errno));
+		goto err;
+	}
+
+	unlink(path);
+	if (bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		log_warn("RTCM: Socket bind failed: %s", strerror(errno));
+		goto err;
+	}
+	if (listen(server->listen_fd, max_clients) < 0) {
+		log_warn("RTCM: Socket listen failed: %s", strerror(errno));
+		goto err_unlink;
+	}
+
+	server->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server->event_fd < 0 || server->epoll_fd < 0 ||
+	    rtcm_server_watch(server, server->listen_fd, RTCM_TAG_LISTEN) < 0 ||
+	    rtcm_server_watch(server, server->event_fd, RTCM_TAG_EVENT) < 0) {
+		log_error("RTCM: Could not set up event loop: %s", strerror(errno));
+		goto err_unlink;
+	}
+
+	if (pthread_create(&server->thread, NULL, rtcm_server_thread, server) != 0) {
+		log_error("RTCM: Could not create server thread");
+		goto err_unlink;
+	}
+
+	log_info("RTCM: Socket listening at %s, up to %d clients with %zu bytes buffers",
+		path, max_clients, buffer_size);
+	return server;
+
+err_unlink:
+	unlink(path);
+err:
+	if (server->epoll_fd >= 0)
+		close(server->epoll_fd);
+	if (server->event_fd >= 0)
+		close(server->event_fd);
+	if (server->listen_fd >= 0)
+		close(server->listen_fd);
+	pthread_mutex_destroy(&server->mutex);
+	free(server);
+	return NULL;
+}
+
+/**
+ * @brief Stop RTCM server and disconnect its subscribers
+ *
+ * @param server
+ */
+void rtcm_server_destroy(struct rtcm_server *server)
+{
+	const uint64_t one = 1;
+
+	if (server == NULL)
+		return;
+
+	pthread_mutex_lock(&server->mutex);
+	server->stop = true;
+	pthread_mutex_unlock(&server->mutex);
+	if (write(server->event_fd, &one, sizeof(one)) < 0)
+		log_warn("RTCM: Could not wake up server: %s", strerror(errno));
+	pthread_join(server->thread, NULL);
+
+	for (int i = 0; i < RTCM_MAX_CLIENTS; i++) {
+		if (server->clients[i].fd >= 0)
+			rtcm_client_close(server, &server->clients[i]);
+		free(server->clients[i].buf);
+	}
+	close(server->epoll_fd);
+	close(server->event_fd);
+	close(server->listen_fd);
+	unlink(server->path);
+	pthread_mutex_destroy(&server->mutex);
+	free(server);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file rtcm_server.h
+ * @brief Distribution of RTCM3 frames to several local subscribers
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Frames published by the GNSS thread are copied into a bounded ring buffer
+ * per subscriber and written to the subscribers' sockets by a dedicated
+ * event loop using non-blocking I/O, so a slow subscriber can never stall
+ * the GNSS parser. When a subscriber's buffer is full, whole frames are
+ * dropped for this subscriber only.
+ */
+#ifndef OSCILLATORD_RTCM_SERVER_H
+#define OSCILLATORD_RTCM_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Maximum number of subscribers served at the same time */
+#define RTCM_MAX_CLIENTS 8
+
+/**
+ * @struct rtcm_client_stats
+ * @brief Counters of a subscriber
+ */
+struct rtcm_client_stats {
+	/** Identifier of the subscriber, increasing with each connection */
+	int id;
+	/** Frames accepted in the subscriber's buffer */
+	uint64_t frames_queued;
+	uint64_t bytes_sent;
+	uint64_t frames_dropped;
+	/** Bytes waiting in the subscriber's buffer */
+	size_t queued;
+};
+
+/**
+ * @struct rtcm_stats
+ * @brief Counters of the RTCM server
+ */
+struct rtcm_stats {
+	bool enabled;
+	uint64_t frames_received;
+	uint64_t bytes_received;
+	int nb_clients;
+	struct rtcm_client_stats clients[RTCM_MAX_CLIENTS];
+};
+
+struct rtcm_server;
+
+struct rtcm_server *rtcm_server_new(const char *path, int max_clients, size_t buffer_size);
+void rtcm_server_publish(struct rtcm_server *server, const uint8_t *frame, size_t size);
+void rtcm_server_get_stats(struct rtcm_server *server, struct rtcm_stats *stats);
+void rtcm_server_destroy(struct rtcm_server *server);
+
+#endif /* OSCILLATORD_RTCM_SERVER_H */
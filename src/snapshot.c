@@ -0,0 +1,93 @@
+/**
+ * @file snapshot.c
+ * @brief Lock-free publication of a state from one writer to many readers
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+/**
+ * @brief Allocate both slots of a snapshot and publish initial value
+ *
+ * @param snapshot snapshot to initialize
+ * @param size size of the published state
+ * @param initial initial state, readers get it until first publication
+ * @return 0 on success, -ENOMEM on allocation failure
+ */
+int snapshot_init(struct snapshot *snapshot, size_t size, const void *initial)
+{
+	snapshot->slots = calloc(2, size);
+	if (snapshot->slots == NULL)
+		return -ENOMEM;
+	snapshot->size = size;
+	memcpy(snapshot->slots, initial, size);
+	atomic_init(&snapshot->seq, 0);
+	atomic_init(&snapshot->slot_seq[0], 0);
+	atomic_init(&snapshot->slot_seq[1], 0);
+	return 0;
+}
+
+/**
+ * @brief Free snapshot's slots
+ *
+ * @param snapshot
+ */
+void snapshot_destroy(struct snapshot *snapshot)
+{
+	free(snapshot->slots);
+	snapshot->slots = NULL;
+}
+
+/**
+ * @brief Publish a new state. Must only be called from a single writer thread
+ *
+ * Never blocks, whatever readers are doing.
+ *
+ * @param snapshot
+ * @param data new state, snapshot->size bytes are copied
+ */
+void snapshot_publish(struct snapshot *snapshot, const void *data)
+{
+	unsigned long seq = atomic_load_explicit(&snapshot->seq, memory_order_relaxed);
+	atomic_ulong *slot_seq = &snapshot->slot_seq[(seq + 1) & 1];
+	unsigned long version = atomic_load_explicit(slot_seq, memory_order_relaxed);
+
+	/* Odd version tells readers still copying this slot that it is being written */
+	atomic_store_explicit(slot_seq, version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(snapshot->slots + ((seq + 1) & 1) * snapshot->size, data, snapshot->size);
+	atomic_store_explicit(slot_seq, version + 2, memory_order_release);
+	atomic_store_explicit(&snapshot->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * @brief Copy latest published state
+ *
+ * @param snapshot
+ * @param data buffer of snapshot->size bytes receiving the state
+ * @return sequence number of the state copied, it increases with each publication
+ */
+unsigned long snapshot_read(struct snapshot *snapshot, void *data)
+{
+	unsigned long seq;
+	unsigned long version;
+	unsigned long check;
+	atomic_ulong *slot_seq;
+
+	do {
+		seq = atomic_load_explicit(&snapshot->seq, memory_order_acquire);
+		slot_seq = &snapshot->slot_seq[seq & 1];
+		version = atomic_load_explicit(slot_seq, memory_order_acquire);
+		memcpy(data, snapshot->slots + (seq & 1) * snapshot->size, snapshot->size);
+		atomic_thread_fence(memory_order_acquire);
+		check = atomic_load_explicit(slot_seq, memory_order_relaxed);
+		/* Copy is torn if the slot was being written before or during it */
+	} while ((version & 1) || check != version);
+
+	return seq;
+}
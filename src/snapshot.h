@@ -0,0 +1,38 @@
+/**
+ * @file snapshot.h
+ * @brief Lock-free publication of a state from one writer to many readers
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * The writer fills the slot readers are not using and then publishes it by
+ * bumping a sequence number, so it never waits for readers. Each slot also has
+ * its own sequence number, odd while the writer fills it: readers copy the
+ * latest published slot and retry unless that number was even and unchanged
+ * around the copy, in the unlikely case the writer reused the slot meanwhile.
+ */
+#ifndef OSCILLATORD_SNAPSHOT_H
+#define OSCILLATORD_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * @struct snapshot
+ * @brief Double buffered state, published by a single writer
+ */
+struct snapshot {
+	/** Number of publications, published slot is seq & 1 */
+	atomic_ulong seq;
+	/** Number of writes of each slot, odd while slot is being written */
+	atomic_ulong slot_seq[2];
+	size_t size;
+	unsigned char *slots;
+};
+
+int snapshot_init(struct snapshot *snapshot, size_t size, const void *initial);
+void snapshot_destroy(struct snapshot *snapshot);
+void snapshot_publish(struct snapshot *snapshot, const void *data);
+unsigned long snapshot_read(struct snapshot *snapshot, void *data);
+
+#endif /* OSCILLATORD_SNAPSHOT_H */
@@ -0,0 +1,106 @@
+/**
+ * @file survey_cache.c
+ * @brief Persistence of the antenna position found by survey-in
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "survey_cache.h"
+
+static int survey_cache_get(const struct config *cache, const char *key, int64_t min, int64_t max, int64_t *value)
+{
+	const char *string = config_get(cache, key);
+	char *end;
+
+	if (string == NULL)
+		return -ENOENT;
+
+	errno = 0;
+	*value = strtoll(string, &end, 10);
+	if (errno != 0 || end == string || *end != '\0' || *value < min || *value > max)
+		return -EINVAL;
+	return 0;
+}
+
+/**
+ * @brief Load antenna position saved after a survey-in
+ *
+ * @param path cache file
+ * @param position Output position
+ * @return 0 on success, -errno on error
+ */
+int survey_cache_load(const char *path, struct survey_position *position)
+{
+	struct config cache;
+	int64_t x, y, z, accuracy;
+	int ret;
+
+	ret = config_init(&cache, path);
+	if (ret != 0) {
+		config_cleanup(&cache);
+		return ret;
+	}
+
+	ret = survey_cache_get(&cache, "ecef-x", INT32_MIN, INT32_MAX, &x);
+	if (ret == 0)
+		ret = survey_cache_get(&cache, "ecef-y", INT32_MIN, INT32_MAX, &y);
+	if (ret == 0)
+		ret = survey_cache_get(&cache, "ecef-z", INT32_MIN, INT32_MAX, &z);
+	if (ret == 0)
+		ret = survey_cache_get(&cache, "accuracy", 0, UINT32_MAX, &accuracy);
+	config_cleanup(&cache);
+	if (ret != 0) {
+		log_warn("Invalid survey-in cache %s", path);
+		return ret;
+	}
+
+	position->ecef_x = x;
+	position->ecef_y = y;
+	position->ecef_z = z;
+	position->accuracy = accuracy;
+	return 0;
+}
+
+/**
+ * @brief Save antenna position found by a survey-in
+ *
+ * @param path cache file
+ * @param position
+ * @return 0 on success, -errno on error
+ */
+int survey_cache_save(const char *path, const struct survey_position *position)
+{
+	struct config cache = {0};
+	char value[16];
+	int ret;
+
+	snprintf(value, sizeof(value), "%" PRId32, position->ecef_x);
+	ret = config_set(&cache, "ecef-x", value);
+	if (ret == 0) {
+		snprintf(value, sizeof(value), "%" PRId32, position->ecef_y);
+		ret = config_set(&cache, "ecef-y", value);
+	}
+	if (ret == 0) {
+		snprintf(value, sizeof(value), "%" PRId32, position->ecef_z);
+		ret = config_set(&cache, "ecef-z", value);
+	}
+	if (ret == 0) {
+		snprintf(value, sizeof(value), "%" PRIu32, position->accuracy);
+		ret = config_set(&cache, "accuracy", value);
+	}
+	if (ret == 0)
+		ret = config_save(&cache, path);
+	config_cleanup(&cache);
+
+	if (ret != 0)
+		log_warn("Could not save survey-in position to %s", path);
+	return ret;
+}
@@ -0,0 +1,31 @@
+/**
+ * @file survey_cache.h
+ * @brief Persistence of the antenna position found by survey-in
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Position is saved in a key=value file read with the config parser.
+ */
+#ifndef OSCILLATORD_SURVEY_CACHE_H
+#define OSCILLATORD_SURVEY_CACHE_H
+
+#include <stdint.h>
+
+/**
+ * @struct survey_position
+ * @brief Antenna position, in the units of UBX-TIM-SVIN and CFG-TMODE
+ */
+struct survey_position {
+	/** ECEF coordinates in cm */
+	int32_t ecef_x;
+	int32_t ecef_y;
+	int32_t ecef_z;
+	/** Position accuracy in 0.1 mm */
+	uint32_t accuracy;
+};
+
+int survey_cache_load(const char *path, struct survey_position *position);
+int survey_cache_save(const char *path, const struct survey_position *position);
+
+#endif /* OSCILLATORD_SURVEY_CACHE_H */
@@ -0,0 +1,236 @@
+/**
+ * @file sys_sync.c
+ * @brief Synchronization of the system clock to the disciplined PHC
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timex.h>
+#include <time.h>
+
+#include "clock_servo.h"
+#include "log.h"
+#include "sys_sync.h"
+#include "utils.h"
+
+#define SYS_SYNC_DEFAULT_SAMPLES 5
+/* Maximum frequency adjustment of CLOCK_REALTIME (ppb) */
+#define SYS_SYNC_MAX_PPB 500000
+/* Offset above which system clock is stepped again, as left by a leap second (ns) */
+#define SYS_SYNC_STEP_THRESHOLD_NS 1000000
+/* Number of samples between two statistics reports */
+#define SYS_SYNC_STATS_PERIOD 16
+/* TAI - GPS, PHC holds TAI time */
+#define GPS_TO_TAI_SECONDS 19
+
+struct sys_sync {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	bool stop;
+	int fd_clock;
+	int nb_samples;
+	enum phc_offset_method method;
+	struct gnss *gnss;
+	struct clock_servo servo;
+	/** Published for monitoring, if not NULL */
+	struct snapshot *info;
+	struct sys_sync_state state;
+	int stats_count;
+	double offset_sum_sq;
+	int64_t delay_max;
+};
+
+/**
+ * @brief Keep kernel's TAI offset in line with GNSS leap seconds
+ *
+ * @param utc_offset TAI - UTC in seconds
+ */
+static void sys_sync_set_tai_offset(int utc_offset)
+{
+	struct timex timex = { .modes = 0 };
+
+	if (adjtimex(&timex) < 0 || timex.tai == utc_offset)
+		return;
+	timex.modes = ADJ_TAI;
+	timex.constant = utc_offset;
+	if (adjtimex(&timex) < 0)
+		log_warn("Could not set kernel TAI offset: %s", strerror(errno));
+	else
+		log_info("Kernel TAI offset set to %d s", utc_offset);
+}
+
+static void sys_sync_update_stats(struct sys_sync *sys_sync, int64_t offset, int64_t delay)
+{
+	sys_sync->offset_sum_sq += (double) offset * offset;
+	if (delay > sys_sync->delay_max)
+		sys_sync->delay_max = delay;
+	if (++sys_sync->stats_count < SYS_SYNC_STATS_PERIOD)
+		return;
+
+	sys_sync->state.offset_rms = (int64_t) sqrt(sys_sync->offset_sum_sq / sys_sync->stats_count);
+	sys_sync->state.delay_max = sys_sync->delay_max;
+	log_info("System clock: offset rms %" PRIi64 " ns, max delay %" PRIi64 " ns, freq %+.0f ppb",
+		sys_sync->state.offset_rms, sys_sync->state.delay_max, sys_sync->state.freq);
+	sys_sync->stats_count = 0;
+	sys_sync->offset_sum_sq = 0;
+	sys_sync->delay_max = 0;
+}
+
+/**
+ * @brief Measure offset and steer system clock
+ *
+ * @param sys_sync
+ */
+static void sys_sync_iterate(struct sys_sync *sys_sync)
+{
+	enum clock_servo_state state;
+	struct phc_offset measure;
+	struct gnss_epoch epoch;
+	int64_t offset;
+	int utc_offset;
+	double ppb;
+	int ret;
+
+	/* PHC holds TAI time, system clock UTC. Leap seconds are read from the
+	 * latest published epoch, never from the session the gnss thread writes */
+	if (gnss_wait_epoch(sys_sync->gnss, 0, 0, &epoch) != 0 || !epoch.lsset)
+		return;
+	utc_offset = epoch.leap_seconds + GPS_TO_TAI_SECONDS;
+
+	ret = phc_offset_measure(sys_sync->fd_clock, sys_sync->method, sys_sync->nb_samples, &measure);
+	if (ret != 0) {
+		log_warn("Could not measure PHC to system clock offset: %s", strerror(-ret));
+		return;
+	}
+	sys_sync_set_tai_offset(utc_offset);
+	offset = (int64_t) utc_offset * NS_IN_SECOND - measure.offset;
+
+	/* Slewing it at SYS_SYNC_MAX_PPB would take long and wind up the servo */
+	if (sys_sync->servo.state == CLOCK_SERVO_LOCKED && llabs(offset) > SYS_SYNC_STEP_THRESHOLD_NS) {
+		log_warn("System clock: offset %" PRIi64 " ns, stepping again", offset);
+		sys_sync->servo.state = CLOCK_SERVO_UNLOCKED;
+	}
+	ppb = clock_servo_sample(&sys_sync->servo, offset, &state);
+	if (state == CLOCK_SERVO_JUMP) {
+		log_info("System clock: stepping by %" PRIi64 " ns", -offset);
+		ret = clock_step(CLOCK_REALTIME, -offset);
+		if (ret != 0)
+			log_error("Could not step system clock: %s", strerror(-ret));
+	}
+	ret = clock_set_frequency(CLOCK_REALTIME, ppb);
+	if (ret != 0)
+		log_error("Could not adjust system clock frequency: %s", strerror(-ret));
+	log_debug("System clock: offset %" PRIi64 " ns, delay %" PRIi64 " ns, freq %+.0f ppb",
+		offset, measure.delay, ppb);
+
+	sys_sync->state.state = state;
+	sys_sync->state.offset = offset;
+	sys_sync->state.delay = measure.delay;
+	sys_sync->state.freq = ppb;
+	if (state == CLOCK_SERVO_LOCKED)
+		sys_sync_update_stats(sys_sync, offset, measure.delay);
+	if (sys_sync->info != NULL)
+		snapshot_publish(sys_sync->info, &sys_sync->state);
+}
+
+static void *sys_sync_thread(void *p_data)
+{
+	struct sys_sync *sys_sync = p_data;
+	struct timespec next;
+	bool stop = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!stop) {
+		next.tv_sec++;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		pthread_mutex_lock(&sys_sync->mutex);
+		stop = sys_sync->stop;
+		pthread_mutex_unlock(&sys_sync->mutex);
+		if (!stop)
+			sys_sync_iterate(sys_sync);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Start system clock synchronization if enabled in configuration
+ *
+ * @param config
+ * @param fd_clock PHC file descriptor
+ * @param phc_set whether PHC time has been set from GNSS by oscillatord
+ * @param gnss providing leap seconds
+ * @param info published state for monitoring, can be NULL
+ * @return struct sys_sync*, NULL if disabled or on error
+ */
+struct sys_sync *sys_sync_new(const struct config *config, int fd_clock, bool phc_set, struct gnss *gnss, struct snapshot *info)
+{
+	struct sys_sync *sys_sync;
+	long nb_samples;
+	double ppb = 0;
+	int ret;
+
+	if (!config_get_bool_default(config, "phc2sys", false))
+		return NULL;
+	if (fd_clock < 0) {
+		log_error("phc2sys needs the PTP clock");
+		return NULL;
+	}
+	if (!phc_set) {
+		log_warn("phc2sys disabled: PHC time is only set in disciplining mode");
+		return NULL;
+	}
+
+	sys_sync = calloc(1, sizeof(*sys_sync));
+	if (sys_sync == NULL) {
+		log_error("Could not allocate system clock synchronization");
+		return NULL;
+	}
+	nb_samples = config_get_unsigned_number(config, "phc2sys-samples");
+	sys_sync->nb_samples = nb_samples > 0 ? nb_samples : SYS_SYNC_DEFAULT_SAMPLES;
+	sys_sync->fd_clock = fd_clock;
+	sys_sync->gnss = gnss;
+	sys_sync->info = info;
+	sys_sync->method = phc_offset_probe(fd_clock);
+	sys_sync->state.enabled = true;
+	sys_sync->state.precise = sys_sync->method == PHC_OFFSET_PRECISE;
+	sys_sync->state.offset_rms = -1;
+	sys_sync->state.delay_max = -1;
+
+	if (clock_get_frequency(CLOCK_REALTIME, &ppb) != 0)
+		ppb = 0;
+	clock_servo_init(&sys_sync->servo, ppb, SYS_SYNC_MAX_PPB);
+	pthread_mutex_init(&sys_sync->mutex, NULL);
+
+	ret = pthread_create(&sys_sync->thread, NULL, sys_sync_thread, sys_sync);
+	if (ret != 0) {
+		log_error("Could not create system clock synchronization thread");
+		pthread_mutex_destroy(&sys_sync->mutex);
+		free(sys_sync);
+		return NULL;
+	}
+	log_info("Synchronizing system clock to PHC");
+	return sys_sync;
+}
+
+/**
+ * @brief Stop system clock synchronization
+ *
+ * @param sys_sync
+ */
+void sys_sync_stop(struct sys_sync *sys_sync)
+{
+	if (sys_sync == NULL)
+		return;
+	pthread_mutex_lock(&sys_sync->mutex);
+	sys_sync->stop = true;
+	pthread_mutex_unlock(&sys_sync->mutex);
+	pthread_join(sys_sync->thread, NULL);
+	pthread_mutex_destroy(&sys_sync->mutex);
+	free(sys_sync);
+}
@@ -0,0 +1,48 @@
+/**
+ * @file sys_sync.h
+ * @brief Synchronization of the system clock to the disciplined PHC
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * A thread measures the offset of CLOCK_REALTIME to the PHC once per second
+ * and steers it with a PI servo, like phc2sys does, so that hosts without
+ * chrony get the PHC's time without going through the NTP SHM.
+ */
+#ifndef OSCILLATORD_SYS_SYNC_H
+#define OSCILLATORD_SYS_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "gnss.h"
+#include "snapshot.h"
+
+/**
+ * @struct sys_sync_state
+ * @brief State of the system clock synchronization, for monitoring
+ */
+struct sys_sync_state {
+	bool enabled;
+	/** Hardware cross timestamps are used */
+	bool precise;
+	/** enum clock_servo_state */
+	int state;
+	/** Last offset of the system clock to the PHC, in ns */
+	int64_t offset;
+	/** Last measurement window, in ns */
+	int64_t delay;
+	/** Frequency adjustment of the system clock, in ppb */
+	double freq;
+	/** RMS offset and maximum measurement window of the last period, in ns */
+	int64_t offset_rms;
+	int64_t delay_max;
+};
+
+struct sys_sync;
+
+struct sys_sync *sys_sync_new(const struct config *config, int fd_clock, bool phc_set, struct gnss *gnss, struct snapshot *info);
+void sys_sync_stop(struct sys_sync *sys_sync);
+
+#endif /* OSCILLATORD_SYS_SYNC_H */
@@ -0,0 +1,288 @@
+/**
+ * @file ubx_capture.c
+ * @brief Recording of receiver messages and offline replay
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "ubx_capture.h"
+#include "utils.h"
+
+#define NS_IN_MS 1000000ULL
+
+/** Capture file is flushed at least once per period */
+#define UBX_CAPTURE_FLUSH_PERIOD_NS NS_IN_SECOND
+
+/** Largest message accepted when replaying, bigger than any UBX frame */
+#define UBX_REPLAY_MAX_SIZE 65536
+
+struct ubx_capture {
+	FILE *file;
+	uint64_t last_flush;
+};
+
+struct ubx_replay {
+	FILE *file;
+	/** Replay speed factor, 0 to replay as fast as possible */
+	double speed;
+	/** Capture and replay times of the first record */
+	uint64_t capture_start;
+	uint64_t replay_start;
+	bool started;
+	bool eof;
+	/** Next record, read in advance to know when to deliver it */
+	struct ubx_capture_record record;
+	bool pending;
+	uint32_t seq;
+	char name[UINT8_MAX + 1];
+	uint8_t data[UBX_REPLAY_MAX_SIZE];
+	PARSER_MSG_t msg;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NS_IN_SECOND + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / NS_IN_SECOND,
+		.tv_nsec = deadline % NS_IN_SECOND,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/**
+ * @brief Open a capture file, messages are appended to it if it exists
+ *
+ * @param path
+ * @return struct ubx_capture*, NULL on error
+ */
+struct ubx_capture *ubx_capture_open(const char *path)
+{
+	struct ubx_capture *capture;
+
+	capture = calloc(1, sizeof(*capture));
+	if (capture == NULL) {
+		log_error("Could not allocate capture");
+		return NULL;
+	}
+
+	capture->file = fopen(path, "ab");
+	if (capture->file == NULL) {
+		log_error("Could not open capture file %s: %s", path, strerror(errno));
+		free(capture);
+		return NULL;
+	}
+
+	if (ftell(capture->file) == 0 &&
+	    fwrite(UBX_CAPTURE_MAGIC, strlen(UBX_CAPTURE_MAGIC), 1, capture->file) != 1) {
+		log_error("Could not write capture file %s: %s", path, strerror(errno));
+		fclose(capture->file);
+		free(capture);
+		return NULL;
+	}
+
+	capture->last_flush = monotonic_ns();
+	log_info("Capturing GNSS messages to %s", path);
+	return capture;
+}
+
+/**
+ * @brief Append a message to the capture file, timestamped with the current
+ * monotonic time
+ *
+ * @param capture
+ * @param msg
+ * @return 0 on success, -EIO on error
+ */
+int ubx_capture_write(struct ubx_capture *capture, const PARSER_MSG_t *msg)
+{
+	size_t name_len = msg->name != NULL ? strnlen(msg->name, UINT8_MAX) : 0;
+	struct ubx_capture_record record = {
+		.timestamp = monotonic_ns(),
+		.size = msg->size,
+		.type = msg->type,
+		.name_len = name_len,
+	};
+
+	if (fwrite(&record, sizeof(record), 1, capture->file) != 1 ||
+	    (name_len > 0 && fwrite(msg->name, name_len, 1, capture->file) != 1) ||
+	    (msg->size > 0 && fwrite(msg->data, msg->size, 1, capture->file) != 1)) {
+		log_warn("Could not write GNSS message to capture: %s", strerror(errno));
+		return -EIO;
+	}
+
+	if (record.timestamp - capture->last_flush >= UBX_CAPTURE_FLUSH_PERIOD_NS) {
+		fflush(capture->file);
+		capture->last_flush = record.timestamp;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Flush and close capture file
+ *
+ * @param capture
+ */
+void ubx_capture_close(struct ubx_capture *capture)
+{
+	if (capture == NULL)
+		return;
+	fclose(capture->file);
+	free(capture);
+}
+
+/**
+ * @brief Open a capture file for replay
+ *
+ * @param path
+ * @param speed replay speed factor, 1 for real time, 0 for as fast as possible
+ * @return struct ubx_replay*, NULL on error
+ */
+struct ubx_replay *ubx_replay_open(const char *path, double speed)
+{
+	char magic[sizeof(UBX_CAPTURE_MAGIC) - 1];
+	struct ubx_replay *replay;
+
+	if (speed < 0) {
+		log_error("Invalid replay speed %f", speed);
+		return NULL;
+	}
+
+	replay = calloc(1, sizeof(*replay));
+	if (replay == NULL) {
+		log_error("Could not allocate replay");
+		return NULL;
+	}
+	replay->speed = speed;
+
+	replay->file = fopen(path, "rb");
+	if (replay->file == NULL) {
+		log_error("Could not open replay file %s: %s", path, strerror(errno));
+		free(replay);
+		return NULL;
+	}
+
+	if (fread(magic, sizeof(magic), 1, replay->file) != 1 ||
+	    memcmp(magic, UBX_CAPTURE_MAGIC, sizeof(magic)) != 0) {
+		log_error("%s is not a GNSS capture file", path);
+		fclose(replay->file);
+		free(replay);
+		return NULL;
+	}
+
+	log_info("Replaying GNSS messages from %s at speed %.1f", path, speed);
+	return replay;
+}
+
+/**
+ * @brief Read header of next record
+ *
+ * @return true if a record is pending, false at end of file
+ */
+static bool ubx_replay_peek(struct ubx_replay *replay)
+{
+	if (replay->pending)
+		return true;
+	if (replay->eof)
+		return false;
+
+	if (fread(&replay->record, sizeof(replay->record), 1, replay->file) != 1) {
+		log_info("GNSS replay finished after %" PRIu32 " messages", replay->seq);
+		replay->eof = true;
+		return false;
+	}
+	replay->pending = true;
+	return true;
+}
+
+/**
+ * @brief Get next message of the capture, once its time has come
+ *
+ * Behaves like rxGetNextMessageTimeout(): returns NULL if no message is due
+ * within timeout_ms, which is always the case after end of file.
+ *
+ * @param replay
+ * @param timeout_ms
+ * @return PARSER_MSG_t* valid until next call, NULL on timeout or error
+ */
+PARSER_MSG_t *ubx_replay_next(struct ubx_replay *replay, uint32_t timeout_ms)
+{
+	uint64_t now = monotonic_ns();
+	uint64_t deadline = now + timeout_ms * NS_IN_MS;
+	struct ubx_capture_record *record = &replay->record;
+
+	if (!ubx_replay_peek(replay)) {
+		sleep_until_ns(deadline);
+		return NULL;
+	}
+
+	if (!replay->started) {
+		replay->capture_start = record->timestamp;
+		replay->replay_start = now;
+		replay->started = true;
+	}
+
+	if (replay->speed > 0) {
+		uint64_t due = replay->replay_start +
+			(record->timestamp - replay->capture_start) / replay->speed;
+
+		if (due > deadline) {
+			sleep_until_ns(deadline);
+			return NULL;
+		}
+		if (due > now)
+			sleep_until_ns(due);
+	}
+
+	replay->pending = false;
+	if (record->size > sizeof(replay->data) ||
+	    (record->name_len > 0 && fread(replay->name, record->name_len, 1, replay->file) != 1) ||
+	    (record->size > 0 && fread(replay->data, record->size, 1, replay->file) != 1)) {
+		log_error("Truncated or corrupted GNSS capture after %" PRIu32 " messages", replay->seq);
+		replay->eof = true;
+		return NULL;
+	}
+	replay->name[record->name_len] = '\0';
+
+	memset(&replay->msg, 0, sizeof(replay->msg));
+	replay->msg.type = record->type;
+	replay->msg.data = replay->data;
+	replay->msg.size = record->size;
+	replay->msg.seq = ++replay->seq;
+	replay->msg.ts = (record->timestamp - replay->capture_start) / NS_IN_MS;
+	replay->msg.name = replay->name;
+	replay->msg.info = NULL;
+
+	return &replay->msg;
+}
+
+/**
+ * @brief Close replay file
+ *
+ * @param replay
+ */
+void ubx_replay_close(struct ubx_replay *replay)
+{
+	if (replay == NULL)
+		return;
+	fclose(replay->file);
+	free(replay);
+}
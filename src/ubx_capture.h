@@ -0,0 +1,52 @@
+/**
+ * @file ubx_capture.h
+ * @brief Recording of receiver messages and offline replay
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ * Every message returned by the receiver parser can be appended to a capture
+ * file along with its monotonic reception time. A capture file can later be
+ * replayed in place of the receiver, at real or accelerated speed, so that
+ * the GNSS thread can run without hardware.
+ *
+ * Capture file format, in host byte order:
+ * - 8 bytes magic UBX_CAPTURE_MAGIC
+ * - records made of a struct ubx_capture_record, followed by name_len bytes
+ *   of message name (not NUL terminated) and size bytes of message data.
+ */
+#ifndef OSCILLATORD_UBX_CAPTURE_H
+#define OSCILLATORD_UBX_CAPTURE_H
+
+#include <stdint.h>
+
+#include <ff/ff_parser.h>
+
+#define UBX_CAPTURE_MAGIC "OSCUBX1\n"
+
+/**
+ * @struct ubx_capture_record
+ * @brief Header of a message in a capture file
+ */
+struct ubx_capture_record {
+	/** CLOCK_MONOTONIC time of reception in nanoseconds */
+	uint64_t timestamp;
+	uint32_t size;
+	/** PARSER_MSGTYPE_t of the message */
+	uint8_t type;
+	uint8_t name_len;
+	uint8_t reserved[2];
+} __attribute__((packed));
+
+struct ubx_capture;
+struct ubx_replay;
+
+struct ubx_capture *ubx_capture_open(const char *path);
+int ubx_capture_write(struct ubx_capture *capture, const PARSER_MSG_t *msg);
+void ubx_capture_close(struct ubx_capture *capture);
+
+struct ubx_replay *ubx_replay_open(const char *path, double speed);
+PARSER_MSG_t *ubx_replay_next(struct ubx_replay *replay, uint32_t timeout_ms);
+void ubx_replay_close(struct ubx_replay *replay);
+
+#endif /* OSCILLATORD_UBX_CAPTURE_H */
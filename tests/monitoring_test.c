@@ -0,0 +1,159 @@
+/**
+ * @file monitoring_test.c
+ * @brief Check the monitoring socket resynchronizes after a bad request
+ *
+ * A line that is not JSON must get an error response, and the requests
+ * following it, in the same write or in later ones, must still be answered.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <json-c/json.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "log.h"
+#include "monitoring.h"
+
+#define RECEIVE_TIMEOUT_S 5
+#define CONNECT_RETRIES   50
+
+static int connect_to_monitoring(int port) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct timeval timeout = {.tv_sec = RECEIVE_TIMEOUT_S};
+    int            sockfd;
+
+    for (int i = 0; i < CONNECT_RETRIES; i++) {
+        sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (sockfd < 0)
+            return -errno;
+        if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return sockfd;
+        }
+        close(sockfd);
+        usleep(100 * 1000);
+    }
+
+    return -ECONNREFUSED;
+}
+
+/* read one response line, at most size - 1 chars */
+static int read_line(int sockfd, char* line, size_t size) {
+    size_t len = 0;
+
+    while (len < size - 1) {
+        ssize_t ret = recv(sockfd, line + len, 1, 0);
+
+        if (ret <= 0)
+            return -1;
+        if (line[len] == '\n')
+            break;
+        len++;
+    }
+    line[len] = '\0';
+
+    return 0;
+}
+
+/* check next response is an error, or a normal response with the given id */
+static int expect_response(int sockfd, int id) {
+    struct json_object* resp;
+    struct json_object* value;
+    char                line[16 * 1024];
+    int                 ret = -1;
+
+    if (read_line(sockfd, line, sizeof(line)) < 0) {
+        log_error("No response received");
+        return -1;
+    }
+    resp = json_tokener_parse(line);
+    if (resp == NULL) {
+        log_error("Response is not JSON: %s", line);
+        return -1;
+    }
+    if (id < 0)
+        ret = json_object_object_get_ex(resp, "error", NULL) ? 0 : -1;
+    else if (json_object_object_get_ex(resp, "id", &value))
+        ret = json_object_get_int(value) == id ? 0 : -1;
+    if (ret < 0)
+        log_error("Unexpected response: %s", line);
+    json_object_put(resp);
+
+    return ret;
+}
+
+static int send_string(int sockfd, const char* str) {
+    return send(sockfd, str, strlen(str), MSG_NOSIGNAL) == (ssize_t)strlen(str) ? 0 : -1;
+}
+
+int main(void) {
+    char                config_path[] = "/tmp/monitoring_test_XXXXXX";
+    struct devices_path devices_path;
+    struct monitoring*  monitoring;
+    struct config       config;
+    FILE*               f;
+    int                 port = 20000 + getpid() % 10000;
+    int                 sockfd;
+    int                 ret = 0;
+    int                 fd;
+
+    log_set_level(LOG_INFO);
+    fd = mkstemp(config_path);
+    if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+        log_error("Could not create configuration: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(f, "oscillator=sim\nsocket-address=127.0.0.1\nsocket-port=%d\n", port);
+    fclose(f);
+    ret = config_init(&config, config_path);
+    unlink(config_path);
+    if (ret != 0) {
+        log_error("config_init: %s", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    memset(&devices_path, 0, sizeof(devices_path));
+    monitoring = monitoring_init(&config, &devices_path);
+    if (monitoring == NULL) {
+        log_error("monitoring_init failed");
+        return EXIT_FAILURE;
+    }
+    sockfd = connect_to_monitoring(port);
+    if (sockfd < 0) {
+        log_error("Could not connect to monitoring: %s", strerror(-sockfd));
+        monitoring_stop(monitoring);
+        return EXIT_FAILURE;
+    }
+
+    /* bad line and valid request in a single write */
+    ret |= send_string(sockfd, "garbage\n{\"id\": 1, \"request\": 0}\n");
+    ret |= expect_response(sockfd, -1);
+    ret |= expect_response(sockfd, 1);
+
+    /* bad line split across writes, valid request right after it */
+    ret |= send_string(sockfd, "{\"id\": x");
+    usleep(100 * 1000);
+    ret |= send_string(sockfd, "yz}\n{\"id\": 2, \"request\": 0}\n");
+    ret |= expect_response(sockfd, -1);
+    ret |= expect_response(sockfd, 2);
+
+    close(sockfd);
+    monitoring_stop(monitoring);
+    if (ret != 0) {
+        log_error("monitoring_test failed");
+        return EXIT_FAILURE;
+    }
+    log_info("monitoring_test passed");
+
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <math.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -22,19 +23,12 @@
 #include "config.h"
 #include "log.h"
 #include "ptspair.h"
+#include "sim_model.h"
 #include "utils.h"
 
 /* simulation parameters */
-#define SETPOINT_MIN               31500
-#define SETPOINT_MAX               1016052
-/* offset to apply at maximum at each turn in ns */
-#define TREND_OFFSET_NS            10
-/* maximum absolute value of the error offset to add at each turn */
-#define ERROR_AMPLITUDE_NS         5
 #define INITIAL_ERROR_AMPLITUDE_NS 10000000
 
-#define SETPOINT_AMPLITUDE         ((SETPOINT_MAX - SETPOINT_MIN) + 1)
-
 static void signal_handler(int signum) {
     log_info("Caught signal %s.\n", strsignal(signum));
     if (!loop) {
@@ -44,30 +38,44 @@ static void signal_handler(int signum) {
     loop = false;
 }
 
-/* returns a random number in [min, max) */
-static long random_in_range(long min, long max) {
-    return (random() % (min - max)) + min;
+/* initial control values, shared with the sim oscillator through the config */
+static void init_controls(struct sim_model* model, const struct config* config) {
+    long value;
+
+    value = config_get_unsigned_number(config, "sim-fine");
+    if (value >= 0)
+        sim_model_set_fine(model, value);
+    value = config_get_unsigned_number(config, "sim-coarse");
+    if (value >= 0)
+        sim_model_set_coarse(model, value);
 }
 
-/* compute what to add to the current phase offset */
-static long compute_delta(uint32_t setpoint) {
-    /* find the center of the setpoints interval */
-    int  center      = (SETPOINT_MIN + SETPOINT_MAX) / 2;
-    /* compute the alg. distance of the current setpoint to this center */
-    int  distance    = abs((int)setpoint - center);
-    /*
-     * base offset added is so that the maximum distance increases the
-     * offset by TREND_OFFSET ns
-     */
-    long base_offset = (TREND_OFFSET_NS * distance) / SETPOINT_AMPLITUDE;
-    /* add a random error */
-    int  error       = (random() % (2 * ERROR_AMPLITUDE_NS)) - ERROR_AMPLITUDE_NS;
+/* publish simulated temperature for the sim oscillator's attributes */
+static void write_status(const struct sim_model* model) {
+    FILE* f = fopen(STATUS_FILE_PATH ".tmp", "we");
 
-    return base_offset + error;
+    if (f == NULL)
+        return;
+    fprintf(f, "%.3f\n", model->temperature);
+    fclose(f);
+    rename(STATUS_FILE_PATH ".tmp", STATUS_FILE_PATH);
+}
+
+/* run simulation offline as fast as possible, printing a CSV line per second */
+static int run_batch(struct sim_model* model, unsigned long duration) {
+    printf("time_s,phase_error_ns,frequency,temperature\n");
+    for (unsigned long i = 0; i < duration && loop; i++) {
+        sim_model_step(model);
+        printf("%" PRIu64 ",%.3f,%.6e,%.3f\n", model->t, model->phase_error_ns, model->frequency,
+               model->temperature);
+    }
+
+    return EXIT_SUCCESS;
 }
 
 static void cleanup(void) {
     unlink(CONTROL_FIFO_PATH);
+    unlink(STATUS_FILE_PATH);
 }
 
 int main(int argc, char* argv[]) {
@@ -84,8 +92,9 @@ int main(int argc, char* argv[]) {
     int32_t           phase_error;
     /* data written by oscillatord to the 1PPS device */
     int32_t           phase_offset;
-    uint32_t          setpoint;
-    time_t            seed;
+    struct sim_control control;
+    struct sim_model_params params;
+    struct sim_model  model;
     int               control_fifo_fd;
     int               phase_error_fd;
     const char*       phase_error_pts;
@@ -98,12 +107,10 @@ int main(int argc, char* argv[]) {
 
     /* must be done early because of the attribute cleanup */
     memset(&pts, 0, sizeof(pts));
-    seed = time(NULL);
-    srand(seed);
 
     prog_name = basename(argv[0]);
-    if (argc != 2)
-        error(EXIT_FAILURE, 0, "%s config_file_path", prog_name);
+    if (argc != 2 && argc != 3)
+        error(EXIT_FAILURE, 0, "%s config_file_path [batch_duration_s]", prog_name);
     path = argv[1];
 
     ret  = config_init(&config, path);
@@ -112,6 +119,16 @@ int main(int argc, char* argv[]) {
 
     log_set_level(config_get_bool_default(&config, "enable-debug", false) ? LOG_DEBUG : LOG_INFO);
 
+    sim_model_default_params(&params);
+    sim_model_load_params(&params, &config);
+    sim_model_init(&model, &params);
+    init_controls(&model, &config);
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    if (argc == 3)
+        return run_batch(&model, strtoul(argv[2], NULL, 0));
+
     /* TODO implement a config_get ull ? */
     period_str = config_get(&config, "simulation-period");
     period     = atoll(period_str ?: "1000000000");
@@ -156,18 +173,12 @@ int main(int argc, char* argv[]) {
     if (ret == -1)
         error(EXIT_FAILURE, errno, "timerfd_settime");
 
-    log_info("%s[%jd] started, seed %jd.\n", prog_name, (intmax_t)getpid(), (intmax_t)seed);
+    log_info("%s[%jd] started, seed %" PRIu64 ".\n", prog_name, (intmax_t)getpid(), params.seed);
 
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-
-    /* choose initial setpoint */
-    setpoint = random_in_range(SETPOINT_MIN, SETPOINT_MAX + 1);
-    setpoint = SETPOINT_MIN;
-    log_info("initial setpoint %" PRIu32 "\n", setpoint);
-    /* choose initial phase_error */
-    phase_error = random_in_range(-INITIAL_ERROR_AMPLITUDE_NS, INITIAL_ERROR_AMPLITUDE_NS);
-    log_info("initial phase_error: %" PRIi32 "\n", phase_error);
+    log_info("initial fine %" PRIu32 ", coarse %" PRIu32 "\n", model.fine, model.coarse);
+    /* choose initial phase_error, deterministic for a given seed */
+    sim_model_add_phase(&model, (double)(params.seed % (2 * INITIAL_ERROR_AMPLITUDE_NS)) - INITIAL_ERROR_AMPLITUDE_NS);
+    log_info("initial phase: %.0f\n", model.phase_ns);
 
     memset(&its, 0, sizeof(its));
     while (loop) {
@@ -190,7 +201,10 @@ int main(int argc, char* argv[]) {
             sret = read(tfd, &expired, sizeof(expired));
             if (sret < 0 && ret != -EINTR)
                 error(EXIT_FAILURE, errno, "read");
-            phase_error += compute_delta(setpoint);
+            /* one simulated second per timer period, whatever the period */
+            sim_model_step(&model);
+            write_status(&model);
+            phase_error = lround(model.phase_error_ns);
             log_debug("phase error: %" PRIi32 "\n", phase_error);
 
             if (phase_error_fd != -1) {
@@ -200,29 +214,32 @@ int main(int argc, char* argv[]) {
             }
         }
         if (FD_ISSET(control_fifo_fd, &readfds)) {
-            sret = read(control_fifo_fd, &setpoint, sizeof(setpoint));
+            sret = read(control_fifo_fd, &control, sizeof(control));
             if (sret < 0)
                 error(EXIT_FAILURE, errno, "read");
             if (sret == 0 && ret != -EINTR) {
                 log_info("Peer closed the control fifo\n");
                 break;
             }
-            log_debug("new setpoint: %" PRIu32 "\n", setpoint);
+            if (control.type == SIM_CONTROL_COARSE)
+                sim_model_set_coarse(&model, control.value);
+            else
+                sim_model_set_fine(&model, control.value);
+            log_debug("new %s: %" PRIu32 "\n", control.type == SIM_CONTROL_COARSE ? "coarse" : "fine",
+                      control.value);
         }
         if (FD_ISSET(phase_error_fd, &readfds)) {
             sret = read(phase_error_fd, &phase_offset, sizeof(phase_offset));
             if (sret < 0)
                 error(EXIT_FAILURE, errno, "read");
             log_debug("applying phase offset: %" PRIi32 "\n", phase_offset);
-            phase_error += phase_offset;
+            sim_model_add_phase(&model, phase_offset);
         }
         if (FD_ISSET(pts_fd, &readfds)) {
             ret = ptspair_process_events(&pts);
             if (ret < 0 && ret != -EINTR)
                 error(EXIT_FAILURE, -ret, "ptspair_process_events");
         }
-
-        usleep(100000);
     }
 
     close(tfd);
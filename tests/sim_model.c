@@ -0,0 +1,233 @@
+/**
+ * @file sim_model.c
+ * @brief Stochastic model of a disciplined atomic oscillator
+ *
+ * Flicker noises are approximated by a sum of first order Gauss-Markov
+ * processes of equal variance with one time constant per decade, from 1 s to
+ * 10^(SIM_MODEL_FLICKER_POLES - 1) s, which has a 1/f spectrum in between.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/oscillators/sim_oscillator.h"
+#include "log.h"
+#include "sim_model.h"
+
+#define SECONDS_PER_DAY    86400.0
+#define NS_PER_S           1e9
+/*
+ * Allan deviation of the flicker FM approximation for a unit variance of
+ * each pole, measured between 10 s and 10000 s
+ */
+#define FLICKER_FM_ADEV    0.77
+
+/* xoshiro256** */
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t rng_next(struct sim_model_rng* rng) {
+    uint64_t* s      = rng->s;
+    uint64_t  result = rotl(s[1] * 5, 7) * 9;
+    uint64_t  t      = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/* state is expanded from the seed with splitmix64, as advised by xoshiro's authors */
+static void rng_seed(struct sim_model_rng* rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+        z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        rng->s[i]  = z ^ (z >> 31);
+    }
+    rng->has_spare = false;
+}
+
+/* uniform in (0, 1) */
+static double rng_uniform(struct sim_model_rng* rng) {
+    return ((rng_next(rng) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/* standard normal, Box-Muller */
+static double rng_gaussian(struct sim_model_rng* rng) {
+    double r;
+    double theta;
+
+    if (rng->has_spare) {
+        rng->has_spare = false;
+        return rng->spare;
+    }
+    r              = sqrt(-2.0 * log(rng_uniform(rng)));
+    theta          = 2.0 * M_PI * rng_uniform(rng);
+    rng->spare     = r * sin(theta);
+    rng->has_spare = true;
+
+    return r * cos(theta);
+}
+
+/* advance flicker poles and return the sum, unit variance per pole */
+static double flicker_step(struct sim_model_rng* rng, double* poles) {
+    double tau = 1.0;
+    double sum = 0.0;
+
+    for (int i = 0; i < SIM_MODEL_FLICKER_POLES; i++) {
+        double a = exp(-1.0 / tau);
+
+        poles[i] = a * poles[i] + sqrt(1.0 - a * a) * rng_gaussian(rng);
+        sum += poles[i];
+        tau *= 10.0;
+    }
+
+    return sum;
+}
+
+static double config_get_double_default(const struct config* config, const char* key, double def) {
+    const char* value = config_get(config, key);
+    char*       end;
+    double      d;
+
+    if (value == NULL)
+        return def;
+    errno = 0;
+    d     = strtod(value, &end);
+    if (errno != 0 || end == value || *end != '\0') {
+        log_warn("invalid value \"%s\" for %s, using %g", value, key, def);
+        return def;
+    }
+
+    return d;
+}
+
+/**
+ * @brief Fill parameters with values close to a mRO50 in a lab
+ */
+void sim_model_default_params(struct sim_model_params* params) {
+    *params = (struct sim_model_params){
+        .seed                    = 1,
+        .white_pm_ns             = 1.0,
+        .flicker_pm_ns           = 0.5,
+        .white_fm                = 3e-11,
+        .flicker_fm              = 2e-12,
+        .random_walk_fm          = 5e-15,
+        .aging                   = 2e-12,
+        .initial_frequency       = 2e-9,
+        .temperature_mean        = 40.0,
+        .temperature_amplitude   = 2.0,
+        .temperature_period_s    = SECONDS_PER_DAY,
+        .temperature_noise       = 0.05,
+        .temperature_coefficient = 1e-12,
+        .fine_center             = (SIM_FINE_MIN + SIM_FINE_MAX) / 2,
+        .fine_gain               = -1.5e-12,
+        .fine_curvature          = -5e-17,
+        .coarse_center           = (SIM_COARSE_MIN + SIM_COARSE_MAX) / 2,
+        .coarse_gain             = -1e-12,
+    };
+}
+
+/**
+ * @brief Override parameters with the sim-* keys of a configuration
+ */
+void sim_model_load_params(struct sim_model_params* params, const struct config* config) {
+    const char* seed = config_get(config, "sim-seed");
+
+    if (seed != NULL)
+        params->seed = strtoull(seed, NULL, 0);
+    params->white_pm_ns             = config_get_double_default(config, "sim-white-pm-ns", params->white_pm_ns);
+    params->flicker_pm_ns           = config_get_double_default(config, "sim-flicker-pm-ns", params->flicker_pm_ns);
+    params->white_fm                = config_get_double_default(config, "sim-white-fm", params->white_fm);
+    params->flicker_fm              = config_get_double_default(config, "sim-flicker-fm", params->flicker_fm);
+    params->random_walk_fm          = config_get_double_default(config, "sim-random-walk-fm", params->random_walk_fm);
+    params->aging                   = config_get_double_default(config, "sim-aging", params->aging);
+    params->initial_frequency       = config_get_double_default(config, "sim-initial-frequency", params->initial_frequency);
+    params->temperature_mean        = config_get_double_default(config, "sim-temperature-mean", params->temperature_mean);
+    params->temperature_amplitude   = config_get_double_default(config, "sim-temperature-amplitude", params->temperature_amplitude);
+    params->temperature_period_s    = config_get_double_default(config, "sim-temperature-period", params->temperature_period_s);
+    params->temperature_noise       = config_get_double_default(config, "sim-temperature-noise", params->temperature_noise);
+    params->temperature_coefficient = config_get_double_default(config, "sim-temperature-coefficient", params->temperature_coefficient);
+    params->fine_gain               = config_get_double_default(config, "sim-fine-gain", params->fine_gain);
+    params->fine_curvature          = config_get_double_default(config, "sim-fine-curvature", params->fine_curvature);
+    params->coarse_gain             = config_get_double_default(config, "sim-coarse-gain", params->coarse_gain);
+}
+
+/**
+ * @brief Initialize model, tuning at its center
+ */
+void sim_model_init(struct sim_model* model, const struct sim_model_params* params) {
+    memset(model, 0, sizeof(*model));
+    model->params      = *params;
+    model->fine        = params->fine_center;
+    model->coarse      = params->coarse_center;
+    model->temperature = params->temperature_mean;
+    rng_seed(&model->rng, params->seed);
+    /* start flicker processes in their stationary state */
+    for (int i = 0; i < SIM_MODEL_FLICKER_POLES; i++) {
+        model->flicker_fm[i] = rng_gaussian(&model->rng);
+        model->flicker_pm[i] = rng_gaussian(&model->rng);
+    }
+}
+
+void sim_model_set_fine(struct sim_model* model, uint32_t fine) {
+    model->fine = fine > SIM_FINE_MAX ? SIM_FINE_MAX : fine;
+}
+
+void sim_model_set_coarse(struct sim_model* model, uint32_t coarse) {
+    model->coarse = coarse > SIM_COARSE_MAX ? SIM_COARSE_MAX : coarse;
+}
+
+/**
+ * @brief Apply a phase jump, as done by oscillatord on the PHC
+ */
+void sim_model_add_phase(struct sim_model* model, double phase_ns) {
+    model->phase_ns += phase_ns;
+}
+
+/**
+ * @brief Fractional frequency offset caused by control values
+ */
+double sim_model_tuning(const struct sim_model_params* params, uint32_t fine, uint32_t coarse) {
+    double d = (double)fine - params->fine_center;
+
+    return params->fine_gain * d + params->fine_curvature * d * d +
+           params->coarse_gain * ((double)coarse - params->coarse_center);
+}
+
+/**
+ * @brief Advance model by one second
+ *
+ * Updates frequency, temperature and phase_error_ns
+ */
+void sim_model_step(struct sim_model* model) {
+    const struct sim_model_params* p   = &model->params;
+    struct sim_model_rng*          rng = &model->rng;
+    double                         y;
+
+    model->t++;
+    model->temperature = p->temperature_mean + p->temperature_noise * rng_gaussian(rng);
+    if (p->temperature_period_s > 0)
+        model->temperature += p->temperature_amplitude * sin(2.0 * M_PI * model->t / p->temperature_period_s);
+
+    /* random walk FM: ADEV(tau) = q * sqrt(tau / 3) */
+    model->random_walk += p->random_walk_fm * sqrt(3.0) * rng_gaussian(rng);
+
+    y = p->initial_frequency + p->aging * model->t / SECONDS_PER_DAY +
+        p->temperature_coefficient * (model->temperature - p->temperature_mean) +
+        sim_model_tuning(p, model->fine, model->coarse) + model->random_walk +
+        p->white_fm * rng_gaussian(rng) + p->flicker_fm / FLICKER_FM_ADEV * flicker_step(rng, model->flicker_fm);
+    model->frequency = y;
+    model->phase_ns += y * NS_PER_S;
+
+    model->phase_error_ns = model->phase_ns + p->white_pm_ns * rng_gaussian(rng) +
+                            p->flicker_pm_ns / sqrt(SIM_MODEL_FLICKER_POLES) * flicker_step(rng, model->flicker_pm);
+}
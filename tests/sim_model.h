@@ -0,0 +1,92 @@
+/**
+ * @file sim_model.h
+ * @brief Stochastic model of a disciplined atomic oscillator, used by
+ * oscillator_sim
+ *
+ * The model advances by steps of one simulated second, independently of
+ * wall clock time, so that it can run as fast as needed. Its fractional
+ * frequency is the sum of:
+ *  - white, flicker and random walk frequency noises,
+ *  - linear aging,
+ *  - a temperature profile times a temperature coefficient,
+ *  - coarse and fine tuning transfer curves, ranges matching a mRO50.
+ * White and flicker phase noises are added to the phase error read.
+ *
+ * All the noises are drawn from a seeded pseudo random generator, two runs
+ * with the same seed and control values give the same phase errors.
+ */
+#ifndef TESTS_SIM_MODEL_H
+#define TESTS_SIM_MODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/* Number of first order processes summed to approximate flicker noises */
+#define SIM_MODEL_FLICKER_POLES 6
+
+struct sim_model_params {
+    uint64_t seed;
+    /* Phase noises, rms in ns */
+    double   white_pm_ns;
+    double   flicker_pm_ns;
+    /* Frequency noises, as their Allan deviation at 1 s */
+    double   white_fm;
+    double   flicker_fm;
+    double   random_walk_fm;
+    /* Linear frequency drift, per day */
+    double   aging;
+    /* Fractional frequency offset at start, tuning at its center */
+    double   initial_frequency;
+    /* Temperature profile: mean + amplitude * sin(2 pi t / period) + noise */
+    double   temperature_mean;
+    double   temperature_amplitude;
+    double   temperature_period_s;
+    double   temperature_noise;
+    /* Fractional frequency per degree, around temperature_mean */
+    double   temperature_coefficient;
+    /* Fine tuning: gain * d + curvature * d^2, d distance to fine_center */
+    uint32_t fine_center;
+    double   fine_gain;
+    double   fine_curvature;
+    /* Coarse tuning: gain * (coarse - coarse_center) */
+    uint32_t coarse_center;
+    double   coarse_gain;
+};
+
+struct sim_model_rng {
+    uint64_t s[4];
+    bool     has_spare;
+    double   spare;
+};
+
+struct sim_model {
+    struct sim_model_params params;
+    struct sim_model_rng    rng;
+    /* Simulated time, in s */
+    uint64_t                t;
+    uint32_t                fine;
+    uint32_t                coarse;
+    /* Phase, without phase noises, in ns */
+    double                  phase_ns;
+    /* Random walk frequency noise state */
+    double                  random_walk;
+    double                  flicker_fm[SIM_MODEL_FLICKER_POLES];
+    double                  flicker_pm[SIM_MODEL_FLICKER_POLES];
+    /* Outputs of the last step */
+    double                  frequency;
+    double                  temperature;
+    double                  phase_error_ns;
+};
+
+void   sim_model_default_params(struct sim_model_params* params);
+void   sim_model_load_params(struct sim_model_params* params, const struct config* config);
+void   sim_model_init(struct sim_model* model, const struct sim_model_params* params);
+void   sim_model_set_fine(struct sim_model* model, uint32_t fine);
+void   sim_model_set_coarse(struct sim_model* model, uint32_t coarse);
+void   sim_model_add_phase(struct sim_model* model, double phase_ns);
+void   sim_model_step(struct sim_model* model);
+double sim_model_tuning(const struct sim_model_params* params, uint32_t fine, uint32_t coarse);
+
+#endif /* TESTS_SIM_MODEL_H */
@@ -0,0 +1,38 @@
+# Runs oscillator_sim twice in batch mode with the same seed, checks both runs
+# give the same phase errors and that the phase drift matches the model's
+# default initial frequency of 2e-9.
+# Usage: cmake -DSIM=<oscillator_sim> -DCONFIG=<config> -DDURATION=<s> -P sim_regression.cmake
+foreach(run first second)
+	execute_process(
+		COMMAND ${SIM} ${CONFIG} ${DURATION}
+		OUTPUT_VARIABLE ${run}
+		RESULT_VARIABLE ret)
+	if(NOT ret EQUAL 0)
+		message(FATAL_ERROR "oscillator_sim exited with ${ret}")
+	endif()
+endforeach()
+
+if(NOT first STREQUAL second)
+	message(FATAL_ERROR "two runs with the same seed differ")
+endif()
+
+string(REGEX MATCHALL "[^\n]+" lines "${first}")
+list(LENGTH lines nb_lines)
+math(EXPR expected "${DURATION} + 1")
+if(NOT nb_lines EQUAL expected)
+	message(FATAL_ERROR "got ${nb_lines} lines, expected ${expected}")
+endif()
+
+list(GET lines -1 last)
+string(REPLACE "," ";" last "${last}")
+list(GET last 0 time)
+list(GET last 1 phase_error)
+if(NOT time EQUAL DURATION)
+	message(FATAL_ERROR "last time is ${time}, expected ${DURATION}")
+endif()
+# 2e-9 drift, noises are a few ns rms over such a run
+math(EXPR phase_min "${DURATION} * 2 - 20 - ${DURATION} / 50")
+math(EXPR phase_max "${DURATION} * 2 + 20 + ${DURATION} / 50")
+if(phase_error LESS phase_min OR phase_error GREATER phase_max)
+	message(FATAL_ERROR "phase error ${phase_error} ns outside of [${phase_min}, ${phase_max}]")
+endif()
@@ -18,21 +18,43 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+/** Watch mode: delay between reconnection attempts doubles up to this value */
+#define RECONNECT_DELAY_MAX_S 60
+
+/** Time waited for a response before giving up on the connection */
+#define RECEIVE_TIMEOUT_S 10
+
+/** Watch mode: default number of rotated files kept */
+#define DEFAULT_ROTATED_FILES 5
+
+static volatile sig_atomic_t running = 1;
+
+static void signal_handler(int sig)
+{
+	(void) sig;
+	running = 0;
+}
+
 static void print_help(void)
 {
 	printf("usage: art_monitoring_client [-h -r REQUEST_TYPE -a ADDRESS] -p PORT\n");
+	printf("       art_monitoring_client [-a ADDRESS -n COUNT -o FILE -s SIZE -k FILES] -i INTERVAL -p PORT\n");
 	printf("- -a ADDRESS: Address socket should bind to. Defaults to local address\n");
 	printf("- -p PORT: Port socket should bind to\n");
-	printf("- -r REQUEST_TYPE: send a request to oscillatord. Accepted values are:\n");
+	printf("- -r REQUEST_TYPE: send a request to oscillatord, can be repeated to send\n");
+	printf("  several requests in a single round trip. Accepted values are:\n");
 	printf("\t- calibration: request a calibration of the algorithm\n");
 	printf("\t- gnss_start: start gnss receiver\n");
 	printf("\t- gnss_stop: stop gnss receiver.\n");
@@ -40,159 +62,127 @@ static void print_help(void)
 	printf("\t- save_eeprom: save minipod's disciplining data in EEPROM.\n");
 	printf("\t- fake_holdover_start: start fake holdover\n");
 	printf("\t- fake_holdover_stop: stop fake holdover.\n");
+	printf("- -i INTERVAL: watch mode, sample monitoring data every INTERVAL seconds over a\n");
+	printf("  single connection and output them as CSV. Reconnects automatically.\n");
+	printf("- -n COUNT: watch mode, stop after COUNT samples. Defaults to infinite\n");
+	printf("- -o FILE: watch mode, write CSV to FILE instead of standard output\n");
+	printf("- -s SIZE: watch mode, rotate FILE once it exceeds SIZE kB. Defaults to no rotation\n");
+	printf("- -k FILES: watch mode, number of rotated files kept. Defaults to %d\n", DEFAULT_ROTATED_FILES);
 	printf("- -h: prints help\n");
 	return;
 }
 
-/* Send json formatted request and returns json response */
-static struct json_object *json_send_and_receive(int sockfd, int request)
-{
-	int ret;
-
-	struct json_object *json_req = json_object_new_object();
-	json_object_object_add(json_req, "request", json_object_new_int(request));
+/** Maximum number of requests that can be sent in a single frame */
+#define MAX_REQUESTS 16
 
-	const char *req = json_object_to_json_string(json_req);
-	char buf[1024];
-	strcpy(buf, req);
-	ret = send(sockfd, req, strlen(buf), 0);
-	if (ret == -1)
-	{
-		log_error("Error sending request: %d", ret);
-		log_error("FAIL");
-		return NULL;
-	}
-
-	char *resp = (char *)malloc(sizeof(char) * 2048);
-	ret = recv(sockfd, resp, 2048, 0);
-	if (-1 == ret)
-	{
-		log_error("Error receiving response: %d", ret);
-		log_error("FAIL");
-		return NULL;
-	}
+/** Size of the chunks read from the socket */
+#define RECV_CHUNK_SIZE 2048
 
-	return json_tokener_parse(resp);
-}
+/* Responses are newline delimited json objects, parsed incrementally */
+struct receiver {
+	struct json_tokener *tok;
+	char buf[RECV_CHUNK_SIZE];
+	int len;
+	int offset;
+};
 
-int main(int argc, char *argv[]) {
-	int c;
-	int request = REQUEST_NONE;
-	const char* socket_port = NULL;
-	const char* socket_addr = NULL;
+/* Send all requests in a single json formatted frame */
+static int json_send_requests(int sockfd, const int *requests, int nb_requests)
+{
+	struct json_object *json_req;
+	int ret;
 
-	while ((c = getopt(argc, argv, "a:p:r:h")) != -1)
-	switch (c)
-	{
-		case 'a':
-			socket_addr = optarg;
-			break;
-		case 'p':
-			socket_port = optarg;
-			break;
-		case 'r':
-		if (strcmp(optarg, "calibration") == 0)
-			request = REQUEST_CALIBRATION;
-		else if (strcmp(optarg, "gnss_start") == 0)
-			request = REQUEST_GNSS_START;
-		else if (strcmp(optarg, "gnss_stop") == 0)
-			request = REQUEST_GNSS_STOP;
-		else if (strcmp(optarg, "gnss_soft") == 0)
-			request = REQUEST_GNSS_SOFT;
-		else if (strcmp(optarg, "gnss_hard") == 0)
-			request = REQUEST_GNSS_HARD;
-		else if (strcmp(optarg, "gnss_cold") == 0)
-			request = REQUEST_GNSS_COLD;
-		else if (strcmp(optarg, "read_eeprom") == 0)
-			request = REQUEST_READ_EEPROM;
-		else if (strcmp(optarg, "save_eeprom") == 0)
-			request = REQUEST_SAVE_EEPROM;
-		else if (strcmp(optarg, "fake_holdover_start") == 0)
-			request = REQUEST_FAKE_HOLDOVER_START;
-		else if (strcmp(optarg, "fake_holdover_stop") == 0)
-			request = REQUEST_FAKE_HOLDOVER_STOP;
-		else if (strcmp(optarg, "mro_coarse_inc") == 0)
-			request = REQUEST_MRO_COARSE_INC;
-		else if (strcmp(optarg, "mro_coarse_dec") == 0)
-			request = REQUEST_MRO_COARSE_DEC;
-		else {
-			log_error("Unknown request %s", optarg);
-			return -1;
+	if (nb_requests == 1) {
+		json_req = json_object_new_object();
+		json_object_object_add(json_req, "id", json_object_new_int(0));
+		json_object_object_add(json_req, "request", json_object_new_int(requests[0]));
+	} else {
+		struct json_object *json_array = json_object_new_array();
+
+		for (int i = 0; i < nb_requests; i++) {
+			struct json_object *item = json_object_new_object();
+			json_object_object_add(item, "id", json_object_new_int(i));
+			json_object_object_add(item, "request", json_object_new_int(requests[i]));
+			json_object_array_add(json_array, item);
 		}
-		log_info("Action requested: %s", optarg);
-		break;
-	case 'h':
-		print_help();
-		return 0;
-	case '?':
-		if (optopt == 'r')
-			fprintf (stderr, "Option -%c requires request type.\n", optopt);
-		else
-			fprintf (stderr,
-					"Unknown option character `\\x%x'.\n",
-					optopt);
-		return EXIT_FAILURE;
-	default:
-		abort();
+		json_req = json_object_new_object();
+		json_object_object_add(json_req, "requests", json_array);
 	}
 
-	if (socket_port == NULL) {
-		log_error("Bad port");
-		print_help();
-		return EXIT_FAILURE;
-	}
-
-	int              socket_fd;
-	int              status;
-	struct addrinfo* addresses;
-	struct addrinfo* current;
-	struct addrinfo  hint = {
-		.ai_family = AF_UNSPEC,
-		.ai_protocol = IPPROTO_TCP,
-	};
-
-	status = getaddrinfo(socket_addr, socket_port, &hint, &addresses);
-	if (status == EAI_SYSTEM)
-	{
-		log_error("Unable to get an Internet address from '%s:%s': %s", socket_addr, socket_port, strerror(errno));
-		return EXIT_FAILURE;
+	const char *req = json_object_to_json_string(json_req);
+	size_t len = strlen(req);
+	size_t sent = 0;
+
+	while (sent < len) {
+		ret = send(sockfd, req + sent, len - sent, 0);
+		if (ret == -1) {
+			log_error("Error sending request: %s", strerror(errno));
+			json_object_put(json_req);
+			return -1;
+		}
+		sent += ret;
 	}
-	else if (status != 0)
-	{
-		log_error("Unable to get an Internet address from '%s:%s': %s", socket_addr, socket_port, gai_strerror(status));
-		return EXIT_FAILURE;
+	ret = send(sockfd, "\n", 1, 0);
+	json_object_put(json_req);
+	if (ret == -1) {
+		log_error("Error sending request: %s", strerror(errno));
+		return -1;
 	}
+	return 0;
+}
 
-	for (current = addresses; current; current = current->ai_next)
-	{
-		socket_fd = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
-		if (socket_fd < 0)
-		{
-			log_warn("Couldn't open a socket for '%s:%s' (IPv%i): %s", socket_addr, socket_port, current->ai_family == AF_INET ? 4 : 6, strerror(errno));
-			continue;
+/* Read from socket until a complete json response has been received */
+static struct json_object *json_receive(int sockfd, struct receiver *rcv)
+{
+	struct json_object *obj;
+	enum json_tokener_error jerr;
+
+	for (;;) {
+		if (rcv->offset >= rcv->len) {
+			int ret = recv(sockfd, rcv->buf, sizeof(rcv->buf), 0);
+			if (ret <= 0) {
+				log_error("Error receiving response: %s",
+					ret == 0 ? "connection closed" :
+					errno == EAGAIN || errno == EWOULDBLOCK ? "timed out" : strerror(errno));
+				return NULL;
+			}
+			rcv->len = ret;
+			rcv->offset = 0;
 		}
-		if (connect(socket_fd, current->ai_addr, current->ai_addrlen) == 0)
-			break;
-		log_warn("Couldn't connect to '%s:%s' (IPv%i) : %s", socket_addr, socket_port, current->ai_family == AF_INET ? 4 : 6, strerror(errno));
 
-		close(socket_fd);
-	}
-	freeaddrinfo(addresses);
-
-	if (current == NULL)
-	{
-		log_error("Could not connect to %s:%s", socket_addr, socket_port);
-		return EXIT_FAILURE;
+		obj = json_tokener_parse_ex(rcv->tok, rcv->buf + rcv->offset, rcv->len - rcv->offset);
+		jerr = json_tokener_get_error(rcv->tok);
+		if (obj != NULL) {
+			rcv->offset += json_tokener_get_parse_end(rcv->tok);
+			return obj;
+		} else if (jerr != json_tokener_continue) {
+			log_error("Error parsing response: %s", json_tokener_error_desc(jerr));
+			return NULL;
+		}
+		rcv->offset = rcv->len;
 	}
+}
 
-	/* Request data through socket */
-	struct json_object *obj = json_send_and_receive(socket_fd, request);
+/* Print content of a json response */
+static void print_response(struct json_object *obj, const int *requests, int nb_requests)
+{
 	struct json_object *layer_1;
 	struct json_object *layer_2;
 	struct json_object *layer_3;
 
 	log_info(json_object_to_json_string(obj));
 
+	/* Request id */
+	if (json_object_object_get_ex(obj, "id", &layer_1)) {
+		int id = json_object_get_int(layer_1);
+		if (id >= 0 && id < nb_requests)
+			log_info("Response to request %d (%d)", id, requests[id]);
+	}
+
+	/* Error */
+	if (json_object_object_get_ex(obj, "error", &layer_1))
+		log_error("Error: %s", json_object_get_string(layer_1));
+
 	/* Disciplining */
 	json_object_object_get_ex(obj, "disciplining", &layer_1);
 	if (layer_1 != NULL) {
@@ -341,11 +331,432 @@ int main(int argc, char *argv[]) {
 	if (layer_1 != NULL)
 		log_info("Action requested: %s", json_object_get_string(layer_1));
 
-	free(obj);
+}
 
-	close(socket_fd);
-	log_info("PASSED !");
+/* Connect to oscillatord monitoring socket, returns socket fd or -1 on error */
+static int connect_to_server(const char *socket_addr, const char *socket_port)
+{
+	int              socket_fd = -1;
+	int              status;
+	struct timeval   timeout = { .tv_sec = RECEIVE_TIMEOUT_S, .tv_usec = 0 };
+	struct addrinfo* addresses;
+	struct addrinfo* current;
+	struct addrinfo  hint = {
+		.ai_family = AF_UNSPEC,
+		.ai_protocol = IPPROTO_TCP,
+	};
 
+	status = getaddrinfo(socket_addr, socket_port, &hint, &addresses);
+	if (status == EAI_SYSTEM)
+	{
+		log_error("Unable to get an Internet address from '%s:%s': %s", socket_addr, socket_port, strerror(errno));
+		return -1;
+	}
+	else if (status != 0)
+	{
+		log_error("Unable to get an Internet address from '%s:%s': %s", socket_addr, socket_port, gai_strerror(status));
+		return -1;
+	}
 
-	return EXIT_SUCCESS;
+	for (current = addresses; current; current = current->ai_next)
+	{
+		socket_fd = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
+		if (socket_fd < 0)
+		{
+			log_warn("Couldn't open a socket for '%s:%s' (IPv%i): %s", socket_addr, socket_port, current->ai_family == AF_INET ? 4 : 6, strerror(errno));
+			continue;
+		}
+		if (connect(socket_fd, current->ai_addr, current->ai_addrlen) == 0)
+			break;
+		log_warn("Couldn't connect to '%s:%s' (IPv%i) : %s", socket_addr, socket_port, current->ai_family == AF_INET ? 4 : 6, strerror(errno));
+
+		close(socket_fd);
+	}
+	freeaddrinfo(addresses);
+
+	if (current == NULL)
+	{
+		log_error("Could not connect to %s:%s", socket_addr, socket_port);
+		return -1;
+	}
+	/* A stuck daemon must not block us forever */
+	if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+		log_warn("Could not set receive timeout: %s", strerror(errno));
+	return socket_fd;
+}
+
+/* CSV columns written in watch mode, as object and field of the response */
+static const struct csv_column {
+	const char *name;
+	const char *object;
+	const char *field;
+} csv_columns[] = {
+	{ "clock_class", "clock", "class" },
+	{ "clock_offset", "clock", "offset" },
+	{ "disciplining_status", "disciplining", "status" },
+	{ "convergence_progress", "disciplining", "convergence_progress" },
+	{ "ready_for_holdover", "disciplining", "ready_for_holdover" },
+	{ "fine_ctrl", "oscillator", "fine_ctrl" },
+	{ "coarse_ctrl", "oscillator", "coarse_ctrl" },
+	{ "lock", "oscillator", "lock" },
+	{ "temperature", "oscillator", "temperature" },
+	{ "gnss_fix", "gnss", "fix" },
+	{ "gnss_fixOk", "gnss", "fixOk" },
+	{ "satellites_count", "gnss", "satellites_count" },
+	{ "survey_in_position_error", "gnss", "survey_in_position_error" },
+	{ "time_accuracy", "gnss", "time_accuracy" },
+	{ "antenna_status", "gnss", "antenna_status" },
+	{ "antenna_power", "gnss", "antenna_power" },
+	{ "leap_seconds", "gnss", "leap_seconds" },
+	{ "lsChange", "gnss", "lsChange" },
+};
+
+/* CSV output of watch mode, to standard output or to a rotated file */
+struct recorder {
+	const char *path;
+	FILE *file;
+	long max_size;
+	int max_files;
+	long size;
+};
+
+/* Open recorder output, writing CSV header if file is empty */
+static int recorder_open(struct recorder *rec)
+{
+	if (rec->path == NULL) {
+		rec->file = stdout;
+		rec->size = 0;
+	} else {
+		rec->file = fopen(rec->path, "a");
+		if (rec->file == NULL) {
+			log_error("Could not open %s: %s", rec->path, strerror(errno));
+			return -1;
+		}
+		if (fseek(rec->file, 0, SEEK_END) == 0)
+			rec->size = ftell(rec->file);
+		else
+			rec->size = 0;
+	}
+
+	if (rec->size <= 0) {
+		int ret = fprintf(rec->file, "timestamp");
+		for (size_t i = 0; i < sizeof(csv_columns) / sizeof(csv_columns[0]); i++)
+			ret += fprintf(rec->file, ",%s", csv_columns[i].name);
+		ret += fprintf(rec->file, "\n");
+		rec->size = ret;
+	}
+	return 0;
+}
+
+/* Rotate recorder file: FILE -> FILE.1 -> ... -> FILE.max_files */
+static int recorder_rotate(struct recorder *rec)
+{
+	size_t len = strlen(rec->path) + 16;
+	char from[len];
+	char to[len];
+
+	fclose(rec->file);
+	rec->file = NULL;
+
+	for (int i = rec->max_files - 1; i >= 1; i--) {
+		snprintf(from, len, "%s.%d", rec->path, i);
+		snprintf(to, len, "%s.%d", rec->path, i + 1);
+		if (rename(from, to) < 0 && errno != ENOENT)
+			log_warn("Could not rename %s to %s: %s", from, to, strerror(errno));
+	}
+	if (rec->max_files > 0) {
+		snprintf(to, len, "%s.1", rec->path);
+		if (rename(rec->path, to) < 0)
+			log_warn("Could not rename %s to %s: %s", rec->path, to, strerror(errno));
+	} else if (unlink(rec->path) < 0) {
+		log_warn("Could not remove %s: %s", rec->path, strerror(errno));
+	}
+
+	return recorder_open(rec);
+}
+
+/* Write one CSV line from a monitoring response */
+static int recorder_write(struct recorder *rec, struct json_object *obj, const struct timespec *timestamp)
+{
+	int ret;
+
+	if (rec->path != NULL && rec->max_size > 0 && rec->size >= rec->max_size) {
+		if (recorder_rotate(rec) < 0)
+			return -1;
+	}
+
+	ret = fprintf(rec->file, "%lld.%03ld", (long long) timestamp->tv_sec, timestamp->tv_nsec / 1000000);
+	for (size_t i = 0; i < sizeof(csv_columns) / sizeof(csv_columns[0]); i++) {
+		struct json_object *object;
+		struct json_object *field;
+
+		if (json_object_object_get_ex(obj, csv_columns[i].object, &object) &&
+		    json_object_object_get_ex(object, csv_columns[i].field, &field))
+			ret += fprintf(rec->file, ",%s", json_object_get_string(field));
+		else
+			ret += fprintf(rec->file, ",");
+	}
+	ret += fprintf(rec->file, "\n");
+	/* At most one sample is lost if we get killed */
+	fflush(rec->file);
+	rec->size += ret;
+	return 0;
+}
+
+/* Sleep for delay seconds unless a signal stops the program */
+static void sleep_interruptible(int delay)
+{
+	struct timespec ts = { .tv_sec = delay, .tv_nsec = 0 };
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Watch mode: sample monitoring data every interval over a single connection.
+ * Sampling is scheduled on absolute deadlines so it does not drift, and the
+ * connection is reopened with an exponential backoff when lost.
+ */
+static int watch(const char *socket_addr, const char *socket_port, double interval, long count, struct recorder *rec)
+{
+	const int request = REQUEST_NONE;
+	struct receiver rcv = { .len = 0, .offset = 0 };
+	struct timespec next;
+	int reconnect_delay = 1;
+	int socket_fd = -1;
+	long samples = 0;
+	int ret = 0;
+
+	rcv.tok = json_tokener_new();
+	if (rcv.tok == NULL) {
+		log_error("Could not allocate json tokener");
+		return EXIT_FAILURE;
+	}
+	if (recorder_open(rec) < 0) {
+		json_tokener_free(rcv.tok);
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (running && (count == 0 || samples < count)) {
+		struct json_object *obj;
+		struct timespec now;
+
+		if (socket_fd < 0) {
+			socket_fd = connect_to_server(socket_addr, socket_port);
+			if (socket_fd < 0) {
+				log_warn("Reconnecting in %d s", reconnect_delay);
+				sleep_interruptible(reconnect_delay);
+				reconnect_delay *= 2;
+				if (reconnect_delay > RECONNECT_DELAY_MAX_S)
+					reconnect_delay = RECONNECT_DELAY_MAX_S;
+				continue;
+			}
+			log_info("Connected to %s:%s", socket_addr ? socket_addr : "localhost", socket_port);
+			json_tokener_reset(rcv.tok);
+			rcv.len = 0;
+			rcv.offset = 0;
+			clock_gettime(CLOCK_MONOTONIC, &next);
+		}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (json_send_requests(socket_fd, &request, 1) < 0 ||
+		    (obj = json_receive(socket_fd, &rcv)) == NULL) {
+			log_warn("Connection to %s:%s lost, reconnecting in %d s",
+				socket_addr ? socket_addr : "localhost", socket_port, reconnect_delay);
+			close(socket_fd);
+			socket_fd = -1;
+			sleep_interruptible(reconnect_delay);
+			reconnect_delay *= 2;
+			if (reconnect_delay > RECONNECT_DELAY_MAX_S)
+				reconnect_delay = RECONNECT_DELAY_MAX_S;
+			continue;
+		}
+		ret = recorder_write(rec, obj, &now);
+		json_object_put(obj);
+		if (ret < 0)
+			break;
+		samples++;
+		reconnect_delay = 1;
+
+		next.tv_sec += (time_t) interval;
+		next.tv_nsec += (long) ((interval - (time_t) interval) * 1000000000.0);
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec)) {
+			/* We are late, do not try to catch up with a burst of samples */
+			next = now;
+			continue;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	if (socket_fd >= 0)
+		close(socket_fd);
+	if (rec->file != NULL && rec->file != stdout)
+		fclose(rec->file);
+	json_tokener_free(rcv.tok);
+	log_info("%ld samples recorded", samples);
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	int c;
+	int request;
+	int requests[MAX_REQUESTS];
+	int nb_requests = 0;
+	const char* socket_port = NULL;
+	const char* socket_addr = NULL;
+	double interval = 0.0;
+	long count = 0;
+	struct recorder rec = {
+		.path = NULL,
+		.file = NULL,
+		.max_size = 0,
+		.max_files = DEFAULT_ROTATED_FILES,
+		.size = 0,
+	};
+
+	while ((c = getopt(argc, argv, "a:p:r:i:n:o:s:k:h")) != -1)
+	switch (c)
+	{
+		case 'i':
+			interval = atof(optarg);
+			if (interval <= 0.0) {
+				log_error("Bad interval %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'o':
+			rec.path = optarg;
+			break;
+		case 's':
+			rec.max_size = atol(optarg) * 1024;
+			break;
+		case 'k':
+			rec.max_files = atoi(optarg);
+			break;
+		case 'a':
+			socket_addr = optarg;
+			break;
+		case 'p':
+			socket_port = optarg;
+			break;
+		case 'r':
+		if (nb_requests >= MAX_REQUESTS) {
+			log_error("Too many requests, at most %d can be sent", MAX_REQUESTS);
+			return -1;
+		}
+		if (strcmp(optarg, "calibration") == 0)
+			request = REQUEST_CALIBRATION;
+		else if (strcmp(optarg, "gnss_start") == 0)
+			request = REQUEST_GNSS_START;
+		else if (strcmp(optarg, "gnss_stop") == 0)
+			request = REQUEST_GNSS_STOP;
+		else if (strcmp(optarg, "gnss_soft") == 0)
+			request = REQUEST_GNSS_SOFT;
+		else if (strcmp(optarg, "gnss_hard") == 0)
+			request = REQUEST_GNSS_HARD;
+		else if (strcmp(optarg, "gnss_cold") == 0)
+			request = REQUEST_GNSS_COLD;
+		else if (strcmp(optarg, "read_eeprom") == 0)
+			request = REQUEST_READ_EEPROM;
+		else if (strcmp(optarg, "save_eeprom") == 0)
+			request = REQUEST_SAVE_EEPROM;
+		else if (strcmp(optarg, "fake_holdover_start") == 0)
+			request = REQUEST_FAKE_HOLDOVER_START;
+		else if (strcmp(optarg, "fake_holdover_stop") == 0)
+			request = REQUEST_FAKE_HOLDOVER_STOP;
+		else if (strcmp(optarg, "mro_coarse_inc") == 0)
+			request = REQUEST_MRO_COARSE_INC;
+		else if (strcmp(optarg, "mro_coarse_dec") == 0)
+			request = REQUEST_MRO_COARSE_DEC;
+		else {
+			log_error("Unknown request %s", optarg);
+			return -1;
+		}
+		requests[nb_requests++] = request;
+		log_info("Action requested: %s", optarg);
+		break;
+	case 'h':
+		print_help();
+		return 0;
+	case '?':
+		if (optopt == 'r')
+			fprintf (stderr, "Option -%c requires request type.\n", optopt);
+		else
+			fprintf (stderr,
+					"Unknown option character `\\x%x'.\n",
+					optopt);
+		return EXIT_FAILURE;
+	default:
+		abort();
+	}
+
+	if (nb_requests == 0)
+		requests[nb_requests++] = REQUEST_NONE;
+
+	if (socket_port == NULL) {
+		log_error("Bad port");
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (interval > 0.0) {
+		struct sigaction sa = { .sa_handler = signal_handler };
+
+		if (nb_requests > 1 || requests[0] != REQUEST_NONE) {
+			log_error("Requests cannot be sent in watch mode");
+			return EXIT_FAILURE;
+		}
+		/* No SA_RESTART, blocking calls must return to check running */
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		signal(SIGPIPE, SIG_IGN);
+		return watch(socket_addr, socket_port, interval, count, &rec);
+	}
+
+	int socket_fd = connect_to_server(socket_addr, socket_port);
+	if (socket_fd < 0)
+		return EXIT_FAILURE;
+
+	struct receiver rcv = { .len = 0, .offset = 0 };
+	int ret = EXIT_SUCCESS;
+
+	rcv.tok = json_tokener_new();
+	if (rcv.tok == NULL) {
+		log_error("Could not allocate json tokener");
+		close(socket_fd);
+		return EXIT_FAILURE;
+	}
+
+	/* Request data through socket */
+	if (json_send_requests(socket_fd, requests, nb_requests) < 0) {
+		log_error("FAIL");
+		ret = EXIT_FAILURE;
+		goto out;
+	}
+
+	/* One response is received per request, matched by id */
+	for (int i = 0; i < nb_requests; i++) {
+		struct json_object *obj = json_receive(socket_fd, &rcv);
+		if (obj == NULL) {
+			log_error("FAIL");
+			ret = EXIT_FAILURE;
+			goto out;
+		}
+		print_response(obj, requests, nb_requests);
+		json_object_put(obj);
+	}
+	log_info("PASSED !");
+
+out:
+	json_tokener_free(rcv.tok);
+	close(socket_fd);
+	return ret;
 }